@@ -26,45 +26,69 @@
 #include <stdint.h>
 #include "khash.h"
 #include "binidx.h"
+#include "iitidx.h"
+
+#define BIOIDX_BACKEND_BIN 0
+#define BIOIDX_BACKEND_IIT 1
 
 KHASH_MAP_INIT_INT(idx, void *)
 typedef struct bioidx_t{
     khash_t(idx) *idx;
     uint32_t min_shift;
     uint32_t step;
+    int backend;
 } bioidx_t;
 
-typedef binidx_itr_t bioidx_itr_t;
+typedef struct bioidx_itr_t{
+    int backend;
+    union {
+        binidx_itr_t bin;
+        iitidx_itr_t iit;
+    } u;
+} bioidx_itr_t;
 
-bioidx_t *bioidx_init(){
+bioidx_t *bioidx_init_backend(int backend){
     bioidx_t *bioidx;
+    if (backend != BIOIDX_BACKEND_BIN && backend != BIOIDX_BACKEND_IIT) return NULL;
     bioidx = malloc(sizeof(*bioidx));
     if (!bioidx) return NULL;
     bioidx->idx = kh_init(idx);
     if (!bioidx->idx) {free(bioidx); return NULL;}
     bioidx->min_shift = 12;
     bioidx->step = 3;
+    bioidx->backend = backend;
     return bioidx;
 }
 
+bioidx_t *bioidx_init(){
+    return bioidx_init_backend(BIOIDX_BACKEND_BIN);
+}
+
 void bioidx_destroy(bioidx_t *bioidx){
     khiter_t k;
     khash_t (idx) *h = bioidx->idx;
     for (k = kh_begin(h); k != kh_end(h); ++k)
-        if (kh_exist(h, k))
-            binidx_destroy(kh_val(h, k));
+        if (kh_exist(h, k)){
+            if (bioidx->backend == BIOIDX_BACKEND_IIT) iitidx_destroy(kh_val(h, k));
+            else binidx_destroy(kh_val(h, k));
+        }
     kh_destroy(idx, h);
     free(bioidx);
 }
 
+/* min_shift and step only apply to the bin backend */
 int bioidx_chrom_insert(bioidx_t *bioidx, int32_t bioidx_key, uint32_t min_shift, uint32_t step){
     khiter_t k;
     int ret;
-    binidx_t *binidx = binidx_init(min_shift, step);
-    if (!binidx) return -1;
+    void *cidx = bioidx->backend == BIOIDX_BACKEND_IIT? iitidx_init(): binidx_init(min_shift, step);
+    if (!cidx) return -1;
     k = kh_put(idx, bioidx->idx, bioidx_key, &ret);
-    if (ret < 1) {binidx_destroy(binidx); return -1;} /*operation failed or key already present*/
-    kh_val(bioidx->idx, k) = binidx;
+    if (ret < 1) { /*operation failed or key already present*/
+        if (bioidx->backend == BIOIDX_BACKEND_IIT) iitidx_destroy(cidx);
+        else binidx_destroy(cidx);
+        return -1;
+    }
+    kh_val(bioidx->idx, k) = cidx;
     return 0;
 }
 
@@ -75,17 +99,30 @@ int bioidx_insert(bioidx_t *bioidx, int32_t bioidx_key, int32_t start, int32_t e
         if (bioidx_key == -1 || bioidx_chrom_insert(bioidx, bioidx_key, bioidx->min_shift, bioidx->step) < 0) return -1;
         k = kh_get(idx, bioidx->idx, bioidx_key);
     }
+    if (bioidx->backend == BIOIDX_BACKEND_IIT) return iitidx_insert(kh_val(bioidx->idx, k), start, end, data);
     return binidx_insert(kh_val(bioidx->idx, k), start, end, data);
 }
 
+int bioidx_build(bioidx_t *bioidx){
+    khiter_t k;
+    khash_t (idx) *h = bioidx->idx;
+    if (bioidx->backend != BIOIDX_BACKEND_IIT) return 0;
+    for (k = kh_begin(h); k != kh_end(h); ++k)
+        if (kh_exist(h, k) && iitidx_build(kh_val(h, k)) != 0) return -1;
+    return 0;
+}
+
 int bioidx_search(bioidx_t *bioidx, bioidx_itr_t *itr, int32_t bioidx_key, int32_t start, int32_t end){
     khiter_t k;
+    itr->backend = bioidx->backend;
     k = kh_get(idx, bioidx->idx, bioidx_key);
     if (k == kh_end(bioidx->idx)){
-        itr->bidx = NULL;
+        if (bioidx->backend == BIOIDX_BACKEND_IIT) itr->u.iit.iidx = NULL;
+        else itr->u.bin.bidx = NULL;
         return 0;
     }
-    return binidx_search(kh_val(bioidx->idx, k), itr, start, end);
+    if (bioidx->backend == BIOIDX_BACKEND_IIT) return iitidx_search(kh_val(bioidx->idx, k), &itr->u.iit, start, end);
+    return binidx_search(kh_val(bioidx->idx, k), &itr->u.bin, start, end);
 }
 
 bioidx_itr_t *bioidx_itr_init(){
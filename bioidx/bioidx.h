@@ -27,12 +27,19 @@
 #define __BIOIDX_H
 
 #include <stdint.h>
+#include "iitidx_itr.h"
 
 #define BIOIDX_VERSION "1.0.0"
 static inline int32_t bioidx_key(int32_t tid, char strand){
     return ((tid >= 0 && (strand)=='-')?(INT32_MIN+tid):(tid));
 }
 typedef struct bioidx_t bioidx_t;
+
+/* hierarchical bins of linked items, which can be inserted and searched in any order */
+#define BIOIDX_BACKEND_BIN 0
+/* implicit interval tree over an array per key, built by bioidx_build() or the first search after inserting */
+#define BIOIDX_BACKEND_IIT 1
+
 typedef struct binidx_itr_t{
     void *bidx;
     int32_t start;
@@ -43,22 +50,35 @@ typedef struct binidx_itr_t{
     void *prev_item;
     int l;
 } binidx_itr_t;
-typedef binidx_itr_t bioidx_itr_t;
+typedef struct bioidx_itr_t{
+    int backend;
+    union {
+        binidx_itr_t bin;
+        iitidx_itr_t iit;
+    } u;
+} bioidx_itr_t;
 bioidx_t *bioidx_init();
+bioidx_t *bioidx_init_backend(int backend);
 void bioidx_destroy(bioidx_t *bioidx);
 int bioidx_chrom_insert(bioidx_t *bioidx, int32_t bioidx_key, uint32_t min_shift, uint32_t step);
 int bioidx_insert(bioidx_t *bioidx, int32_t bioidx_key, int32_t start, int32_t end, void *data);
+/* finish the inserts before searching from several threads */
+int bioidx_build(bioidx_t *bioidx);
 int bioidx_search(bioidx_t *bioidx, bioidx_itr_t *itr, int32_t bioidx_key, int32_t start, int32_t end);
 bioidx_itr_t *bioidx_itr_init();
 void bioidx_itr_destroy(bioidx_itr_t *itr);
 void *binidx_itr_next(void *itr);
 int binidx_itr_remove(void *itr);
+void *iitidx_itr_next(void *itr);
+int iitidx_itr_remove(void *itr);
 static inline void *bioidx_itr_next(bioidx_itr_t *itr){
-    if (!itr->bidx) return NULL;
-    return binidx_itr_next(itr);
+    if (itr->backend == BIOIDX_BACKEND_IIT) return itr->u.iit.iidx? iitidx_itr_next(&itr->u.iit): NULL;
+    if (!itr->u.bin.bidx) return NULL;
+    return binidx_itr_next(&itr->u.bin);
 }
 static inline int bioidx_itr_remove(bioidx_itr_t *itr) {
-    if (!itr->bidx) return -1;
-    return binidx_itr_remove(itr);
+    if (itr->backend == BIOIDX_BACKEND_IIT) return itr->u.iit.iidx? iitidx_itr_remove(&itr->u.iit): -1;
+    if (!itr->u.bin.bidx) return -1;
+    return binidx_itr_remove(&itr->u.bin);
 }
 #endif /* __BIOIDX_H */
\ No newline at end of file
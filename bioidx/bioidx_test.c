@@ -26,12 +26,13 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include "bioidx.h"
-int main(){
+
+static void demo(int backend){
     const char * n1 = "reg1";
     const char * n2 = "reg2";
     const char * n3 = "reg3";
     const char * n4 = "reg4";
-    bioidx_t *bidx = bioidx_init();
+    bioidx_t *bidx = bioidx_init_backend(backend);
     bioidx_itr_t *bitr ;
     bitr = bioidx_itr_init();
     bioidx_insert(bidx, 0, 200, 100000, (void *)n4);
@@ -50,4 +51,95 @@ int main(){
     while ((ret = bioidx_itr_next(bitr)) != NULL) fprintf(stderr, "3:%s\n", ret);
     bioidx_destroy(bidx);
     bioidx_itr_destroy(bitr);
-}
\ No newline at end of file
+}
+
+/* scan all the items that are still in the index */
+static void brute_query(int32_t *item, char *alive, int n_item, int32_t key, int32_t start, int32_t end, int64_t *n, int64_t *sum){
+    int j;
+    *n = *sum = 0;
+    for (j = 0; j < n_item; ++j)
+        if (j % 3 == key && alive[j] && item[2 * j] < end && item[2 * j + 1] > start) {(*n)++; *sum += 2 * j;}
+}
+
+static int compare_query(bioidx_t *bin, bioidx_t *iit, int32_t *item, char *alive, int n_item, int n_query, int32_t span){
+    bioidx_itr_t itr;
+    int64_t sum0, sum1, sum2, n0, n1, n2;
+    int i, ret = 0;
+    void *d;
+    for (i = 0; i < n_query && ret == 0; ++i){
+        int32_t key = i % 4, start = rand() % span, end = start + 1 + rand() % 5000;
+        sum1 = sum2 = n1 = n2 = 0;
+        bioidx_search(bin, &itr, key, start, end);
+        while ((d = bioidx_itr_next(&itr))) {n1++; sum1 += (int32_t *)d - item;}
+        bioidx_search(iit, &itr, key, start, end);
+        while ((d = bioidx_itr_next(&itr))) {
+            n2++;
+            sum2 += (int32_t *)d - item;
+            if (((int32_t *)d)[0] >= end || ((int32_t *)d)[1] <= start) ret = 1;
+        }
+        brute_query(item, alive, n_item, key, start, end, &n0, &sum0);
+        if (n0 != n1 || sum0 != sum1 || n0 != n2 || sum0 != sum2) ret = 1;
+    }
+    if (ret) fprintf(stderr, "backends differ for query %d of %d items\n", i - 1, n_item);
+    return ret;
+}
+
+/* drop the items of key 0 whose index is a multiple of 7 */
+static void remove_some(bioidx_t *bidx, int32_t *item, char *alive, int32_t span){
+    bioidx_itr_t itr;
+    void *d;
+    bioidx_search(bidx, &itr, 0, 0, span * 2);
+    while ((d = bioidx_itr_next(&itr)))
+        if (((int32_t *)d - item) / 2 % 7 == 0) {
+            bioidx_itr_remove(&itr);
+            alive[((int32_t *)d - item) / 2] = 0;
+        }
+}
+
+/* both backends should find the same items as a scan for random intervals and queries */
+static int compare(int n_item, int n_query, int32_t span){
+    bioidx_t *bin = bioidx_init_backend(BIOIDX_BACKEND_BIN);
+    bioidx_t *iit = bioidx_init_backend(BIOIDX_BACKEND_IIT);
+    int32_t *item = malloc(n_item * 2 * sizeof(*item));
+    char *alive = malloc(n_item);
+    int i, ret = 0;
+    srand(11);
+    for (i = 0; i < n_item; ++i){
+        item[2 * i] = rand() % span;
+        item[2 * i + 1] = item[2 * i] + 1 + rand() % (i % 10 == 0? span / 10: 1000);
+        alive[i] = 1;
+        /* the last items are inserted after the first removal, so that the tree is built again */
+        if (i == n_item / 2) {
+            remove_some(bin, item, alive, span);
+            remove_some(iit, item, alive, span);
+        }
+        bioidx_insert(bin, i % 3, item[2 * i], item[2 * i + 1], item + 2 * i);
+        bioidx_insert(iit, i % 3, item[2 * i], item[2 * i + 1], item + 2 * i);
+    }
+    bioidx_build(iit);
+    ret = compare_query(bin, iit, item, alive, n_item, n_query, span);
+    if (ret == 0) {
+        remove_some(bin, item, alive, span);
+        remove_some(iit, item, alive, span);
+        ret = compare_query(bin, iit, item, alive, n_item, n_query, span);
+    }
+    bioidx_destroy(bin);
+    bioidx_destroy(iit);
+    free(item);
+    free(alive);
+    return ret;
+}
+
+int main(){
+    fprintf(stderr, "[bin]\n");
+    demo(BIOIDX_BACKEND_BIN);
+    fprintf(stderr, "[iit]\n");
+    demo(BIOIDX_BACKEND_IIT);
+    int n;
+    /* the small and odd sizes leave the rightmost path of the tree partly outside the array */
+    for (n = 1; n <= 900; ++n)
+        if (compare(n, 500, 100000)) return 1;
+    if (compare(100000, 2000, 10000000)) return 1;
+    fprintf(stderr, "backends agree\n");
+    return 0;
+}
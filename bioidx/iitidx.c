@@ -0,0 +1,185 @@
+/* The MIT License (MIT)
+
+   Copyright (c) 2023 Anrui Liu <liuar6@gmail.com>
+
+   Permission is hereby granted, free of charge, to any person obtaining
+   a copy of this software and associated documentation files (the
+   “Software”), to deal in the Software without restriction, including
+   without limitation the rights to use, copy, modify, merge, publish,
+   distribute, sublicense, and/or sell copies of the Software, and to
+   permit persons to whom the Software is furnished to do so, subject to
+   the following conditions:
+
+   The above copyright notice and this permission notice shall be
+   included in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+   EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+   MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+   NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+   BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+   ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+   CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include "iitidx.h"
+
+/* subtrees of at most this level are scanned linearly */
+#define IIT_SCAN_LEVEL 3
+
+void *iitidx_init(){
+    return calloc(1, sizeof(iitidx_t));
+}
+
+void iitidx_destroy(void *_iidx){
+    iitidx_t *iidx = _iidx;
+    free(iidx->a);
+    free(iidx);
+}
+
+int iitidx_insert(void *_iidx, int32_t start, int32_t end, void *data){
+    iitidx_t *iidx = _iidx;
+    iit_item_t *item;
+    if (start < 0 || end <= start) return -1;
+    if (iidx->n == iidx->m){
+        int64_t m = iidx->m? iidx->m << 1: 16;
+        iit_item_t *new_a = realloc(iidx->a, m * sizeof(*new_a));
+        if (!new_a) return -1;
+        iidx->a = new_a;
+        iidx->m = m;
+    }
+    item = iidx->a + iidx->n++;
+    item->start = start;
+    item->end = end;
+    item->max = end;
+    item->data = data;
+    iidx->dirty = 1;
+    return 0;
+}
+
+static int iit_item_comp(const void *a, const void *b){
+    const iit_item_t *i1 = a, *i2 = b;
+    if (i1->start != i2->start) return i1->start < i2->start? -1: 1;
+    return (i1->end > i2->end) - (i1->end < i2->end);
+}
+
+int iitidx_build(void *_iidx){
+    iitidx_t *iidx = _iidx;
+    iit_item_t *a;
+    int64_t i, j, last_i, n;
+    int32_t last = 0;
+    int k;
+    if (!iidx->dirty) return 0;
+    /* drop the removed items */
+    for (i = j = 0; i < iidx->n; ++i)
+        if (iidx->a[i].end >= 0) iidx->a[j++] = iidx->a[i];
+    iidx->n = n = j;
+    iidx->dirty = 0;
+    iidx->max_level = -1;
+    if (n == 0) return 0;
+    a = iidx->a;
+    qsort(a, n, sizeof(*a), iit_item_comp);
+    /* the leaves are the even indices */
+    for (i = last_i = 0; i < n; i += 2) {
+        last_i = i;
+        last = a[i].max = a[i].end;
+    }
+    for (k = 1; (int64_t)1 << k <= n; ++k) {
+        int64_t x = (int64_t)1 << (k - 1), i0 = (x << 1) - 1, step = x << 2;
+        for (i = i0; i < n; i += step) {
+            int32_t el = a[i - x].max;
+            int32_t er = i + x < n? a[i + x].max: last;
+            int32_t e = a[i].end;
+            e = e > el? e: el;
+            e = e > er? e: er;
+            a[i].max = e;
+        }
+        /* move last_i to its parent, whose right subtree may be out of the array */
+        last_i = last_i >> k & 1? last_i - x: last_i + x;
+        if (last_i < n && a[last_i].max > last) last = a[last_i].max;
+    }
+    iidx->max_level = k - 1;
+    return 0;
+}
+
+int iitidx_search(void *_iidx, void *_itr, int32_t start, int32_t end){
+    iitidx_t *iidx = _iidx;
+    iitidx_itr_t *itr = _itr;
+    if (start < 0 || end <= start) return -1;
+    if (iidx->dirty && iitidx_build(iidx) != 0) return -1;
+    itr->iidx = iidx;
+    itr->start = start;
+    itr->end = end;
+    itr->i = itr->i1 = 0;
+    itr->last = -1;
+    itr->t = 0;
+    if (iidx->n > 0){
+        itr->stack[0].k = iidx->max_level;
+        itr->stack[0].x = ((int64_t)1 << iidx->max_level) - 1;
+        itr->stack[0].w = 0;
+        itr->t = 1;
+    }
+    return 0;
+}
+
+/* a depth-first walk of the tree with an explicit stack, resumed at each call */
+void *iitidx_itr_next(void *_itr){
+    iitidx_itr_t *itr = _itr;
+    const iit_item_t *a = itr->iidx->a;
+    int64_t n = itr->iidx->n;
+    int32_t start = itr->start, end = itr->end;
+    iit_stack_t z;
+    for (;;){
+        while (itr->i < itr->i1){
+            int64_t i = itr->i++;
+            if (a[i].start >= end) {
+                itr->i = itr->i1;
+                break;
+            }
+            if (start < a[i].end) {
+                itr->last = i;
+                return a[i].data;
+            }
+        }
+        if (itr->t == 0) return NULL;
+        z = itr->stack[--itr->t];
+        if (z.k <= IIT_SCAN_LEVEL) {
+            itr->i = z.x >> z.k << z.k;
+            itr->i1 = itr->i + ((int64_t)1 << (z.k + 1)) - 1;
+            if (itr->i1 > n) itr->i1 = n;
+        } else if (z.w == 0) {
+            /* revisit the node once its left subtree is done, which is skipped when it ends before the query */
+            int64_t y = z.x - ((int64_t)1 << (z.k - 1));
+            itr->stack[itr->t].k = z.k;
+            itr->stack[itr->t].x = z.x;
+            itr->stack[itr->t++].w = 1;
+            if (y >= n || a[y].max > start) {
+                itr->stack[itr->t].k = z.k - 1;
+                itr->stack[itr->t].x = y;
+                itr->stack[itr->t++].w = 0;
+            }
+        } else if (z.x < n && a[z.x].start < end) {
+            itr->stack[itr->t].k = z.k - 1;
+            itr->stack[itr->t].x = z.x + ((int64_t)1 << (z.k - 1));
+            itr->stack[itr->t++].w = 0;
+            if (start < a[z.x].end) {
+                itr->last = z.x;
+                return a[z.x].data;
+            }
+        }
+    }
+}
+
+/* the item stays in the array with an end of -1, which no query overlaps, until the next build */
+int iitidx_itr_remove(void *_itr){
+    iitidx_itr_t *itr = _itr;
+    iit_item_t *item;
+    if (itr->last < 0) return -1;
+    item = itr->iidx->a + itr->last;
+    item->end = -1;
+    itr->last = -1;
+    return 0;
+}
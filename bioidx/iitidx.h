@@ -0,0 +1,58 @@
+/* The MIT License (MIT)
+
+   Copyright (c) 2023 Anrui Liu <liuar6@gmail.com>
+
+   Permission is hereby granted, free of charge, to any person obtaining
+   a copy of this software and associated documentation files (the
+   “Software”), to deal in the Software without restriction, including
+   without limitation the rights to use, copy, modify, merge, publish,
+   distribute, sublicense, and/or sell copies of the Software, and to
+   permit persons to whom the Software is furnished to do so, subject to
+   the following conditions:
+
+   The above copyright notice and this permission notice shall be
+   included in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+   EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+   MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+   NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+   BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+   ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+   CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+ */
+
+#ifndef __IITIDX_H
+#define __IITIDX_H
+
+#include <stdint.h>
+#include "iitidx_itr.h"
+
+/* implicit augmented interval tree: the items are kept in an array sorted by start, in which the node of level k
+ * sits at an index whose lowest k bits are 1 and holds the max end of its subtree. Inserting only appends; the
+ * array is sorted and the max ends computed by iitidx_build(). */
+typedef struct iit_item_t{
+    int32_t start;
+    int32_t end; /* -1 once the item is removed */
+    int32_t max;
+    void *data;
+} iit_item_t;
+
+typedef struct iitidx_t{
+    iit_item_t *a;
+    int64_t n;
+    int64_t m;
+    int max_level;
+    int dirty; /* items were inserted since the last build */
+} iitidx_t;
+
+void *iitidx_init();
+void iitidx_destroy(void *_iidx);
+int iitidx_insert(void *_iidx, int32_t start, int32_t end, void *data);
+int iitidx_build(void *_iidx);
+int iitidx_search(void *_iidx, void *_itr, int32_t start, int32_t end);
+void *iitidx_itr_next(void *_itr);
+int iitidx_itr_remove(void *_itr);
+
+#endif /* __IITIDX_H */
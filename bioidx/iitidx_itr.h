@@ -0,0 +1,51 @@
+/* The MIT License (MIT)
+
+   Copyright (c) 2023 Anrui Liu <liuar6@gmail.com>
+
+   Permission is hereby granted, free of charge, to any person obtaining
+   a copy of this software and associated documentation files (the
+   “Software”), to deal in the Software without restriction, including
+   without limitation the rights to use, copy, modify, merge, publish,
+   distribute, sublicense, and/or sell copies of the Software, and to
+   permit persons to whom the Software is furnished to do so, subject to
+   the following conditions:
+
+   The above copyright notice and this permission notice shall be
+   included in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+   EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+   MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+   NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+   BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+   ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+   CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+ */
+
+#ifndef __IITIDX_ITR_H
+#define __IITIDX_ITR_H
+
+#include <stdint.h>
+
+/* the iterator of iitidx, shared with bioidx.h so that bioidx_itr_t can hold it by value */
+struct iitidx_t;
+
+typedef struct iit_stack_t{
+    int64_t x;
+    int32_t k;
+    int32_t w;
+} iit_stack_t;
+
+typedef struct iitidx_itr_t{
+    struct iitidx_t *iidx;
+    int32_t start;
+    int32_t end;
+    int64_t i;    /* next item of the linear scan of a small subtree */
+    int64_t i1;   /* end of the linear scan, i == i1 when there is none */
+    int64_t last; /* the item returned last, -1 for none */
+    int t;
+    iit_stack_t stack[64];
+} iitidx_itr_t;
+
+#endif /* __IITIDX_ITR_H */
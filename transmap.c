@@ -27,60 +27,132 @@
 #include <getopt.h>
 #include <stdio.h>
 #include <stdint.h>
+#include <inttypes.h>
+#include <unistd.h>
 #include "htslib/sam.h"
+#include "htslib/thread_pool.h"
 #include "bioidx/bioidx.h"
 #include "transmap.h"
+#include "transmap_pipe.h"
+#include "transmap_split.h"
+#include "transmap_shard.h"
+#include "transmap_sorted.h"
+#include "transmap_collate.h"
+#include "transmap_sort.h"
+#include "transmap_io.h"
+#include "transmap_text.h"
+#include "transmap_expand.h"
+#include "transmap_tcc.h"
+#include "transmap_count.h"
+#include "transmap_cov.h"
+#include "transmap_frag.h"
+#include "transmap_col.h"
+#include "transmap_ref.h"
+#include "transmap_tagsplit.h"
+#include "transmap_part.h"
+#include "transmap_multi.h"
 
 int main(int argc, char *argv[]) {
     struct transmap_option options;
     struct transmap_statistic statistics;
+    int run_shard = 0;
+    if (argc > 1 && strcmp(argv[1], "plan") == 0) return transmap_plan_main(argc - 1, argv + 1);
+    if (argc > 1 && strcmp(argv[1], "merge") == 0) return transmap_merge_main(argc - 1, argv + 1);
+    if (argc > 1 && strcmp(argv[1], "expand") == 0) return transmap_expand_main(argc - 1, argv + 1);
+    if (argc > 1 && strcmp(argv[1], "run") == 0) {run_shard = 1; argc--; argv++;}
     memset(&statistics, 0, sizeof(struct transmap_statistic));
     transmap_option(&options, argc, argv);
     if (options.show_help || options.show_version) return 0;
+    if (run_shard && options.shard < 0) transmap_usage("[transmap run] Error: you should specify the shard via --shard.");
+    char *run_stats_file = NULL;
+    if (run_shard && !options.stats_file){
+        if (!(run_stats_file = malloc(strlen(options.out_file) + strlen(".stats") + 1))) return 1;
+        sprintf(run_stats_file, "%s.stats", options.out_file);
+        options.stats_file = run_stats_file;
+    }
+    /* the reference of a CRAM output is kept next to it unless --transcriptome names it */
+    char *cram_ref_file = NULL;
+    if (options.genome_file && !options.ref_file){
+        if (!(cram_ref_file = malloc(strlen(options.out_file) + strlen(".fa") + 1))) return 1;
+        sprintf(cram_ref_file, "%s.fa", options.out_file);
+        options.ref_file = cram_ref_file;
+    }
 
     int ret;
     sam_parser_t *sam = NULL;
     samFile *out = NULL;
     sam_hdr_t *new_hdr = NULL;
-    bam1_t **record;
-    bam_vector_t *r1v = NULL, *r2v = NULL;
-    bam_vector_t *bv = NULL;
-    vec_t(bed) *bed_hit = NULL;
-    vec_t(exon) *exon_hit = NULL;
-
-    if (!(bv = bam_vector_init())) {ret = 1; goto clean_up;}
-    if (!(r1v = bam_vector_init())) {ret = 1; goto clean_up;}
-    if (!(r2v = bam_vector_init())) {ret = 1; goto clean_up;}
-    if (!(bed_hit = vec_init(bed))) {ret = 1; goto clean_up;}
-    if (!(exon_hit = vec_init(exon))) {ret = 1; goto clean_up;}
-
+    htsThreadPool tpool = {NULL, 0};
+    transmap_batch_t *batch = NULL;
+    transmap_worker_t worker;
+    transmap_out_t output = {0};
     bed_dict_t *bed = NULL;
     gtf_dict_t *gtf = NULL;
-    uint8_t *buffer = NULL;
-    size_t buffer_size = 0;
-    int ret_val, count;
+    void *dict;
+    transmap_extra_t *extra[TRANSMAP_MAX_ANNOT];
+    int i, n_extra = 0;
+    memset(&worker, 0, sizeof(worker));
 
     new_hdr = sam_hdr_init();
     if (!new_hdr){
         ret = 1;
         goto clean_up;
     }
-    if ((sam = sam_parser_open(options.sam_file)) == NULL){
+    if (options.n_threads > 1 && !(tpool.pool = hts_tpool_init(options.n_threads))){
+        fprintf(stderr, "[transmap] Error: can not create the thread pool.\n");
+        ret = 1;
+        goto clean_up;
+    }
+    if ((sam = sam_parser_open(options.sam_file, &tpool, options.io_backend)) == NULL){
         fprintf(stderr, "[transmap] Error: can not open the input bam file.\n");
         ret = 1;
         goto clean_up;
     }
+    if (options.shard >= 0){
+        int64_t shard_start, shard_end;
+        if (transmap_manifest_read(options.manifest, options.shard, &shard_start, &shard_end) != 0){
+            fprintf(stderr, "[transmap] Error: can not find shard %d in the manifest file.\n", options.shard);
+            ret = 1;
+            goto clean_up;
+        }
+        if (sam_parser_range(sam, shard_start, shard_end) != 0){
+            fprintf(stderr, "[transmap] Error: can not seek to shard %d of the input bam file.\n", options.shard);
+            ret = 1;
+            goto clean_up;
+        }
+    }
+    if (options.others & OPTION_COLLATE){
+        char prefix[32];
+        if (strcmp(options.out_file, "-") == 0) sprintf(prefix, "transmap.%d", (int)getpid());
+        if (sam_parser_collate(sam, strcmp(options.out_file, "-") == 0? prefix: options.out_file, options.n_bucket, (size_t)options.collate_memory << 20u, &tpool) != 0){
+            fprintf(stderr, "[transmap] Error: can not collate the input bam file.\n");
+            ret = 1;
+            goto clean_up;
+        }
+    }
     char out_mode[3];
     strncpy(out_mode, "w\0\0", 3);
     if (strcmp(options.out_file + strlen(options.out_file) - 4, ".bam") == 0) out_mode[1] = 'b';
-    if ((out = sam_open(options.out_file, out_mode)) == NULL){
+    else if (transmap_is_cram(options.out_file)) out_mode[1] = 'c';
+    if (options.n_split > 1 && (sam->fp->format.format != bam || out_mode[1] != 'b')){
+        fprintf(stderr, "[transmap] Error: --split requires bam input and bam output.\n");
+        ret = 1;
+        goto clean_up;
+    }
+    if (options.n_split <= 1 && !(options.others & OPTION_NO_OUTPUT) && (out = sam_open(options.out_file, out_mode)) == NULL){
         fprintf(stderr, "[transmap] Error: can not open the output bam file.");
         ret = 1;
         goto clean_up;
     }
+    /* sam text output is formatted by sam_text_t, which writes to the file directly */
+    if (out && tpool.pool && out_mode[1] != '\0' && hts_set_opt(out, HTS_OPT_THREAD_POOL, &tpool) != 0){
+        fprintf(stderr, "[transmap] Error: can not attach the thread pool to the output bam file.");
+        ret = 1;
+        goto clean_up;
+    }
 
     if (options.others & OPTION_GTF_MODE){
-        if (!(gtf = gtf_parse(options.in_file, options.gtf_feature, options.gtf_attribute))){
+        if (!(gtf = gtf_parse(options.in_file, options.gtf_feature, options.gtf_attribute, options.count_group, options.index_backend))){
             fprintf(stderr, "[transmap] Error: can not open the gtf file.");
             ret = 1;
             goto clean_up;
@@ -91,8 +163,9 @@ int main(int argc, char *argv[]) {
             goto clean_up;
         }
         if (gtf->record->size > options.index_cutoff) options.others |= OPTION_USE_INDEX;
+        dict = gtf;
     } else {
-        if (!(bed = bed_parse(options.in_file))){
+        if (!(bed = bed_parse(options.in_file, options.index_backend))){
             fprintf(stderr, "[transmap] Error: can not open the bed file.");
             ret = 1;
             goto clean_up;
@@ -103,6 +176,7 @@ int main(int argc, char *argv[]) {
             goto clean_up;
         }
         if (bed->size > options.index_cutoff) options.others |= OPTION_USE_INDEX;
+        dict = bed;
     }
 
     char *s = NULL;
@@ -113,76 +187,446 @@ int main(int argc, char *argv[]) {
 
         goto clean_up;
     }
+    for (n_extra = 0; n_extra + 1 < options.n_annot; ++n_extra){
+        if (!(extra[n_extra] = transmap_extra_init(options.annot_file[n_extra + 1], options.annot_mode[n_extra + 1], options.annot_out[n_extra + 1], sam->hdr, s, &tpool, &options))){
+            fprintf(stderr, "[transmap] Error: can not prepare the annotation %s.\n", options.annot_file[n_extra + 1]);
+            ret = 1;
+            free(s);
+            goto clean_up;
+        }
+    }
     free(s);
-    if (sam_hdr_write(out, new_hdr) != 0){
+    /* the output of a coordinate-sorted input follows neither the query name nor the new coordinates */
+    if (options.others & OPTION_SORT) {
+        if (sam_hdr_count_lines(new_hdr, "HD") > 0) ret = sam_hdr_update_hd(new_hdr, "SO", "coordinate");
+        else ret = sam_hdr_add_line(new_hdr, "HD", "VN", "1.6", "SO", "coordinate", NULL);
+    } else if (options.others & OPTION_COORDINATE && sam_hdr_count_lines(new_hdr, "HD") > 0) ret = sam_hdr_update_hd(new_hdr, "SO", "unsorted");
+    else ret = 0;
+    if (ret != 0){
+        fprintf(stderr, "[transmap] Error: can not generate the new bam header.");
+        ret = 1;
+        goto clean_up;
+    }
+    if (options.genome_file && transmap_ref_write(options.genome_file, options.ref_file, dict, options.others & OPTION_GTF_MODE, new_hdr) != 0){
+        fprintf(stderr, "[transmap] Error: can not write the transcriptome fasta file.\n");
+        ret = 1;
+        goto clean_up;
+    }
+    if (out && out_mode[1] == 'c' && hts_set_opt(out, CRAM_OPT_REFERENCE, options.ref_file) != 0){
+        fprintf(stderr, "[transmap] Error: can not set the reference of the output cram file.\n");
+        ret = 1;
+        goto clean_up;
+    }
+    if (out && sam_hdr_write(out, new_hdr) != 0){
         fprintf(stderr, "[transmap] Error: can not write the bam header.");
         ret = 1;
         goto clean_up;
     };
-
-    while ((count = sam_parser_next(sam, bv)) > 0){
-        record = bv->data + bv->size - count;
-        if (is_paired(record[0])){
-            ret_val = transmap_paired(record, count, gtf, r1v, r2v, exon_hit, &buffer, &buffer_size, &statistics, &options);
-        } else ret_val = transmap_single(record, count, gtf, r1v, r2v, exon_hit, &buffer, &buffer_size, &statistics, &options);
-        if (ret_val != 0) {ret = 1; goto clean_up;}
-        if (r1v->size >= 1000) {
-            for (int i = 0; i < r1v->size; ++i){
-                if (r1v->data[i]->core.tid != -1) if (sam_write1(out, new_hdr, r1v->data[i]) < 0) {ret = 1; goto clean_up;}
-                if (r2v->data[i]->core.tid != -1) if (sam_write1(out, new_hdr, r2v->data[i]) < 0) {ret = 1; goto clean_up;}
-            }
-            r1v->size = 0;
-            r2v->size = 0;
+    output.fp = out;
+    output.hdr = new_hdr;
+    output.keep_tags = options.keep_tags;
+    if ((options.others & OPTION_SORT) && !(output.sort = bam_sort_init(options.out_file, new_hdr, (size_t)options.sort_memory << 20u, &tpool))){
+        fprintf(stderr, "[transmap] Error: can not allocate the memory for sorting.\n");
+        ret = 1;
+        goto clean_up;
+    }
+    if (options.tcc_file && !(output.tcc = tcc_init())){
+        fprintf(stderr, "[transmap] Error: can not allocate the memory for the equivalence classes.\n");
+        ret = 1;
+        goto clean_up;
+    }
+    if (options.count_file){
+        const char **group = NULL;
+        int n_target = sam_hdr_nref(new_hdr);
+        if (gtf && options.count_group && (group = calloc(n_target > 0? n_target: 1, sizeof(*group)))){
+            for (khiter_t k = 0; k < kh_end(gtf->record); ++k)
+                if (kh_exist(gtf->record, k)) group[kh_val(gtf->record, k)->new_tid] = kh_val(gtf->record, k)->group;
         }
-        if (bv->size >= 1000) bv->size = 0;
+        if ((options.count_group && !group) || !(output.count = count_init(n_target, group, options.count_mode))){
+            fprintf(stderr, "[transmap] Error: can not allocate the memory for the counts.\n");
+            if (group) free(group);
+            ret = 1;
+            goto clean_up;
+        }
+        if (group) free(group);
     }
-    for (int i = 0; i < r1v->size; ++i){
-        if (r1v->data[i]->core.tid != -1) if (sam_write1(out, new_hdr, r1v->data[i]) < 0) {ret = 1; goto clean_up;}
-        if (r2v->data[i]->core.tid != -1) if (sam_write1(out, new_hdr, r2v->data[i]) < 0) {ret = 1; goto clean_up;}
+    if (options.coverage_file && !(output.cov = cov_init(new_hdr))){
+        fprintf(stderr, "[transmap] Error: can not allocate the memory for the coverage.\n");
+        ret = 1;
+        goto clean_up;
+    }
+    if (options.frag_file && !(output.frag = frag_init(options.frag_file, new_hdr))){
+        fprintf(stderr, "[transmap] Error: can not open the fragment file.\n");
+        ret = 1;
+        goto clean_up;
+    }
+    if (options.col_file && !(output.col = col_init(options.col_file))){
+        fprintf(stderr, "[transmap] Error: can not open the columnar file.\n");
+        ret = 1;
+        goto clean_up;
+    }
+    if (options.split_tag){
+        /* the per-value files are named after the output file without its .bam suffix */
+        char *prefix = strndup(options.out_file, strlen(options.out_file) - 4);
+        if (!prefix || !(output.tag_split = tag_split_init(prefix, options.split_tag, new_hdr, options.max_open, &tpool))){
+            fprintf(stderr, "[transmap] Error: can not allocate the memory for splitting by tag.\n");
+            if (prefix) free(prefix);
+            ret = 1;
+            goto clean_up;
+        }
+        free(prefix);
+    }
+    if (options.tee_file){
+        size_t l = strlen(options.tee_file);
+        int tee_bam = l > 4 && strcmp(options.tee_file + l - 4, ".bam") == 0;
+        if (!(output.tee = sam_open(options.tee_file, tee_bam? "wb": "w"))
+            || (tee_bam && tpool.pool && hts_set_opt(output.tee, HTS_OPT_THREAD_POOL, &tpool) != 0)
+            || sam_hdr_write(output.tee, sam->hdr) != 0){
+            fprintf(stderr, "[transmap] Error: can not open the tee output file.\n");
+            ret = 1;
+            goto clean_up;
+        }
+        output.tee_hdr = sam->hdr;
+    }
+    if (options.n_part > 1){
+        char *prefix = strndup(options.out_file, strlen(options.out_file) - 4);
+        int mode = options.others & OPTION_PARTITION_HASH? TRANSMAP_PART_HASH: TRANSMAP_PART_RANGE;
+        if (!prefix || !(output.part = part_init(prefix, new_hdr, options.n_part, mode, &tpool))){
+            fprintf(stderr, "[transmap] Error: can not open the output bam files of the partitions.\n");
+            if (prefix) free(prefix);
+            ret = 1;
+            goto clean_up;
+        }
+        free(prefix);
+    }
+    if (out && out_mode[1] == '\0' && !(output.text = sam_text_init(out, new_hdr, options.others & OPTION_TEXT_THREAD))){
+        fprintf(stderr, "[transmap] Error: can not allocate the memory for the sam output.\n");
+        ret = 1;
+        goto clean_up;
     }
-    fprintf(stderr, "[Read statistics]\n");
-    fprintf(stderr, "Total:                      %d\n", statistics.n_read_processed);
-    fprintf(stderr, "Mapped unique:              %d\n", statistics.read_statistics[TRANSMAP_MAPPED]);
-    fprintf(stderr, "Mapped multiple:            %d\n", statistics.read_statistics[TRANSMAP_MULTI_MAPPED]);
-    fprintf(stderr, "Unmapped unaligned:         %d\n", statistics.read_statistics[TRANSMAP_UNALIGNED]);
-    if (options.others & OPTION_REQUIRE_BOTH_MATE){
-        fprintf(stderr, "Unmapped mate unaligned:    %d\n", statistics.read_statistics[TRANSMAP_MATE_UNALIGNED]);
-        fprintf(stderr, "Unmapped mate missing:      %d\n", statistics.read_statistics[TRANSMAP_MATE_MISSING]);
-        fprintf(stderr, "Unmapped improper pair:     %d\n", statistics.read_statistics[TRANSMAP_PAIR_IMPROPER]);
-    }
-    fprintf(stderr, "Unmapped no overlap:        %d\n", statistics.read_statistics[TRANSMAP_UNMAPPED_NO_OVERLAP]);
-    if (!(options.others & OPTION_ALLOW_PARTIAL)) fprintf(stderr, "Unmapped partial:           %d\n", statistics.read_statistics[TRANSMAP_UNMAPPED_PARTIAL]);
-    if (options.others & OPTION_GTF_MODE) fprintf(stderr, "Unmapped exon imcompatible: %d\n", statistics.read_statistics[TRANSMAP_EXON_IMCOMPATIBLE]);
-    if ((options.others & OPTION_ALLOW_PARTIAL && !(options.others & OPTION_GTF_MODE)) || options.others & OPTION_IRREGULAR) fprintf(stderr, "Unmapped no match:          %d\n", statistics.read_statistics[TRANSMAP_UNMAPPED_NO_MATCH]);
 
-    fprintf(stderr, "\n[Alignment statistics]\n");
-    fprintf(stderr, "Total:                      %d\n", statistics.n_align_processed);
-    fprintf(stderr, "Mapped unique:              %d\n", statistics.align_statistics[TRANSMAP_MAPPED]);
-    fprintf(stderr, "Mapped multiple:            %d\n", statistics.align_statistics[TRANSMAP_MULTI_MAPPED]);
-    if (options.others & OPTION_REQUIRE_BOTH_MATE){
-        fprintf(stderr, "Unmapped mate unaligned:    %d\n", statistics.align_statistics[TRANSMAP_MATE_UNALIGNED]);
-        fprintf(stderr, "Unmapped mate missing:      %d\n", statistics.align_statistics[TRANSMAP_MATE_MISSING]);
-        fprintf(stderr, "Unmapped improper pair:     %d\n", statistics.align_statistics[TRANSMAP_PAIR_IMPROPER]);
-    }
-    fprintf(stderr, "Unmapped no overlap:        %d\n", statistics.align_statistics[TRANSMAP_UNMAPPED_NO_OVERLAP]);
-    if (!(options.others & OPTION_ALLOW_PARTIAL)) fprintf(stderr, "Unmapped partial:           %d\n", statistics.align_statistics[TRANSMAP_UNMAPPED_PARTIAL]);
-    if (options.others & OPTION_GTF_MODE) fprintf(stderr, "Unmapped exon imcompatible: %d\n", statistics.align_statistics[TRANSMAP_EXON_IMCOMPATIBLE]);
-    if ((options.others & OPTION_ALLOW_PARTIAL && !(options.others & OPTION_GTF_MODE)) || options.others & OPTION_IRREGULAR) fprintf(stderr, "Unmapped no match:          %d\n", statistics.align_statistics[TRANSMAP_UNMAPPED_NO_MATCH]);
+    if (options.n_split > 1) {
+        if (transmap_split_run(options.sam_file, options.out_file, new_hdr, dict, &tpool, output.cov, &statistics, &options) != 0) {ret = 1; goto clean_up;}
+    } else if (options.others & OPTION_COORDINATE) {
+        if (transmap_sorted_run(sam, &output, dict, &statistics, &options) != 0) {ret = 1; goto clean_up;}
+    } else if (options.n_workers > 0) {
+        if (transmap_pipe_run(sam, &output, dict, &statistics, &options) != 0) {ret = 1; goto clean_up;}
+    } else {
+        if (transmap_worker_init(&worker, dict, &options) != 0) {ret = 1; goto clean_up;}
+        if (!(batch = transmap_batch_init())) {ret = 1; goto clean_up;}
+        while ((ret = transmap_batch_read(sam, batch, TRANSMAP_BATCH_SIZE)) > 0){
+            if (transmap_batch_map(batch, &worker, &options) != 0) {ret = 1; goto clean_up;}
+            /* before the write, which may tag the input records for --tee */
+            for (i = 0; i < n_extra; ++i) if (transmap_extra_run(extra[i], batch) != 0) {ret = 1; goto clean_up;}
+            if (transmap_batch_write(batch, &output) != 0) {ret = 1; goto clean_up;}
+            transmap_batch_clear(batch);
+        }
+        if (ret < 0) {ret = 1; goto clean_up;}
+        transmap_statistic_merge(&statistics, &worker.statistics);
+    }
+    if (output.sort && bam_sort_finish(output.sort, out) != 0) {ret = 1; goto clean_up;}
+    if (output.text && sam_text_finish(output.text) != 0) {
+        fprintf(stderr, "[transmap] Error: can not write the sam output.\n");
+        ret = 1;
+        goto clean_up;
+    }
+    if (output.tag_split && tag_split_finish(output.tag_split) != 0){
+        fprintf(stderr, "[transmap] Error: can not write the output bam files of the tag values.\n");
+        ret = 1;
+        goto clean_up;
+    }
+    if (output.tee){
+        ret = sam_close(output.tee);
+        output.tee = NULL;
+        if (ret != 0){
+            fprintf(stderr, "[transmap] Error: can not write the tee output file.\n");
+            ret = 1;
+            goto clean_up;
+        }
+    }
+    if (output.part){
+        char *manifest = malloc(strlen(options.out_file) + strlen(".parts.tsv") + 1);
+        if (manifest) sprintf(manifest, "%.*s.parts.tsv", (int)strlen(options.out_file) - 4, options.out_file);
+        if (!manifest || part_finish(output.part, manifest) != 0){
+            fprintf(stderr, "[transmap] Error: can not write the output bam files of the partitions.\n");
+            if (manifest) free(manifest);
+            ret = 1;
+            goto clean_up;
+        }
+        free(manifest);
+    }
+    if (output.tcc && tcc_write(output.tcc, options.tcc_file, new_hdr) != 0){
+        fprintf(stderr, "[transmap] Error: can not write the equivalence class file.\n");
+        ret = 1;
+        goto clean_up;
+    }
+    if (output.count && count_write(output.count, options.count_file, new_hdr) != 0){
+        fprintf(stderr, "[transmap] Error: can not write the count file.\n");
+        ret = 1;
+        goto clean_up;
+    }
+    if (output.cov && cov_write(output.cov, options.coverage_file, new_hdr) != 0){
+        fprintf(stderr, "[transmap] Error: can not write the coverage file.\n");
+        ret = 1;
+        goto clean_up;
+    }
+    if (output.frag && frag_close(output.frag) != 0){
+        fprintf(stderr, "[transmap] Error: can not write the fragment file.\n");
+        ret = 1;
+        goto clean_up;
+    }
+    if (output.col && col_close(output.col, new_hdr) != 0){
+        fprintf(stderr, "[transmap] Error: can not write the columnar file.\n");
+        ret = 1;
+        goto clean_up;
+    }
+    transmap_statistic_print(&statistics, &options);
+    if (options.stats_file && transmap_statistic_write(options.stats_file, &statistics, &options) != 0){
+        fprintf(stderr, "[transmap] Error: can not write the statistics file.\n");
+        ret = 1;
+        goto clean_up;
+    }
+    for (i = 0; i < n_extra; ++i){
+        if (transmap_extra_finish(extra[i]) != 0){
+            fprintf(stderr, "[transmap] Error: can not write the output file of the annotation %s.\n", options.annot_file[i + 1]);
+            ret = 1;
+            goto clean_up;
+        }
+    }
 
     ret = 0;
     clean_up:
-    if (bed_hit) vec_destroy(bed, bed_hit);
-    if (bv) bam_vector_destroy(bv);
-    if (r1v) bam_vector_destroy(r1v);
-    if (r2v) bam_vector_destroy(r2v);
+    transmap_worker_destroy(&worker);
+    if (batch) transmap_batch_destroy(batch);
+    if (output.sort) bam_sort_destroy(output.sort);
+    if (output.text) sam_text_destroy(output.text);
+    if (output.tcc) tcc_destroy(output.tcc);
+    if (output.count) count_destroy(output.count);
+    if (output.cov) cov_destroy(output.cov);
+    if (output.frag) frag_destroy(output.frag);
+    if (output.col) col_destroy(output.col);
+    if (output.tag_split) tag_split_destroy(output.tag_split);
+    if (output.part) part_destroy(output.part);
+    if (output.tee) sam_close(output.tee);
     if (new_hdr) sam_hdr_destroy(new_hdr);
+    for (i = 0; i < n_extra; ++i) transmap_extra_destroy(extra[i]);
     if (bed) bed_free(bed);
-    if (buffer) free(buffer);
     if (sam) sam_parser_close(sam);
     if (out) sam_close(out);
+    if (tpool.pool) hts_tpool_destroy(tpool.pool);
+    if (run_stats_file) free(run_stats_file);
+    if (cram_ref_file) free(cram_ref_file);
+    if (options.keep_tags) free(options.keep_tags);
     return ret;
 }
 
+transmap_batch_t *transmap_batch_init(){
+    transmap_batch_t *batch;
+    if (!(batch = calloc(1, sizeof(*batch)))) return NULL;
+    if (!(batch->bv = bam_vector_init())) goto clean_up;
+    if (!(batch->r1v = bam_vector_init())) goto clean_up;
+    if (!(batch->r2v = bam_vector_init())) goto clean_up;
+    if (!(batch->group = vec_init(int))) goto clean_up;
+    if (!(batch->hit = vec_init(int))) goto clean_up;
+    if (!(batch->status = vec_init(int))) goto clean_up;
+    return batch;
+
+    clean_up:
+    transmap_batch_destroy(batch);
+    return NULL;
+}
+
+void transmap_batch_clear(transmap_batch_t *batch){
+    batch->bv->size = 0;
+    batch->r1v->size = 0;
+    batch->r2v->size = 0;
+    vec_clear(int, batch->group);
+    vec_clear(int, batch->hit);
+    vec_clear(int, batch->status);
+}
+
+void transmap_batch_destroy(transmap_batch_t *batch){
+    if (batch->bv) bam_vector_destroy(batch->bv);
+    if (batch->r1v) bam_vector_destroy(batch->r1v);
+    if (batch->r2v) bam_vector_destroy(batch->r2v);
+    if (batch->group) vec_destroy(int, batch->group);
+    if (batch->hit) vec_destroy(int, batch->hit);
+    if (batch->status) vec_destroy(int, batch->status);
+    free(batch);
+}
+
+int transmap_batch_read(sam_parser_t *sam, transmap_batch_t *batch, size_t batch_size){
+    int count = 0, n_group = 0;
+    while (batch->bv->size < batch_size && (count = sam_parser_next(sam, batch->bv)) > 0){
+        if (vec_add(int, batch->group, count) != 0) return -1;
+        n_group++;
+    }
+    if (count < 0) return -1;
+    return n_group;
+}
+
+int transmap_batch_map(transmap_batch_t *batch, transmap_worker_t *worker, struct transmap_option *options){
+    bam1_t **record = batch->bv->data;
+    int64_t read_statistics[10];
+    int i, count, ret, n_hit, status;
+    for (i = 0; i < batch->group->size; ++i){
+        count = batch->group->data[i];
+        n_hit = batch->r1v->size;
+        if (options->tee_file) memcpy(read_statistics, worker->statistics.read_statistics, sizeof(read_statistics));
+        if (is_paired(record[0]))
+            ret = transmap_paired(record, count, worker->dict, batch->r1v, batch->r2v, worker->candidate, &worker->buffer, &worker->buffer_size, &worker->statistics, options);
+        else ret = transmap_single(record, count, worker->dict, batch->r1v, batch->r2v, worker->candidate, &worker->buffer, &worker->buffer_size, &worker->statistics, options);
+        if (ret != 0) return -1;
+        if (vec_add(int, batch->hit, batch->r1v->size - n_hit) != 0) return -1;
+        if (options->tee_file){
+            /* the status of the read is the one counted for it */
+            for (status = 0; status < TRANSMAP_UNALIGNED && worker->statistics.read_statistics[status] == read_statistics[status]; ++status);
+            if (vec_add(int, batch->status, status) != 0) return -1;
+        }
+        record += count;
+    }
+    return 0;
+}
+
+int transmap_out_write(transmap_out_t *out, bam1_t *b){
+    if (out->cov && cov_add(out->cov, b) != 0) return -1;
+    /* the routing tag may be dropped by keep_tags */
+    if (out->tag_split) return tag_split_write(out->tag_split, b, out->keep_tags);
+    if (out->keep_tags && bam_aux_keep(b, out->keep_tags) != 0) return -1;
+    if (out->part) return part_write(out->part, b);
+    if (out->sort) return bam_sort_add(out->sort, b);
+    if (out->text) return sam_text_write1(out->text, b);
+    if (!out->fp) return 0;
+    return sam_write1(out->fp, out->hdr, b) < 0? -1: 0;
+}
+
+int transmap_out_pair(transmap_out_t *out, bam1_t *b1, bam1_t *b2){
+    if (out->frag && frag_add(out->frag, b1, b2) != 0) return -1;
+    if (b1->core.tid != -1) if (transmap_out_write(out, b1) != 0) return -1;
+    if (b2->core.tid != -1) if (transmap_out_write(out, b2) != 0) return -1;
+    return 0;
+}
+
+int transmap_batch_write(transmap_batch_t *batch, transmap_out_t *out){
+    bam_vector_t *r1v = batch->r1v, *r2v = batch->r2v;
+    int i, k = 0;
+    if (out->tcc || out->count || out->col) {
+        for (i = 0; i < batch->hit->size; ++i){
+            if (out->tcc && tcc_add(out->tcc, r1v->data + k, r2v->data + k, batch->hit->data[i]) != 0) return -1;
+            if (out->count && count_add(out->count, r1v->data + k, r2v->data + k, batch->hit->data[i]) != 0) return -1;
+            if (out->col && col_add(out->col, r1v->data + k, r2v->data + k, batch->hit->data[i]) != 0) return -1;
+            k += batch->hit->data[i];
+        }
+    }
+    if (out->tee) {
+        bam1_t **record = batch->bv->data;
+        for (i = 0; i < batch->group->size; ++i){
+            /* the reads for which a candidate target is found */
+            if (batch->status->data[i] < TRANSMAP_UNMAPPED_NO_OVERLAP){
+                for (k = 0; k < batch->group->data[i]; ++k){
+                    if (bam_aux_update_int(record[k], "ZT", batch->status->data[i]) != 0) return -1;
+                    if (sam_write1(out->tee, out->tee_hdr, record[k]) < 0) return -1;
+                }
+            }
+            record += batch->group->data[i];
+        }
+    }
+    if (!out->fp && !out->cov && !out->frag && !out->tag_split && !out->part) return 0;
+    for (i = 0; i < r1v->size; ++i)
+        if (transmap_out_pair(out, r1v->data[i], r2v->data[i]) != 0) return -1;
+    return 0;
+}
+
+int transmap_worker_init(transmap_worker_t *worker, void *dict, struct transmap_option *options){
+    memset(worker, 0, sizeof(*worker));
+    worker->dict = dict;
+    worker->others = options->others;
+    if (options->others & OPTION_GTF_MODE) worker->candidate = vec_init(exon);
+    else worker->candidate = vec_init(bed);
+    return worker->candidate? 0: -1;
+}
+
+void transmap_worker_destroy(transmap_worker_t *worker){
+    if (worker->candidate) {
+        if (worker->others & OPTION_GTF_MODE) vec_destroy(exon, worker->candidate);
+        else vec_destroy(bed, worker->candidate);
+    }
+    if (worker->buffer) free(worker->buffer);
+    worker->candidate = NULL;
+    worker->buffer = NULL;
+}
+
+void transmap_statistic_merge(struct transmap_statistic *dst, struct transmap_statistic *src){
+    int i;
+    dst->n_align_processed += src->n_align_processed;
+    dst->n_read_processed += src->n_read_processed;
+    for (i = 0; i < 10; ++i){
+        dst->align_statistics[i] += src->align_statistics[i];
+        dst->read_statistics[i] += src->read_statistics[i];
+    }
+}
+
+int transmap_statistic_write(const char *fn, struct transmap_statistic *statistics, struct transmap_option *options){
+    FILE *f;
+    int i;
+    if (!(f = fopen(fn, "w"))) return -1;
+    fprintf(f, "#transmap statistics\n");
+    fprintf(f, "options\t%" PRIu64 "\n", options->others);
+    fprintf(f, "reads\t%" PRId64, statistics->n_read_processed);
+    for (i = 0; i < 10; ++i) fprintf(f, "\t%" PRId64, statistics->read_statistics[i]);
+    fprintf(f, "\nalignments\t%" PRId64, statistics->n_align_processed);
+    for (i = 0; i < 10; ++i) fprintf(f, "\t%" PRId64, statistics->align_statistics[i]);
+    fprintf(f, "\n");
+    return fclose(f) == 0? 0: -1;
+}
+
+int transmap_statistic_read(const char *fn, struct transmap_statistic *statistics, uint64_t *others){
+    struct transmap_statistic s;
+    FILE *f;
+    int i, n = 0;
+    if (!(f = fopen(fn, "r"))) return -1;
+    memset(&s, 0, sizeof(s));
+    if (fscanf(f, "#transmap statistics\noptions\t%" SCNu64 "\nreads\t%" SCNd64, others, &s.n_read_processed) == 2) n += 2;
+    for (i = 0; i < 10; ++i) n += fscanf(f, "\t%" SCNd64, s.read_statistics + i);
+    n += fscanf(f, "\nalignments\t%" SCNd64, &s.n_align_processed);
+    for (i = 0; i < 10; ++i) n += fscanf(f, "\t%" SCNd64, s.align_statistics + i);
+    fclose(f);
+    if (n != 23) return -1;
+    transmap_statistic_merge(statistics, &s);
+    return 0;
+}
+
+void transmap_statistic_print(struct transmap_statistic *statistics, struct transmap_option *options){
+    fprintf(stderr, "[Read statistics]\n");
+    fprintf(stderr, "Total:                      %" PRId64 "\n", statistics->n_read_processed);
+    fprintf(stderr, "Mapped unique:              %" PRId64 "\n", statistics->read_statistics[TRANSMAP_MAPPED]);
+    fprintf(stderr, "Mapped multiple:            %" PRId64 "\n", statistics->read_statistics[TRANSMAP_MULTI_MAPPED]);
+    fprintf(stderr, "Unmapped unaligned:         %" PRId64 "\n", statistics->read_statistics[TRANSMAP_UNALIGNED]);
+    if (options->others & OPTION_REQUIRE_BOTH_MATE){
+        fprintf(stderr, "Unmapped mate unaligned:    %" PRId64 "\n", statistics->read_statistics[TRANSMAP_MATE_UNALIGNED]);
+        fprintf(stderr, "Unmapped mate missing:      %" PRId64 "\n", statistics->read_statistics[TRANSMAP_MATE_MISSING]);
+        fprintf(stderr, "Unmapped improper pair:     %" PRId64 "\n", statistics->read_statistics[TRANSMAP_PAIR_IMPROPER]);
+    }
+    fprintf(stderr, "Unmapped no overlap:        %" PRId64 "\n", statistics->read_statistics[TRANSMAP_UNMAPPED_NO_OVERLAP]);
+    if (!(options->others & OPTION_ALLOW_PARTIAL)) fprintf(stderr, "Unmapped partial:           %" PRId64 "\n", statistics->read_statistics[TRANSMAP_UNMAPPED_PARTIAL]);
+    if (options->others & OPTION_GTF_MODE) fprintf(stderr, "Unmapped exon imcompatible: %" PRId64 "\n", statistics->read_statistics[TRANSMAP_EXON_IMCOMPATIBLE]);
+    if ((options->others & OPTION_ALLOW_PARTIAL && !(options->others & OPTION_GTF_MODE)) || options->others & OPTION_IRREGULAR) fprintf(stderr, "Unmapped no match:          %" PRId64 "\n", statistics->read_statistics[TRANSMAP_UNMAPPED_NO_MATCH]);
+
+    fprintf(stderr, "\n[Alignment statistics]\n");
+    fprintf(stderr, "Total:                      %" PRId64 "\n", statistics->n_align_processed);
+    fprintf(stderr, "Mapped unique:              %" PRId64 "\n", statistics->align_statistics[TRANSMAP_MAPPED]);
+    fprintf(stderr, "Mapped multiple:            %" PRId64 "\n", statistics->align_statistics[TRANSMAP_MULTI_MAPPED]);
+    if (options->others & OPTION_REQUIRE_BOTH_MATE){
+        fprintf(stderr, "Unmapped mate unaligned:    %" PRId64 "\n", statistics->align_statistics[TRANSMAP_MATE_UNALIGNED]);
+        fprintf(stderr, "Unmapped mate missing:      %" PRId64 "\n", statistics->align_statistics[TRANSMAP_MATE_MISSING]);
+        fprintf(stderr, "Unmapped improper pair:     %" PRId64 "\n", statistics->align_statistics[TRANSMAP_PAIR_IMPROPER]);
+    }
+    fprintf(stderr, "Unmapped no overlap:        %" PRId64 "\n", statistics->align_statistics[TRANSMAP_UNMAPPED_NO_OVERLAP]);
+    if (!(options->others & OPTION_ALLOW_PARTIAL)) fprintf(stderr, "Unmapped partial:           %" PRId64 "\n", statistics->align_statistics[TRANSMAP_UNMAPPED_PARTIAL]);
+    if (options->others & OPTION_GTF_MODE) fprintf(stderr, "Unmapped exon imcompatible: %" PRId64 "\n", statistics->align_statistics[TRANSMAP_EXON_IMCOMPATIBLE]);
+    if ((options->others & OPTION_ALLOW_PARTIAL && !(options->others & OPTION_GTF_MODE)) || options->others & OPTION_IRREGULAR) fprintf(stderr, "Unmapped no match:          %" PRId64 "\n", statistics->align_statistics[TRANSMAP_UNMAPPED_NO_MATCH]);
+}
+
 void transmap_version(){
     fprintf(stderr, "transmap-%s\n\n", TRANSMAP_VERSION);
     exit(0);
@@ -191,11 +635,16 @@ void transmap_version(){
 void transmap_usage(const char* msg){
     const char *usage_info = "\
 Usage:  transmap [options] --fi <alignment file> --fo <output file> --bed <bed file>\n\
+        transmap run --manifest <manifest file> --shard <shard> [options] --fi <alignment file> --fo <output file> --bed <bed file>\n\
+        transmap plan --fi <alignment file> --shards <number of shards> [--fo <manifest file>]\n\
+        transmap merge --fo <output file> <shard bam file> [<shard bam file> ...]\n\
+        transmap expand --fi <compact alignment file> [--fo <output file>] [--fix-NH]\n\
 [options]\n\
--i/--fi             : input bam file sorted (or grouped) by query name.\n\
--o/--fo             : output bam file.\n\
+-i/--fi             : input bam file sorted (or grouped) by query name, or by coordinate with --coordinate.\n\
+-o/--fo             : output bam file. Given once per --bed or --gtf when several are given, in the same order.\n\
 -b/--bed            : bed file providing the regions on which the alignments to be generated.\n\
 -g/--gtf            : gtf file providing the exons of transcripts on which the alignments to be generated.\n\
+                      --bed and --gtf can be given several times to map the input against each annotation in one pass.\n\
 --gtf-feature       : gtf feature used to define the member exons of transcripts. default: exon.\n\
 --gtf-attribute     : gtf attribute used as the reference name of the output. default: transcript_id.\n\
 --partial           : also process the alignments with ranges exceed the target boundaries.\n\
@@ -203,7 +652,48 @@ Usage:  transmap [options] --fi <alignment file> --fo <output file> --bed <bed f
 --both-mate         : require both mate of paired-end alignments to be mapped for reporting.\n\
 --fix-NH            : fix the NH and HI tag.\n\
 --fix-MD            : fix the MD tag if exists.\n\
---fix-NM            : fix the NM tag when --fix-MD is specified. \n\n";
+--fix-NM            : fix the NM tag when --fix-MD is specified. \n\
+-t/--threads        : number of threads used for bam decompression and compression. default: 1.\n\
+-w/--workers        : number of worker threads used for mapping the alignments. default: 0 (map on the main thread).\n\
+--split             : split the bam input into the given number of ranges and map them in parallel.\n\
+--manifest          : manifest file written by \"transmap plan\".\n\
+--shard             : only map the given shard of the manifest.\n\
+--coordinate        : the input bam file is sorted by coordinate.\n\
+--restrict          : only read the alignments overlapping the targets through the index of the input, with --coordinate.\n\
+--max-pending       : maximum number of multi-mapped reads kept for --fix-NH and the read statistics with --coordinate. default: 1048576.\n\
+--collate           : group the input by query name through temporary files first, for input in any order.\n\
+--collate-buckets   : number of temporary files used by --collate. default: 64.\n\
+--collate-memory    : memory in MB for the records of one bucket of --collate, larger buckets are split again. default: 768.\n\
+--io-backend        : how the input file is read: default, fadvise or readahead. default: default.\n\
+--index-backend     : interval index of the annotation, bin (hierarchical bins) or iit (implicit interval tree). default: bin.\n\
+--sort              : sort the output by the new coordinates and index it.\n\
+--sort-memory       : memory in MB for sorting with --sort. default: 768.\n\
+--pair-memory       : memory in MB for the mates waiting for their mate with --coordinate. default: 1024.\n\
+--text-thread       : format the sam text output on a separate thread.\n\
+--drop-seq          : write * as SEQ and QUAL of the output.\n\
+--bin-qual          : bin the base qualities of the output to 8 levels.\n\
+--tcc               : write the read count of each transcript equivalence class to the given file. no alignment is written unless --fo is given.\n\
+--counts            : write the read count of each target to the given tsv file. no alignment is written unless --fo is given.\n\
+--count-mode        : how reads mapped to several targets are counted: unique, fractional or all. default: unique.\n\
+--count-gene        : gtf attribute by which the targets are also counted per gene, e.g. gene_id.\n\
+--coverage          : write the coverage of the targets by the output alignments to the given bedgraph file.\n\
+--fragments         : write the mapped fragments to the given bed file, a BED6 line for each single alignment and a BEDPE line\n\
+                      for each mapped pair. The file is compressed by bgzip if its name ends with .gz.\n\
+--columnar          : write the mapped alignments to the given file in the columnar format of transmap_col.h.\n\
+--genome            : genome fasta file indexed by faidx, required for a .cram output. The sequences of the targets are cut\n\
+                      from it to build the reference of the cram file, which is written to <fo>.fa by default.\n\
+--transcriptome     : write the transcriptome fasta built from --genome to the given file instead.\n\
+--split-by-tag      : write the alignments with each value of the given tag (e.g. RG or CB) to <fo without .bam>.<value>.bam\n\
+                      and the alignments without it to <fo>, which should end with .bam.\n\
+--max-open          : number of files kept open by --split-by-tag. [64]\n\
+--partition         : write the alignments to the given number of files <fo without .bam>.<i>.bam, each holding a contiguous\n\
+                      range of the targets with its own header, listed in <fo without .bam>.parts.tsv.\n\
+--partition-hash    : assign the targets to the files of --partition by the hash of their names.\n\
+--tee               : also write the input records of the reads overlapping any target to the given file, with their status\n\
+                      (0 mapped, 1 multi-mapped, 2 no match, 3 exon incompatible, 4 partial) in the ZT tag.\n\
+--compact           : fold the hits of an alignment that only differ in target, position, strand and cigar into a ZH tag.\n\
+--keep-tags         : comma-separated list of the aux tags kept in the output, e.g. NH,HI,CB,UB. default: all.\n\
+--stats             : also write the statistics to the given file. default for \"transmap run\": <output file>.stats.\n\n";
     if (msg==NULL || msg[0] == '\0') fprintf(stderr, "%s", usage_info);
     else fprintf(stderr, "%s\n\n%s", msg, usage_info);
     exit(1);
@@ -211,6 +701,7 @@ Usage:  transmap [options] --fi <alignment file> --fo <output file> --bed <bed f
 
 void transmap_option(struct transmap_option *options, int argc, char *argv[]){
     char c;
+    int out_given = 0;
     options->sam_file = NULL;
     options->in_file = NULL;
     options->out_file = "-";
@@ -219,9 +710,38 @@ void transmap_option(struct transmap_option *options, int argc, char *argv[]){
     options->show_help = 0;
     options->show_version = 0;
     options->index_cutoff = 0;
+    options->n_threads = 1;
+    options->n_workers = 0;
+    options->n_split = 0;
+    options->manifest = NULL;
+    options->shard = -1;
+    options->stats_file = NULL;
+    options->max_pending = TRANSMAP_MAX_PENDING;
+    options->pair_memory = TRANSMAP_PAIR_MEMORY;
+    options->n_bucket = TRANSMAP_COLLATE_BUCKETS;
+    options->collate_memory = TRANSMAP_COLLATE_MEMORY;
+    options->sort_memory = TRANSMAP_SORT_MEMORY;
+    options->io_backend = TRANSMAP_IO_DEFAULT;
+    options->keep_tags = NULL;
+    options->tcc_file = NULL;
+    options->count_file = NULL;
+    options->count_mode = TRANSMAP_COUNT_UNIQUE;
+    options->count_group = NULL;
+    options->coverage_file = NULL;
+    options->frag_file = NULL;
+    options->col_file = NULL;
+    options->genome_file = NULL;
+    options->ref_file = NULL;
+    options->split_tag = NULL;
+    options->max_open = TRANSMAP_TAG_SPLIT_OPEN;
+    options->n_part = 0;
+    options->tee_file = NULL;
+    options->n_annot = 0;
+    options->index_backend = BIOIDX_BACKEND_BIN;
+    options->n_out = 0;
     options->others = 0;
     if (argc == 1) transmap_usage("");
-    const char *short_options = "hvo:i:b:g:F:A:OPTNDMIB:";
+    const char *short_options = "hvo:i:b:g:F:A:OPTNDMIB:t:w:K:R:H:S:CQ:U:LG:V:ZY:XE:WqJk:ce:a:m:p:r:f:l:x:y:u:n:j:zs:d:";
     const struct option long_options[] =
             {
                     { "help" , no_argument , NULL, 'h' },
@@ -240,6 +760,42 @@ void transmap_option(struct transmap_option *options, int argc, char *argv[]){
                     { "fix-NM" , no_argument, NULL, 'M' },
                     { "irregular" , no_argument, NULL, 'I' },
                     { "index-cutoff" , required_argument, NULL, 'B' },
+                    { "threads" , required_argument, NULL, 't' },
+                    { "workers" , required_argument, NULL, 'w' },
+                    { "split" , required_argument, NULL, 'K' },
+                    { "manifest" , required_argument, NULL, 'R' },
+                    { "shard" , required_argument, NULL, 'H' },
+                    { "stats" , required_argument, NULL, 'S' },
+                    { "coordinate" , no_argument, NULL, 'C' },
+                    { "max-pending" , required_argument, NULL, 'Q' },
+                    { "pair-memory" , required_argument, NULL, 'U' },
+                    { "collate" , no_argument, NULL, 'L' },
+                    { "collate-buckets" , required_argument, NULL, 'G' },
+                    { "collate-memory" , required_argument, NULL, 'V' },
+                    { "sort" , no_argument, NULL, 'Z' },
+                    { "sort-memory" , required_argument, NULL, 'Y' },
+                    { "restrict" , no_argument, NULL, 'X' },
+                    { "io-backend" , required_argument, NULL, 'E' },
+                    { "text-thread" , no_argument, NULL, 'W' },
+                    { "drop-seq" , no_argument, NULL, 'q' },
+                    { "bin-qual" , no_argument, NULL, 'J' },
+                    { "keep-tags" , required_argument, NULL, 'k' },
+                    { "compact" , no_argument, NULL, 'c' },
+                    { "tcc" , required_argument, NULL, 'e' },
+                    { "counts" , required_argument, NULL, 'a' },
+                    { "count-mode" , required_argument, NULL, 'm' },
+                    { "count-gene" , required_argument, NULL, 'p' },
+                    { "coverage" , required_argument, NULL, 'r' },
+                    { "fragments" , required_argument, NULL, 'f' },
+                    { "columnar" , required_argument, NULL, 'l' },
+                    { "genome" , required_argument, NULL, 'x' },
+                    { "transcriptome" , required_argument, NULL, 'y' },
+                    { "split-by-tag" , required_argument, NULL, 'u' },
+                    { "max-open" , required_argument, NULL, 'n' },
+                    { "partition" , required_argument, NULL, 'j' },
+                    { "partition-hash" , no_argument, NULL, 'z' },
+                    { "tee" , required_argument, NULL, 's' },
+                    { "index-backend" , required_argument, NULL, 'd' },
                     {NULL, 0, NULL, 0} ,
             };
 
@@ -256,18 +812,19 @@ void transmap_option(struct transmap_option *options, int argc, char *argv[]){
                 transmap_version();
                 break;
             case 'o':
-                options->out_file = optarg;
+                if (options->n_out == TRANSMAP_MAX_ANNOT) transmap_usage("[transmap] Error: too many --fo.");
+                if (options->n_out == 0) options->out_file = optarg;
+                options->annot_out[options->n_out++] = optarg;
+                out_given = 1;
                 break;
             case 'i':
                 options->sam_file = optarg;
                 break;
             case 'b':
-                options->in_file = optarg;
-                options->others |= OPTION_BED_MODE;
-                break;
             case 'g':
-                options->in_file = optarg;
-                options->others |= OPTION_GTF_MODE;
+                if (options->n_annot == TRANSMAP_MAX_ANNOT) transmap_usage("[transmap] Error: too many --bed or --gtf.");
+                options->annot_file[options->n_annot] = optarg;
+                options->annot_mode[options->n_annot++] = c == 'b'? OPTION_BED_MODE: OPTION_GTF_MODE;
                 break;
             case 'F':
                 options->gtf_feature = optarg;
@@ -299,15 +856,229 @@ void transmap_option(struct transmap_option *options, int argc, char *argv[]){
             case 'B':
                 options->index_cutoff = strtol(optarg, NULL, 10);
                 break;
+            case 't':
+                options->n_threads = strtol(optarg, NULL, 10);
+                break;
+            case 'w':
+                options->n_workers = strtol(optarg, NULL, 10);
+                break;
+            case 'K':
+                options->n_split = strtol(optarg, NULL, 10);
+                break;
+            case 'R':
+                options->manifest = optarg;
+                break;
+            case 'H':
+                options->shard = strtol(optarg, NULL, 10);
+                break;
+            case 'S':
+                options->stats_file = optarg;
+                break;
+            case 'C':
+                options->others |= OPTION_COORDINATE;
+                break;
+            case 'Q':
+                options->max_pending = strtol(optarg, NULL, 10);
+                break;
+            case 'U':
+                options->pair_memory = strtol(optarg, NULL, 10);
+                break;
+            case 'L':
+                options->others |= OPTION_COLLATE;
+                break;
+            case 'G':
+                options->n_bucket = strtol(optarg, NULL, 10);
+                break;
+            case 'V':
+                options->collate_memory = strtol(optarg, NULL, 10);
+                break;
+            case 'Z':
+                options->others |= OPTION_SORT;
+                break;
+            case 'Y':
+                options->sort_memory = strtol(optarg, NULL, 10);
+                break;
+            case 'X':
+                options->others |= OPTION_RESTRICT;
+                break;
+            case 'E':
+                if ((options->io_backend = transmap_io_backend(optarg)) < 0)
+                    transmap_usage("[transmap] Error: --io-backend should be one of default, fadvise or readahead.");
+                break;
+            case 'W':
+                options->others |= OPTION_TEXT_THREAD;
+                break;
+            case 'q':
+                options->others |= OPTION_DROP_SEQ;
+                break;
+            case 'J':
+                options->others |= OPTION_BIN_QUAL;
+                break;
+            case 'c':
+                options->others |= OPTION_COMPACT;
+                break;
+            case 'e':
+                options->tcc_file = optarg;
+                break;
+            case 'a':
+                options->count_file = optarg;
+                break;
+            case 'd':
+                if (strcmp(optarg, "bin") == 0) options->index_backend = BIOIDX_BACKEND_BIN;
+                else if (strcmp(optarg, "iit") == 0) options->index_backend = BIOIDX_BACKEND_IIT;
+                else transmap_usage("[transmap] Error: --index-backend should be one of bin or iit.");
+                break;
+            case 'm':
+                if ((options->count_mode = transmap_count_mode(optarg)) < 0)
+                    transmap_usage("[transmap] Error: --count-mode should be one of unique, fractional or all.");
+                break;
+            case 'p':
+                options->count_group = optarg;
+                break;
+            case 'r':
+                options->coverage_file = optarg;
+                break;
+            case 'f':
+                options->frag_file = optarg;
+                break;
+            case 'l':
+                options->col_file = optarg;
+                break;
+            case 'x':
+                options->genome_file = optarg;
+                break;
+            case 'y':
+                options->ref_file = optarg;
+                break;
+            case 'u':
+                options->split_tag = optarg;
+                break;
+            case 'n':
+                options->max_open = strtol(optarg, NULL, 10);
+                break;
+            case 'j':
+                options->n_part = strtol(optarg, NULL, 10);
+                break;
+            case 'z':
+                options->others |= OPTION_PARTITION_HASH;
+                break;
+            case 's':
+                options->tee_file = optarg;
+                break;
+            case 'k':
+                if (options->keep_tags) free(options->keep_tags);
+                if (!(options->keep_tags = bam_tag_set(optarg)))
+                    transmap_usage("[transmap] Error: --keep-tags should be a comma-separated list of two-character tags.");
+                break;
             default:
                 transmap_usage("[transmap] Error:unrecognized parameter");
         }
     }
     if (argc != optind) transmap_usage("[transmap] Error:unrecognized parameter");
-    if ((options->others & OPTION_BED_MODE) && (options->others & OPTION_GTF_MODE))
-        transmap_usage("[transmap] Error: you can only provide one of --bed or --gtf.");
+    /* the first annotation is mapped by the main pass, the others share its input */
+    if (options->n_annot > 0){
+        options->in_file = options->annot_file[0];
+        options->others |= options->annot_mode[0];
+    }
+    if (options->n_annot > 1){
+        if (options->n_out != options->n_annot)
+            transmap_usage("[transmap] Error: each --bed or --gtf requires its own --fo when several are given.");
+        if (options->n_workers > 0 || options->n_split > 1 || options->shard >= 0 || (options->others & (OPTION_COORDINATE | OPTION_SORT)))
+            transmap_usage("[transmap] Error: several annotations can not be combined with --workers, --split, --shard, --coordinate or --sort.");
+        if (options->split_tag || options->n_part > 1)
+            transmap_usage("[transmap] Error: several annotations can not be combined with --split-by-tag or --partition.");
+        for (int i = 1; i < options->n_annot; ++i)
+            if (transmap_is_cram(options->annot_out[i]) && !options->genome_file) transmap_usage("[transmap] Error: a cram output requires --genome.");
+    } else if (options->n_out > 1) transmap_usage("[transmap] Error: you can only provide one --fo for a single annotation.");
     if (options->in_file == NULL) transmap_usage("[transmap] Error: you should specify either --bed or --gtf.");
     if (options->sam_file == NULL) transmap_usage("[transmap] Error: you should provide the input bam file via --bam.");
+    if (options->n_threads < 1) transmap_usage("[transmap] Error: --threads should be a positive integer.");
+    if (options->n_workers < 0) transmap_usage("[transmap] Error: --workers should not be negative.");
+    if (options->n_split < 0) transmap_usage("[transmap] Error: --split should not be negative.");
+    if (options->n_split > 1 && strcmp(options->out_file, "-") == 0) transmap_usage("[transmap] Error: --split requires an output file.");
+    if (options->shard >= 0 && options->manifest == NULL) transmap_usage("[transmap] Error: --shard requires --manifest.");
+    if (options->shard >= 0 && options->n_split > 1) transmap_usage("[transmap] Error: --shard can not be combined with --split.");
+    if (options->max_pending < 1) transmap_usage("[transmap] Error: --max-pending should be a positive integer.");
+    if (options->pair_memory < 1) transmap_usage("[transmap] Error: --pair-memory should be a positive integer.");
+    if (options->n_bucket < 1) transmap_usage("[transmap] Error: --collate-buckets should be a positive integer.");
+    if (options->collate_memory < 1) transmap_usage("[transmap] Error: --collate-memory should be a positive integer.");
+    if ((options->others & OPTION_COLLATE) && (options->n_split > 1 || (options->others & OPTION_COORDINATE)))
+        transmap_usage("[transmap] Error: --collate can not be combined with --split or --coordinate.");
+    if ((options->others & OPTION_RESTRICT) && !(options->others & OPTION_COORDINATE))
+        transmap_usage("[transmap] Error: --restrict requires --coordinate.");
+    if (options->sort_memory < 1) transmap_usage("[transmap] Error: --sort-memory should be a positive integer.");
+    if ((options->others & OPTION_SORT) && (strlen(options->out_file) < 4 || strcmp(options->out_file + strlen(options->out_file) - 4, ".bam") != 0))
+        transmap_usage("[transmap] Error: --sort requires a bam output file.");
+    if ((options->others & OPTION_SORT) && (options->n_split > 1 || options->shard >= 0))
+        transmap_usage("[transmap] Error: --sort can not be combined with --split or --shard.");
+    if ((options->others & OPTION_COORDINATE) && (options->n_split > 1 || options->shard >= 0 || options->n_workers > 0))
+        transmap_usage("[transmap] Error: --coordinate can not be combined with --split, --shard or --workers.");
+    if ((options->others & OPTION_DROP_SEQ) && (options->others & OPTION_BIN_QUAL))
+        transmap_usage("[transmap] Error: --drop-seq can not be combined with --bin-qual.");
+    if ((options->others & OPTION_COMPACT) && (options->others & (OPTION_SORT | OPTION_COORDINATE)))
+        transmap_usage("[transmap] Error: --compact can not be combined with --sort or --coordinate.");
+    /* the folded hits only live in the ZH tag */
+    if ((options->others & OPTION_COMPACT) && options->keep_tags) bam_tag_set_add(options->keep_tags, "ZH");
+    if (options->tcc_file && (options->n_split > 1 || (options->others & OPTION_COORDINATE)))
+        transmap_usage("[transmap] Error: --tcc can not be combined with --split or --coordinate.");
+    if (options->count_file && (options->n_split > 1 || (options->others & OPTION_COORDINATE)))
+        transmap_usage("[transmap] Error: --counts can not be combined with --split or --coordinate.");
+    if (options->count_group && !(options->count_file && (options->others & OPTION_GTF_MODE)))
+        transmap_usage("[transmap] Error: --count-gene requires --counts and --gtf.");
+    if (options->coverage_file && (options->others & OPTION_COMPACT))
+        transmap_usage("[transmap] Error: --coverage can not be combined with --compact.");
+    if (options->count_file && (options->others & OPTION_COMPACT))
+        transmap_usage("[transmap] Error: --counts can not be combined with --compact.");
+    if (options->tcc_file && (options->others & OPTION_COMPACT))
+        transmap_usage("[transmap] Error: --tcc can not be combined with --compact.");
+    if (options->frag_file && (options->others & OPTION_COMPACT))
+        transmap_usage("[transmap] Error: --fragments can not be combined with --compact.");
+    if (options->col_file && (options->others & OPTION_COMPACT))
+        transmap_usage("[transmap] Error: --columnar can not be combined with --compact.");
+    if (options->frag_file && options->n_split > 1)
+        transmap_usage("[transmap] Error: --fragments can not be combined with --split.");
+    if (options->split_tag){
+        size_t l = strlen(options->out_file);
+        if (strlen(options->split_tag) != 2) transmap_usage("[transmap] Error: --split-by-tag should be a two-letter tag.");
+        if (l <= 4 || strcmp(options->out_file + l - 4, ".bam") != 0) transmap_usage("[transmap] Error: --split-by-tag requires a bam output file.");
+        if (options->n_split > 1 || options->shard >= 0 || (options->others & OPTION_SORT))
+            transmap_usage("[transmap] Error: --split-by-tag can not be combined with --split, --shard or --sort.");
+        if (options->max_open < 1) transmap_usage("[transmap] Error: --max-open should be a positive integer.");
+        /* the records go to the files of the tag values instead */
+        options->others |= OPTION_NO_OUTPUT;
+    }
+    if (options->n_part < 0) transmap_usage("[transmap] Error: --partition should not be negative.");
+    if ((options->others & OPTION_PARTITION_HASH) && options->n_part <= 1) transmap_usage("[transmap] Error: --partition-hash requires --partition.");
+    if (options->n_part > 1){
+        size_t l = strlen(options->out_file);
+        if (l <= 4 || strcmp(options->out_file + l - 4, ".bam") != 0) transmap_usage("[transmap] Error: --partition requires a bam output file.");
+        if (options->n_split > 1 || options->shard >= 0 || (options->others & OPTION_SORT) || options->split_tag)
+            transmap_usage("[transmap] Error: --partition can not be combined with --split, --shard, --sort or --split-by-tag.");
+        /* the ZH entries of --compact keep the tids of the full header */
+        if (options->others & OPTION_COMPACT) transmap_usage("[transmap] Error: --partition can not be combined with --compact.");
+        /* the records go to the files of the partitions instead */
+        options->others |= OPTION_NO_OUTPUT;
+    }
+    if (options->tee_file && (options->n_split > 1 || (options->others & OPTION_COORDINATE)))
+        transmap_usage("[transmap] Error: --tee can not be combined with --split or --coordinate.");
+    if (transmap_is_cram(options->out_file) && !options->genome_file)
+        transmap_usage("[transmap] Error: a cram output requires --genome.");
+    if (options->genome_file && !transmap_is_cram(options->out_file) && !options->ref_file)
+        transmap_usage("[transmap] Error: --genome requires a cram output or --transcriptome.");
+    if (options->ref_file && !options->genome_file)
+        transmap_usage("[transmap] Error: --transcriptome requires --genome.");
+    if (options->col_file && (options->n_split > 1 || (options->others & OPTION_COORDINATE)))
+        transmap_usage("[transmap] Error: --columnar can not be combined with --split or --coordinate.");
+    if ((options->tcc_file || options->count_file || options->coverage_file || options->frag_file || options->col_file) && !out_given) {
+        /* nothing is written but the classes, counts, coverage, fragments and columns */
+        if (options->others & OPTION_SORT) transmap_usage("[transmap] Error: --sort requires --fo with --tcc, --counts, --coverage, --fragments or --columnar.");
+        options->others |= OPTION_NO_OUTPUT;
+        options->others &= ~(uint64_t)OPTION_COMPACT;
+        /* the coverage, fragments and columns need the cigar of the mapped records, the classes and counts only their targets.
+         * NH is only read from the records, by the fragments and the columns */
+        if (!options->coverage_file && !options->frag_file && !options->col_file)
+            options->others = (options->others | OPTION_NO_RECORD) & ~(uint64_t)OPTION_FIX_NH;
+    }
 };
 
 int fix_NH(bam1_t **b, int size){
@@ -321,13 +1092,91 @@ int fix_NH(bam1_t **b, int size){
     return 0;
 }
 
+/* a hit can be folded into the first hit of its source alignment when only the target, position, strand and cigar
+ * differ, so that "transmap expand" rebuilds it exactly */
+static int hit_compactable(const bam1_t *p, const bam1_t *h){
+    if (p->core.tid < 0 || h->core.tid < 0) return 0;
+    if (((p->core.flag ^ h->core.flag) & ~(uint16_t)BAM_FREVERSE) || p->core.qual != h->core.qual) return 0;
+    if (p->core.l_qseq != h->core.l_qseq) return 0;
+    /* the mate fields of paired hits are rebuilt by "transmap expand" */
+    if (!(p->core.flag & BAM_FPAIRED) && (p->core.mtid != h->core.mtid || p->core.mpos != h->core.mpos || p->core.isize != h->core.isize)) return 0;
+    if (bam_get_l_aux(p) != bam_get_l_aux(h) || memcmp(bam_get_aux(p), bam_get_aux(h), bam_get_l_aux(p)) != 0) return 0;
+    return 1;
+}
+
+/* write the ZH entry "tid,±pos,cigar;" of hit h, the cigar is left empty when it equals the one of p */
+static size_t hit_entry(const bam1_t *p, const bam1_t *h, char *s){
+    const uint32_t *cigar = bam_get_cigar(h);
+    char *q = s;
+    q += sprintf(q, "%d,%c%" PRId64 ",", h->core.tid, (h->core.flag & BAM_FREVERSE)? '-': '+', (int64_t)h->core.pos + 1);
+    if (p->core.n_cigar != h->core.n_cigar || memcmp(bam_get_cigar(p), cigar, h->core.n_cigar << 2u) != 0)
+        for (uint32_t i = 0; i < h->core.n_cigar; ++i) q += sprintf(q, "%u%c", bam_cigar_oplen(cigar[i]), bam_cigar_opchr(cigar[i]));
+    *q++ = ';';
+    return q - s;
+}
+
+/* with --compact, fold the n hits of one source alignment at the end of r1v (and r2v for pairs) into a ZH tag of
+ * the first hit. Returns the number of records removed. */
+static int compact_hits(bam_vector_t *r1v, bam_vector_t *r2v, int first, int n, int paired, uint8_t **buffer, size_t *buffer_size){
+    bam1_t **r1 = r1v->data + first, **r2 = r2v->data + first, **r, *t;
+    size_t size = n + 1, l;
+    uint8_t *mark;
+    char *s;
+    int i, k, w, n_compact = 0;
+    if (paired && (r1[0]->core.tid < 0 || r2[0]->core.tid < 0)) return 0;
+    for (i = 1; i < n; ++i){
+        if (!hit_compactable(r1[0], r1[i]) || (paired && !hit_compactable(r2[0], r2[i]))) continue;
+        size += 2 * 64 + 11 * ((size_t)r1[i]->core.n_cigar + (paired? r2[i]->core.n_cigar: 0));
+        n_compact++;
+    }
+    if (n_compact == 0) return 0;
+    /* the marks are taken before the first hits get their ZH tag */
+    if (!(mark = need_buffer(size, buffer, buffer_size))) return -1;
+    s = (char *)mark + n;
+    for (i = 1; i < n; ++i) mark[i] = hit_compactable(r1[0], r1[i]) && (!paired || hit_compactable(r2[0], r2[i]));
+    for (k = 0; k < 1 + paired; ++k){
+        r = k? r2: r1;
+        for (i = 1, l = 0; i < n; ++i) if (mark[i]) l += hit_entry(r[0], r[i], s + l);
+        s[l++] = '\0';
+        if (bam_aux_append(r[0], "ZH", 'Z', (int)l, (uint8_t *)s) != 0) return -1;
+    }
+    /* the folded hits are moved behind the kept ones and dropped */
+    for (i = 1, w = 1; i < n; ++i){
+        if (mark[i]) continue;
+        t = r1[w]; r1[w] = r1[i]; r1[i] = t;
+        t = r2[w]; r2[w] = r2[i]; r2[i] = t;
+        w++;
+    }
+    r1v->size -= n_compact;
+    r2v->size -= n_compact;
+    return n_compact;
+}
+
+/* fix_NH() for the records of a compacted read: NH counts all the n_hit hits, folded or not, and the HI of a record
+ * is followed by the ones of the hits folded into its ZH tag, which "transmap expand --fix-NH" gives them back */
+static int fix_NH_compact(bam1_t **b, int size, int n_hit){
+    const uint8_t *zh;
+    const char *s;
+    int i, hi = 1;
+    for (i = 0; i < size; ++i){
+        if (b[i]->core.tid != -1){
+            if (bam_aux_update_int(b[i], "NH", n_hit) != 0) return -1;
+            if (bam_aux_update_int(b[i], "HI", hi) != 0) return -1;
+        }
+        hi++;
+        if ((zh = bam_aux_get(b[i], "ZH")) && zh[0] == 'Z')
+            for (s = (const char *)zh + 1; *s; ++s) if (*s == ';') hi++;
+    }
+    return 0;
+}
+
 
 int transmap_single(bam1_t **bam, int count, void *dict, bam_vector_t *r1v, bam_vector_t *r2v, void *candidate, uint8_t **buffer, size_t *buffer_size, struct transmap_statistic *statistics, struct transmap_option *options) {
     bam1_t *r1, *t1, *t2;
     uint64_t others = options->others;
     int read_status, align_status;
     int init_index = r1v->size;
-    int i = 0, j = 0, align_n_mapped = 0, read_n_mapped = 0;
+    int i = 0, j = 0, align_n_mapped = 0, read_n_mapped = 0, first;
     int cand_size;
     int ret;
     read_status = TRANSMAP_UNALIGNED;
@@ -345,6 +1194,7 @@ int transmap_single(bam1_t **bam, int count, void *dict, bam_vector_t *r1v, bam_
             cand_size = ((vec_t(bed) *)candidate)->size;
         }
         align_n_mapped = 0;
+        first = r1v->size;
         for (j = 0; j < cand_size; ++j) {
             if (!(t1 = bam_vector_next(r1v))) return -1;
             if (!(t2 = bam_vector_next(r2v))) return -1;
@@ -358,12 +1208,15 @@ int transmap_single(bam1_t **bam, int count, void *dict, bam_vector_t *r1v, bam_
             r1v->size++;
             r2v->size++;
         }
+        if ((others & OPTION_COMPACT) && align_n_mapped > 1 && compact_hits(r1v, r2v, first, align_n_mapped, 0, buffer, buffer_size) < 0) return -1;
         if (align_n_mapped > 1) statistics->align_statistics[TRANSMAP_MULTI_MAPPED]++;
         else statistics->align_statistics[align_status]++;
         read_n_mapped += align_n_mapped;
         read_status = min(read_status, align_status);
     }
-    if (others & OPTION_FIX_NH) if (fix_NH(r1v->data + init_index, r1v->size - init_index) != 0) return -1;
+    if ((others & OPTION_FIX_NH) && (others & OPTION_COMPACT)) {
+        if (fix_NH_compact(r1v->data + init_index, r1v->size - init_index, read_n_mapped) != 0) return -1;
+    } else if (others & OPTION_FIX_NH) if (fix_NH(r1v->data + init_index, r1v->size - init_index) != 0) return -1;
     if (read_n_mapped > 1) statistics->read_statistics[TRANSMAP_MULTI_MAPPED]++;
     else statistics->read_statistics[read_status]++;
     return 0;
@@ -375,7 +1228,7 @@ int transmap_paired(bam1_t **bam, int count, void *dict, bam_vector_t *r1v, bam_
     uint64_t others = options->others;
     int read_status, align_status;
     int i = 0, j = 0, align_n_mapped = 0, read_n_mapped = 0;
-    int init_index = r1v->size;
+    int init_index = r1v->size, first;
     int ret, ret1, ret2;
     int cand_size;
     read_status = TRANSMAP_UNALIGNED;
@@ -436,6 +1289,7 @@ int transmap_paired(bam1_t **bam, int count, void *dict, bam_vector_t *r1v, bam_
             cand_size = ((vec_t(bed) *)candidate)->size;
         }
         align_n_mapped = 0;
+        first = r1v->size;
         for (j = 0; j < cand_size; ++j) {
             if (!(t1 = bam_vector_next(r1v))) return -1;
             if (!(t2 = bam_vector_next(r2v))) return -1;
@@ -464,15 +1318,19 @@ int transmap_paired(bam1_t **bam, int count, void *dict, bam_vector_t *r1v, bam_
                 if (ret2 != TRANSMAP_MAPPED){set_mate_unmapped(t1); t2->core.tid = -1;}
             }
         }
+        if ((others & OPTION_COMPACT) && align_n_mapped > 1 && compact_hits(r1v, r2v, first, align_n_mapped, 1, buffer, buffer_size) < 0) return -1;
         if (align_n_mapped > 1) statistics->align_statistics[TRANSMAP_MULTI_MAPPED]++;
         else statistics->align_statistics[align_status]++;
         read_n_mapped += align_n_mapped;
         read_status = min(read_status, align_status);
     }
     /* fix NH and HI tag */
-    if (others & OPTION_FIX_NH){
-        if (fix_NH(r1v->data + init_index, read_n_mapped) != 0) return -1;
-        if (fix_NH(r2v->data + init_index, read_n_mapped) != 0) return -1;
+    if ((others & OPTION_FIX_NH) && (others & OPTION_COMPACT)){
+        if (fix_NH_compact(r1v->data + init_index, r1v->size - init_index, read_n_mapped) != 0) return -1;
+        if (fix_NH_compact(r2v->data + init_index, r2v->size - init_index, read_n_mapped) != 0) return -1;
+    } else if (others & OPTION_FIX_NH){
+        if (fix_NH(r1v->data + init_index, r1v->size - init_index) != 0) return -1;
+        if (fix_NH(r2v->data + init_index, r2v->size - init_index) != 0) return -1;
     }
     if (read_n_mapped > 1) statistics->read_statistics[TRANSMAP_MULTI_MAPPED]++;
     else statistics->read_statistics[read_status]++;
@@ -497,6 +1355,8 @@ sam_hdr_t *hdrmap_bed(sam_hdr_t *hdr, bed_dict_t *bed){
         new_hdr->target_len[i] = record->end - record->start;
         bioidx_insert(bed->idx, record->tid, record->start, record->end, record);
     }
+    /* the index is searched from several threads */
+    if (bioidx_build(bed->idx) != 0) goto clean_up;
     i = 0;
     const char *hdr_lines = sam_hdr_str(hdr);
     int hdr_size = sam_hdr_length(hdr);
@@ -540,7 +1400,7 @@ sam_hdr_t *hdrmap_gtf(sam_hdr_t *hdr, gtf_dict_t *gtf){
         tr = kh_val(record, k);
         tr->tid = sam_hdr_name2tid(hdr, tr->exons->data[0]->chrom);
         if (!(new_hdr->target_name[tr->new_tid] = strdup(tr->name))) goto clean_up;
-        new_hdr->target_len[i++] = tr->len;
+        new_hdr->target_len[tr->new_tid] = tr->len;
         if (tr->tid < 0) continue;
         exons = tr->exons;
         for (j = 0; j < exons->size; ++j){
@@ -548,6 +1408,7 @@ sam_hdr_t *hdrmap_gtf(sam_hdr_t *hdr, gtf_dict_t *gtf){
                 goto clean_up;
         }
     }
+    if (bioidx_build(gtf->idx) != 0) goto clean_up;
     i = 0;
     const char *hdr_lines = sam_hdr_str(hdr);
     int hdr_size = sam_hdr_length(hdr);
@@ -573,46 +1434,6 @@ sam_hdr_t *hdrmap_gtf(sam_hdr_t *hdr, gtf_dict_t *gtf){
 }
 
 
-uint8_t comp_base[] = {15, 8, 4, 15, 2, 15, 15, 15, 1, 15, 15, 15, 15, 15, 15, 15, 15};
-void bam_rev_seq(bam1_t *b){
-    int32_t l;
-    uint8_t *s;
-    uint8_t v1, v2;
-    l = b->core.l_qseq;
-    s = bam_get_seq(b);
-    for (int i = 0, j = l - 1; i <= j; ++i, --j){
-        v1 = comp_base[bam_seqi(s, i)];
-        v2 = comp_base[bam_seqi(s, j)];
-        bam_set_seqi(s, i, v2);
-        bam_set_seqi(s, j, v1);
-    }
-}
-
-void bam_rev_qual(bam1_t *b){
-    int32_t l;
-    uint8_t *q;
-    uint8_t v;
-    l = b->core.l_qseq;
-    q = bam_get_qual(b);
-    for (int i = 0, j = l - 1; i < j; ++i, --j){
-        v = q[i];
-        q[i] = q[j];
-        q[j] = v;
-    }
-}
-void bam_rev_cigar(bam1_t *b){
-    int32_t l;
-    uint32_t *cigar;
-    uint32_t v;
-    l = b->core.n_cigar;
-    cigar = bam_get_cigar(b);
-    for (int i = 0, j = l - 1; i < j; ++i, --j){
-        v = cigar[i];
-        cigar[i] = cigar[j];
-        cigar[j] = v;
-    }
-}
-
 static inline char rev_base(char b){
     switch(b){
         case 'A':
@@ -906,6 +1727,14 @@ int check_exon_compatible(int32_t pos, int32_t end_pos, const uint32_t *cigars,
     return pass;
 }
 
+/* how the mapped record is built from the source record for a target on the given strand */
+static inline uint32_t build_flags(uint32_t options, char strand){
+    uint32_t flags = 0;
+    if (strand == '-') flags |= BAM_BUILD_REVERSE;
+    if (options & OPTION_DROP_SEQ) flags |= BAM_BUILD_NO_SEQ;
+    if (options & OPTION_BIN_QUAL) flags |= BAM_BUILD_BIN_QUAL;
+    return flags;
+}
 
 int transmap_bed(bam1_t *b, bam1_t *b1, bed_t *bed, uint32_t options, uint8_t **buffer, size_t *buffer_size){
     hts_pos_t pos = b->core.pos;
@@ -915,24 +1744,31 @@ int transmap_bed(bam1_t *b, bam1_t *b1, bed_t *bed, uint32_t options, uint8_t **
     uint32_t md_clip[4] = {0, 0, 0, 0};
     if (b->core.tid != bed->tid || end_pos <= bed->start || pos >= bed->end) return TRANSMAP_UNMAPPED_NO_OVERLAP;
     if (!(options & OPTION_ALLOW_PARTIAL) && (pos < bed->start || end_pos > bed->end)) return TRANSMAP_UNMAPPED_PARTIAL;
-    if (!bam_copy1(b1, b)) return -1;
+    int trimmed = 0;
     if (pos < bed->start || end_pos > bed->end || ((options & OPTION_IRREGULAR) && !(options & OPTION_NO_POLISH))){
-        new_cigar = (uint32_t *) need_buffer((b->core.n_cigar << 2u) + (2u << 2u), buffer, buffer_size);
+        if (!(new_cigar = (uint32_t *) need_buffer((b->core.n_cigar << 2u) + (2u << 2u), buffer, buffer_size))) return -1;
         trim_cigar(bed->start, bed->end, &pos, &end_pos, bam_get_cigar(b), b->core.n_cigar, new_cigar, &new_n_cigar, md_clip, options);
-        b1->core.pos = pos;
         if (new_n_cigar == 0) return TRANSMAP_UNMAPPED_NO_OVERLAP;
-        if (bam_set_cigar(b1, new_cigar, new_n_cigar) < 0) return -1;
-        if (options & OPTION_FIX_MD) if (fix_MD(b1, buffer, buffer_size, md_clip, 0, options & OPTION_FIX_NM) < 0) return -1;
+        trimmed = 1;
+    } else {
+        new_cigar = bam_get_cigar(b);
+        new_n_cigar = b->core.n_cigar;
     }
+    /* only the target of the hit is needed when no alignment is written */
+    if (options & OPTION_NO_RECORD) {
+        b1->core.tid = bed->new_tid;
+        return TRANSMAP_MAPPED;
+    }
+    /* the record is built once, already reversed for the minus strand */
+    if (bam_build(b1, b, new_cigar, new_n_cigar, build_flags(options, bed->strand)) < 0) return -1;
+    b1->core.pos = pos;
+    if (trimmed && (options & OPTION_FIX_MD)) if (fix_MD(b1, buffer, buffer_size, md_clip, 0, options & OPTION_FIX_NM) < 0) return -1;
 
     b1->core.tid = bed->new_tid;
     b1->core.pos = b1->core.pos - bed->start;
     if (bed->strand == '-') {
         b1->core.pos = bed->end - bed->start - bam_endpos(b1);
         b1->core.flag^=16u;
-        bam_rev_cigar(b1);
-        bam_rev_seq(b1);
-        bam_rev_qual(b1);
         uint8_t *md;
         if ((options & OPTION_FIX_MD) && (md = bam_aux_get(b1, "MD")) != NULL) {
             size_t md_len = strlen(++md);
@@ -954,18 +1790,23 @@ int transmap_gtf(bam1_t *b, bam1_t *b1, exon_t *exon, uint32_t options, uint8_t
     if (b->core.tid != tr->tid || end_pos <= tr->start || pos >= tr->end) return TRANSMAP_UNMAPPED_NO_OVERLAP;
     if (!(options & OPTION_ALLOW_PARTIAL) && (pos < tr->start || end_pos > tr->end)) return TRANSMAP_UNMAPPED_PARTIAL;
     if (!check_exon_compatible(pos, end_pos, bam_get_cigar(b), b->core.n_cigar, exon)) return TRANSMAP_EXON_IMCOMPATIBLE;
-    if (!bam_copy1(b1, b)) return -1;
+    if (!(new_cigar = (uint32_t *) need_buffer((b->core.n_cigar << 2u) + (2u << 2u), buffer, buffer_size))) return -1;
     if (pos < tr->start || end_pos > tr->end || ((options & OPTION_IRREGULAR) && !(options & OPTION_NO_POLISH))){
-        new_cigar = (uint32_t *) need_buffer((b->core.n_cigar << 2u) + (2u << 2u), buffer, buffer_size);
         trim_cigar(exon->start, exon->end, &pos, &end_pos, bam_get_cigar(b), b->core.n_cigar, new_cigar, &new_n_cigar, md_clip, options);
         if (new_n_cigar == 0) return TRANSMAP_UNMAPPED_NO_OVERLAP;
     } else {
-        new_cigar =  bam_get_cigar(b1);
-        new_n_cigar = b1->core.n_cigar;
+        /* stitch_cigar works in place, the source record is shared by all the candidates */
+        memcpy(new_cigar, bam_get_cigar(b), b->core.n_cigar << 2u);
+        new_n_cigar = b->core.n_cigar;
     }
     stitch_cigar(&pos, new_cigar, new_n_cigar, &new_n_cigar, &need_stitch_md);
+    if (options & OPTION_NO_RECORD) {
+        b1->core.tid = tr->new_tid;
+        return TRANSMAP_MAPPED;
+    }
+    /* the record is built once, already reversed for the minus strand */
+    if (bam_build(b1, b, new_cigar, new_n_cigar, build_flags(options, tr->strand)) < 0) return -1;
     b1->core.pos = pos;
-    if (bam_set_cigar(b1, new_cigar, new_n_cigar) < 0) return -1;
     if (options & OPTION_FIX_MD) if (fix_MD(b1, buffer, buffer_size, md_clip, need_stitch_md, options & OPTION_FIX_NM) < 0) return -1;
     int i = exon->idx;
     exon_t **exons = tr->exons->data;
@@ -975,9 +1816,6 @@ int transmap_gtf(bam1_t *b, bam1_t *b1, exon_t *exon, uint32_t options, uint8_t
     if (tr->strand == '-') {
         b1->core.pos = tr->len - bam_endpos(b1);
         b1->core.flag^=16u;
-        bam_rev_cigar(b1);
-        bam_rev_seq(b1);
-        bam_rev_qual(b1);
         uint8_t *md;
         if ((options & OPTION_FIX_MD) && (md = bam_aux_get(b1, "MD")) != NULL) {
             size_t md_len = strlen((char *)++md);
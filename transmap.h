@@ -41,9 +41,23 @@
 #define OPTION_GTF_MODE 256u
 #define OPTION_USE_INDEX 512u
 #define OPTION_IRREGULAR 1024u
+#define OPTION_COORDINATE 2048u
+#define OPTION_COLLATE 4096u
+#define OPTION_SORT 8192u
+#define OPTION_RESTRICT 16384u
+#define OPTION_TEXT_THREAD 32768u
+#define OPTION_DROP_SEQ 65536u
+#define OPTION_BIN_QUAL 131072u
+#define OPTION_COMPACT 262144u
+#define OPTION_NO_OUTPUT 524288u
+#define OPTION_NO_RECORD 1048576u
+#define OPTION_PARTITION_HASH 2097152u
 
 
 
+/* --bed and --gtf given at once */
+#define TRANSMAP_MAX_ANNOT 16
+
 struct transmap_option {
     const char* sam_file;
     const char* in_file;
@@ -52,6 +66,38 @@ struct transmap_option {
     const char *gtf_attribute;
     int index_cutoff;
     int use_index;
+    int index_backend; /* BIOIDX_BACKEND_* of the annotation index */
+    int n_threads;
+    int n_workers;
+    int n_split;
+    const char *manifest;
+    int shard;
+    const char *stats_file;
+    int max_pending;
+    int pair_memory;
+    int n_bucket;
+    int collate_memory;
+    int sort_memory;
+    int io_backend;
+    uint8_t *keep_tags; /* set of the aux tags kept in the output, NULL for all */
+    const char *tcc_file;
+    const char *count_file;
+    int count_mode;
+    const char *count_group;
+    const char *coverage_file;
+    const char *frag_file;
+    const char *col_file;
+    const char *genome_file;
+    const char *ref_file; /* transcriptome fasta built from genome_file */
+    const char *split_tag;
+    int max_open;
+    int n_part;
+    const char *tee_file;
+    int n_annot;
+    const char *annot_file[TRANSMAP_MAX_ANNOT];
+    uint64_t annot_mode[TRANSMAP_MAX_ANNOT]; /* OPTION_BED_MODE or OPTION_GTF_MODE */
+    int n_out;
+    const char *annot_out[TRANSMAP_MAX_ANNOT]; /* --fo of each annotation */
     int show_help;
     int show_version;
     uint64_t others;
@@ -61,6 +107,11 @@ void transmap_option(struct transmap_option *options, int argc, char *argv[]);
 void transmap_usage(const char* msg);
 void transmap_version();
 
+static inline int transmap_is_cram(const char *fn){
+    size_t l = strlen(fn);
+    return l > 5 && strcmp(fn + l - 5, ".cram") == 0;
+}
+
 #define TRANSMAP_UNALIGNED 9
 #define TRANSMAP_MATE_UNALIGNED 8
 #define TRANSMAP_MATE_MISSING 7
@@ -73,12 +124,83 @@ void transmap_version();
 #define TRANSMAP_MAPPED 0
 
 struct transmap_statistic {
-    int n_align_processed;
-    int align_statistics[10];
-    int n_read_processed;
-    int read_statistics[10];
+    int64_t n_align_processed;
+    int64_t align_statistics[10];
+    int64_t n_read_processed;
+    int64_t read_statistics[10];
 };
 
+#define TRANSMAP_BATCH_SIZE 1000
+
+struct bam_sort_s;
+struct sam_text_s;
+struct tcc_s;
+struct count_s;
+struct cov_s;
+struct frag_s;
+struct col_s;
+struct tag_split_s;
+struct part_s;
+
+/* where the mapped alignments are written */
+typedef struct transmap_out_s{
+    samFile *fp;
+    sam_hdr_t *hdr;
+    struct bam_sort_s *sort; /* collect the alignments for --sort instead of writing them to fp */
+    struct sam_text_s *text; /* format sam text output with the dedicated encoder */
+    const uint8_t *keep_tags; /* drop the other aux tags before writing */
+    struct tcc_s *tcc; /* count the equivalence classes of the reads */
+    struct count_s *count; /* count the reads of each target and gene */
+    struct cov_s *cov; /* coverage of the targets by the written alignments */
+    struct frag_s *frag; /* bed lines of the mapped fragments */
+    struct col_s *col; /* columnar copy of the mapped alignments */
+    struct tag_split_s *tag_split; /* write the alignments to a file per tag value instead of fp */
+    struct part_s *part; /* write the alignments to a file per range of targets instead of fp */
+    samFile *tee; /* the input records of the reads with a candidate target, tagged with their status */
+    sam_hdr_t *tee_hdr;
+} transmap_out_t;
+
+int transmap_out_write(transmap_out_t *out, bam1_t *b);
+/* write the mapped records of a pair, the records with a tid of -1 are skipped */
+int transmap_out_pair(transmap_out_t *out, bam1_t *b1, bam1_t *b2);
+
+VEC_INIT(int, int)
+
+/* a batch holds whole query-name groups of the input together with the alignments generated from them */
+typedef struct transmap_batch_t{
+    bam_vector_t *bv;
+    bam_vector_t *r1v;
+    bam_vector_t *r2v;
+    vec_t(int) *group; /* record count of each query-name group in bv */
+    vec_t(int) *hit; /* hit count of each query-name group in r1v and r2v */
+    vec_t(int) *status; /* TRANSMAP_* status of each query-name group, only kept for --tee */
+    int64_t id;
+} transmap_batch_t;
+
+/* scratch space owned by a single mapping thread */
+typedef struct transmap_worker_t{
+    void *dict;
+    void *candidate;
+    uint8_t *buffer;
+    size_t buffer_size;
+    uint64_t others;
+    struct transmap_statistic statistics;
+} transmap_worker_t;
+
+transmap_batch_t *transmap_batch_init();
+void transmap_batch_clear(transmap_batch_t *batch);
+void transmap_batch_destroy(transmap_batch_t *batch);
+int transmap_batch_read(sam_parser_t *sam, transmap_batch_t *batch, size_t batch_size);
+int transmap_batch_map(transmap_batch_t *batch, transmap_worker_t *worker, struct transmap_option *options);
+int transmap_batch_write(transmap_batch_t *batch, transmap_out_t *out);
+int transmap_worker_init(transmap_worker_t *worker, void *dict, struct transmap_option *options);
+void transmap_worker_destroy(transmap_worker_t *worker);
+void transmap_statistic_merge(struct transmap_statistic *dst, struct transmap_statistic *src);
+void transmap_statistic_print(struct transmap_statistic *statistics, struct transmap_option *options);
+int transmap_statistic_write(const char *fn, struct transmap_statistic *statistics, struct transmap_option *options);
+int transmap_statistic_read(const char *fn, struct transmap_statistic *statistics, uint64_t *others);
+
+int fix_NH(bam1_t **b, int size);
 sam_hdr_t *hdrmap_bed(sam_hdr_t *hdr, bed_dict_t *bed);
 sam_hdr_t *hdrmap_gtf(sam_hdr_t *hdr, gtf_dict_t *gtf);
 int transmap_single(bam1_t **bam, int count, void *dict, bam_vector_t *r1v, bam_vector_t *r2v, void *candidate, uint8_t **buffer, size_t *buffer_size, struct transmap_statistic *statistics, struct transmap_option *options);
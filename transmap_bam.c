@@ -24,8 +24,17 @@
  */
 
 #include <stdlib.h>
+#include <stdint.h>
+#include <limits.h>
+#include <pthread.h>
+#include <ctype.h>
+#include <string.h>
 #include "htslib/sam.h"
+#include "htslib/bgzf.h"
+#include "htslib/hts_endian.h"
 #include "transmap_bam.h"
+#include "transmap_collate.h"
+#include "transmap_io.h"
 
 bam_vector_t *bam_vector_init(){
     bam_vector_t *bv;
@@ -69,30 +78,85 @@ int sam_parser_comp(const void *_b1, const void *_b2){
     return (b2->core.flag & BAM_FREAD1) - (b1->core.flag & BAM_FREAD1);
 }
 
-sam_parser_t *sam_parser_open(const char* fn){
-    sam_parser_t *p = malloc(sizeof(sam_parser_t));
-    p->fn = strdup(fn);
-    p->fp = sam_open(fn, "r");
-    if (!p->fp) return NULL;
-    p->hdr = sam_hdr_read(p->fp);
-    if (!p->hdr){free(p->fn); sam_close(p->fp) ;return NULL;}
-    bam1_t *b = bam_init1();
-    if (!b) {free(p->fn); sam_hdr_destroy(p->hdr);sam_close(p->fp) ;return NULL;}
-    int ret = sam_read1(p->fp, p->hdr, b);
-    if (ret < 0) {free(p->fn); bam_destroy1(b); sam_hdr_destroy(p->hdr);sam_close(p->fp) ;return NULL;}
-    p->b = b;
+static inline int sam_parser_read1(sam_parser_t *p, bam1_t *b){
+    if (p->collate) return sam_collate_read1(p->collate, b);
+    if (p->itr) return sam_itr_next(p->fp, p->itr, b);
+    if (p->end >= 0 && bgzf_tell(p->fp->fp.bgzf) >= p->end) return -1;
+    if (p->io) transmap_io_read(p->io);
+    return sam_read1(p->fp, p->hdr, b);
+}
+
+sam_parser_t *sam_parser_open(const char* fn, htsThreadPool *tpool, int io_backend){
+    sam_parser_t *p = calloc(1, sizeof(sam_parser_t));
+    if (!p) return NULL;
+    p->end = -1;
+    if (!(p->fn = strdup(fn))) goto clean_up;
+    if (!(p->fp = transmap_io_open(fn, io_backend, &p->io))) goto clean_up;
+    /* the pool must be attached before the first block is inflated */
+    if (tpool && tpool->pool && hts_set_opt(p->fp, HTS_OPT_THREAD_POOL, tpool) != 0) goto clean_up;
+    if (!(p->hdr = sam_hdr_read(p->fp))) goto clean_up;
+    if (!(p->b = bam_init1())) goto clean_up;
+    if (sam_read1(p->fp, p->hdr, p->b) < 0) goto clean_up;
     return p;
+
+    clean_up:
+    if (p->b) bam_destroy1(p->b);
+    if (p->hdr) sam_hdr_destroy(p->hdr);
+    if (p->io) transmap_io_close(p->io);
+    if (p->fp) sam_close(p->fp);
+    if (p->fn) free(p->fn);
+    free(p);
+    return NULL;
 }
 
 int sam_parser_close(sam_parser_t *p) {
     free(p->fn);
     bam_hdr_destroy(p->hdr);
+    if (p->io) transmap_io_close(p->io);
     sam_close(p->fp);
     if (p->b) bam_destroy1(p->b);
+    if (p->collate) sam_collate_destroy(p->collate);
+    if (p->itr) hts_itr_destroy(p->itr);
+    if (p->idx) hts_idx_destroy(p->idx);
     free(p);
     return 0;
 }
 
+int sam_parser_range(sam_parser_t *p, int64_t start, int64_t end){
+    int ret;
+    if (p->fp->format.format != bam) return -1;
+    if (bgzf_seek(p->fp->fp.bgzf, start, SEEK_SET) < 0) return -1;
+    p->end = end;
+    if (!p->b && !(p->b = bam_init1())) return -1;
+    if ((ret = sam_parser_read1(p, p->b)) < -1) return -1;
+    if (ret == -1) {
+        bam_destroy1(p->b);
+        p->b = NULL;
+    }
+    return 0;
+}
+
+/* restart the parser on the records overlapping the regions, through the index of the input. The reglist is owned
+ * by the iterator afterwards. */
+int sam_parser_regions(sam_parser_t *p, hts_reglist_t *reglist, unsigned int n){
+    int ret;
+    if (!(p->idx = sam_index_load(p->fp, p->fn))) {hts_reglist_free(reglist, n); return -1;}
+    if (n == 0) {
+        hts_reglist_free(reglist, n);
+        if (p->b) bam_destroy1(p->b);
+        p->b = NULL;
+        return 0;
+    }
+    if (!(p->itr = sam_itr_regions(p->idx, p->hdr, reglist, n))) return -1;
+    if (!p->b && !(p->b = bam_init1())) return -1;
+    if ((ret = sam_parser_read1(p, p->b)) < -1) return -1;
+    if (ret == -1) {
+        bam_destroy1(p->b);
+        p->b = NULL;
+    }
+    return 0;
+}
+
 int sam_parser_next(sam_parser_t *p, bam_vector_t *bv){
     if (!p->b) return 0;
     bam1_t *b, *b1;
@@ -100,7 +164,7 @@ int sam_parser_next(sam_parser_t *p, bam_vector_t *bv){
     if (!(b1 = bam_vector_next(bv))) return -1;
     bv->data[bv->size] = p->b;
     size_t init_index = bv->size++;
-    while ((b = bam_vector_next(bv)) && (ret = sam_read1(p->fp, p->hdr, b)) >= 0){
+    while ((b = bam_vector_next(bv)) && (ret = sam_parser_read1(p, b)) >= 0){
         if (strcmp(bam_get_qname(b), bam_get_qname(p->b)) == 0) {
             if (b->core.flag & BAM_FSUPPLEMENTARY) continue;
             bv->size++;
@@ -120,6 +184,22 @@ int sam_parser_next(sam_parser_t *p, bam_vector_t *bv){
     return bv->size - init_index;
 }
 
+/* take the next record without grouping by query name; *b is swapped with the record buffered by the parser */
+int sam_parser_next1(sam_parser_t *p, bam1_t **b){
+    bam1_t *tmp;
+    int ret;
+    if (!p->b) return 0;
+    tmp = *b;
+    *b = p->b;
+    p->b = tmp;
+    if ((ret = sam_parser_read1(p, p->b)) < -1) return -1;
+    if (ret == -1) {
+        bam_destroy1(p->b);
+        p->b = NULL;
+    }
+    return 1;
+}
+
 static int sam_realloc_bam_data(bam1_t *b, size_t desired) /* from htslib-1.15 */
 {
     uint32_t new_m_data;
@@ -157,4 +237,131 @@ int bam_set_cigar(bam1_t *b, uint32_t *new_cigars, uint32_t new_n_cigar){
     }
     memmove(bam_get_cigar(b), new_cigars, new_n_cigar<<2u);
     return 0;
-}
\ No newline at end of file
+}
+
+static const uint8_t bam_comp_base[16] = {15, 8, 4, 15, 2, 15, 15, 15, 1, 15, 15, 15, 15, 15, 15, 15};
+
+/* 8-level quality binning: 0-1 are kept, then 2-9, 10-19, 20-24, 25-29, 30-34, 35-39 and 40+ */
+static uint8_t bam_qual_bin[256];
+static pthread_once_t bam_qual_bin_once = PTHREAD_ONCE_INIT;
+
+static void bam_qual_bin_init(void){
+    for (int q = 0; q < 256; ++q){
+        if (q < 2) bam_qual_bin[q] = q;
+        else if (q < 10) bam_qual_bin[q] = 6;
+        else if (q < 20) bam_qual_bin[q] = 15;
+        else if (q < 25) bam_qual_bin[q] = 22;
+        else if (q < 30) bam_qual_bin[q] = 27;
+        else if (q < 35) bam_qual_bin[q] = 33;
+        else if (q < 40) bam_qual_bin[q] = 37;
+        else bam_qual_bin[q] = 40;
+    }
+    bam_qual_bin[0xff] = 0xff;
+}
+
+/* build b1 from b in a single pass with a new cigar: the query name, the cigar, SEQ, QUAL and aux are written once
+ * each, for BAM_BUILD_REVERSE the cigar and QUAL reversed and SEQ reverse complemented on the way. This replaces
+ * bam_copy1() followed by bam_set_cigar() and the in-place reversals. BAM_BUILD_NO_SEQ leaves SEQ and QUAL empty,
+ * BAM_BUILD_BIN_QUAL bins QUAL while it is copied. */
+int bam_build(bam1_t *b1, const bam1_t *b, const uint32_t *cigar, uint32_t n_cigar, uint32_t flags){
+    int32_t l_qseq = (flags & BAM_BUILD_NO_SEQ)? 0: b->core.l_qseq, i;
+    int reverse = (flags & BAM_BUILD_REVERSE) != 0;
+    size_t l_qname = b->core.l_qname;
+    size_t l_seq = (l_qseq + 1) >> 1u;
+    size_t l_aux = bam_get_l_aux(b);
+    size_t l_data = l_qname + (n_cigar << 2u) + l_seq + l_qseq + l_aux;
+    const uint8_t *s, *q;
+    uint8_t *d;
+    uint32_t *c;
+    if (l_data > INT32_MAX) return -1;
+    if (l_data > b1->m_data && sam_realloc_bam_data(b1, l_data) < 0) return -1;
+    b1->core = b->core;
+    b1->core.n_cigar = n_cigar;
+    b1->core.l_qseq = l_qseq;
+    b1->l_data = l_data;
+    b1->id = b->id;
+    d = b1->data;
+    memcpy(d, b->data, l_qname);
+    d += l_qname;
+    c = (uint32_t *)d;
+    if (reverse) for (i = 0; i < n_cigar; ++i) c[i] = cigar[n_cigar - 1 - i];
+    else memcpy(c, cigar, n_cigar << 2u);
+    d += n_cigar << 2u;
+    if (l_qseq > 0){
+        s = bam_get_seq(b);
+        if (reverse) {
+            memset(d, 0, l_seq);
+            for (i = 0; i < l_qseq; ++i) d[i >> 1] |= bam_comp_base[bam_seqi(s, l_qseq - 1 - i)] << ((~i & 1) << 2);
+        } else memcpy(d, s, l_seq);
+        d += l_seq;
+        q = bam_get_qual(b);
+        if (flags & BAM_BUILD_BIN_QUAL) {
+            pthread_once(&bam_qual_bin_once, bam_qual_bin_init);
+            if (reverse) for (i = 0; i < l_qseq; ++i) d[i] = bam_qual_bin[q[l_qseq - 1 - i]];
+            else for (i = 0; i < l_qseq; ++i) d[i] = bam_qual_bin[q[i]];
+        } else if (reverse) for (i = 0; i < l_qseq; ++i) d[i] = q[l_qseq - 1 - i];
+        else memcpy(d, q, l_qseq);
+        d += l_qseq;
+    }
+    memcpy(d, bam_get_aux(b), l_aux);
+    return 0;
+}
+
+/* size of an aux field including its tag and type, 0 if it is malformed */
+static size_t bam_aux_size(const uint8_t *s, const uint8_t *end){
+    const uint8_t *z;
+    uint32_t n;
+    if (end - s < 3) return 0;
+    switch (s[2]){
+        case 'A': case 'c': case 'C': return end - s >= 4? 4: 0;
+        case 's': case 'S': return end - s >= 5? 5: 0;
+        case 'i': case 'I': case 'f': return end - s >= 7? 7: 0;
+        case 'd': return end - s >= 11? 11: 0;
+        case 'Z': case 'H':
+            if (!(z = memchr(s + 3, '\0', end - s - 3))) return 0;
+            return z + 1 - s;
+        case 'B':
+            if (end - s < 8) return 0;
+            n = le_to_u32(s + 4);
+            switch (s[3]){
+                case 'c': case 'C': break;
+                case 's': case 'S': n <<= 1u; break;
+                case 'i': case 'I': case 'f': n <<= 2u; break;
+                default: return 0;
+            }
+            return (size_t)(end - s - 8) >= n? 8 + n: 0;
+        default:
+            return 0;
+    }
+}
+
+uint8_t *bam_tag_set(const char *tags){
+    uint8_t *set;
+    const char *p = tags;
+    if (!(set = calloc(1, BAM_TAG_SET_SIZE))) return NULL;
+    while (1){
+        if (!isalpha((unsigned char)p[0]) || !isalnum((unsigned char)p[1]) || (p[2] != ',' && p[2] != '\0')) {
+            free(set);
+            return NULL;
+        }
+        bam_tag_set_add(set, p);
+        if (p[2] == '\0') break;
+        p += 3;
+    }
+    return set;
+}
+
+int bam_aux_keep(bam1_t *b, const uint8_t *set){
+    uint8_t *s = bam_get_aux(b), *d = s, *end = b->data + b->l_data;
+    size_t size;
+    while (s < end){
+        if ((size = bam_aux_size(s, end)) == 0) return -1;
+        if (bam_tag_set_has(set, s)) {
+            if (d != s) memmove(d, s, size);
+            d += size;
+        }
+        s += size;
+    }
+    b->l_data = d - b->data;
+    return 0;
+}
@@ -34,14 +34,38 @@ typedef struct sam_parser_s{
     samFile *fp;
     sam_hdr_t *hdr;
     bam1_t *b;
+    int64_t end; /* virtual offset at which the parser stops, -1 for the end of file */
+    struct sam_collate_s *collate; /* read from the collated buckets instead of fp when set */
+    hts_idx_t *idx;
+    hts_itr_t *itr; /* only read the regions of the iterator when set */
+    struct transmap_io_s *io;
 } sam_parser_t;
 
 bam_vector_t *bam_vector_init();
 bam1_t *bam_vector_next(bam_vector_t *bv);
 void bam_vector_destroy(bam_vector_t *bv);
 
-sam_parser_t *sam_parser_open(const char* fn);
+sam_parser_t *sam_parser_open(const char* fn, htsThreadPool *tpool, int io_backend);
 int sam_parser_close(sam_parser_t *p);
 int sam_parser_next(sam_parser_t *p, bam_vector_t *bv);
+int sam_parser_next1(sam_parser_t *p, bam1_t **b);
+int sam_parser_range(sam_parser_t *p, int64_t start, int64_t end);
+int sam_parser_regions(sam_parser_t *p, hts_reglist_t *reglist, unsigned int n);
 
-int bam_set_cigar(bam1_t *b, uint32_t *new_cigars, uint32_t new_n_cigar);
\ No newline at end of file
+int bam_set_cigar(bam1_t *b, uint32_t *new_cigars, uint32_t new_n_cigar);
+
+#define BAM_BUILD_REVERSE 1u
+#define BAM_BUILD_NO_SEQ 2u
+#define BAM_BUILD_BIN_QUAL 4u
+
+int bam_build(bam1_t *b1, const bam1_t *b, const uint32_t *cigar, uint32_t n_cigar, uint32_t flags);
+
+/* set of two-character aux tags, one bit per tag */
+#define BAM_TAG_SET_SIZE 8192
+#define bam_tag_set_add(set, tag) ((set)[((uint8_t)(tag)[0] << 5u) | ((uint8_t)(tag)[1] >> 3u)] |= 1u << ((uint8_t)(tag)[1] & 7u))
+#define bam_tag_set_has(set, tag) ((set)[((uint8_t)(tag)[0] << 5u) | ((uint8_t)(tag)[1] >> 3u)] & (1u << ((uint8_t)(tag)[1] & 7u)))
+
+/* parse a comma-separated list of tags, NULL if it is malformed */
+uint8_t *bam_tag_set(const char *tags);
+/* remove the aux fields whose tag is not in set */
+int bam_aux_keep(bam1_t *b, const uint8_t *set);
\ No newline at end of file
@@ -66,7 +66,7 @@ void bed_free(bed_dict_t *bed){
     free(bed);
 }
 
-bed_dict_t *bed_parse(const char* fname){
+bed_dict_t *bed_parse(const char* fname, int index_backend){
     char buffer[1024];
     char *items[7];
     int new_tid = 0;
@@ -78,7 +78,7 @@ bed_dict_t *bed_parse(const char* fname){
     if (bed->record == NULL) goto clean_up;
     bed->size = 0;
     bed->capacity = 1;
-    bed->idx = bioidx_init();
+    bed->idx = bioidx_init_backend(index_backend);
     if (!bed->idx) goto clean_up;
     while (fgets(buffer, 1024, f)){
         strsplit(buffer, items, 7, '\t');
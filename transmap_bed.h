@@ -48,7 +48,7 @@ typedef struct bed_dict_t{
 
 VEC_INIT(bed, bed_t *)
 
-bed_dict_t *bed_parse(const char* fname);
+bed_dict_t *bed_parse(const char* fname, int index_backend);
 void bed_free(bed_dict_t *bed);
 void bed_search1(bed_dict_t *bed, bam1_t *b, vec_t(bed) *hits);
 void bed_search2(bed_dict_t *bed, bam1_t *r1, bam1_t *r2, vec_t(bed) *hits, int mode);
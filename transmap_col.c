@@ -0,0 +1,200 @@
+/* The MIT License (MIT)
+
+   Copyright (c) 2023 Anrui Liu <liuar6@gmail.com>
+
+   Permission is hereby granted, free of charge, to any person obtaining
+   a copy of this software and associated documentation files (the
+   “Software”), to deal in the Software without restriction, including
+   without limitation the rights to use, copy, modify, merge, publish,
+   distribute, sublicense, and/or sell copies of the Software, and to
+   permit persons to whom the Software is furnished to do so, subject to
+   the following conditions:
+
+   The above copyright notice and this permission notice shall be
+   included in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+   EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+   MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+   NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+   BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+   ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+   CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "htslib/sam.h"
+#include "htslib/hfile.h"
+#include "transmap_col.h"
+
+struct col_s{
+    hFILE *hf;
+    uint64_t offset; /* bytes written so far */
+    int64_t group;   /* index of the next query-name group */
+    /* columns of the current chunk */
+    size_t n;
+    int64_t *group_col;
+    int32_t *tid;
+    int64_t *pos;
+    int64_t *end;
+    uint16_t *flag;
+    int32_t *nh;
+    uint8_t *strand;
+    uint64_t *cigar_offset;
+    uint32_t *cigar;
+    size_t n_cigar;
+    size_t m_cigar;
+    /* index of the written chunks */
+    col_chunk_t *index;
+    size_t n_chunk;
+    size_t m_chunk;
+};
+
+static int col_put(col_t *c, const void *data, size_t size){
+    if (size && hwrite(c->hf, data, size) != (ssize_t)size) return -1;
+    c->offset += size;
+    return 0;
+}
+
+static int col_pad(col_t *c){
+    static const char zero[8] = {0};
+    return col_put(c, zero, (8 - c->offset % 8) % 8);
+}
+
+/* write a column at the next multiple of 8 and record its offset */
+static int col_column(col_t *c, uint64_t *offset, const void *data, size_t size){
+    if (col_pad(c) != 0) return -1;
+    *offset = c->offset;
+    return col_put(c, data, size);
+}
+
+static int col_flush(col_t *c){
+    col_chunk_t *chunk;
+    size_t n = c->n;
+    if (n == 0) return 0;
+    if (c->n_chunk == c->m_chunk){
+        size_t m = c->m_chunk? c->m_chunk << 1u: 16;
+        col_chunk_t *new_index = realloc(c->index, m * sizeof(*new_index));
+        if (!new_index) return -1;
+        c->index = new_index;
+        c->m_chunk = m;
+    }
+    chunk = c->index + c->n_chunk;
+    chunk->n_record = n;
+    chunk->n_cigar = c->n_cigar;
+    if (col_column(c, &chunk->offset[COL_GROUP], c->group_col, n * sizeof(*c->group_col)) != 0) return -1;
+    if (col_column(c, &chunk->offset[COL_TID], c->tid, n * sizeof(*c->tid)) != 0) return -1;
+    if (col_column(c, &chunk->offset[COL_POS], c->pos, n * sizeof(*c->pos)) != 0) return -1;
+    if (col_column(c, &chunk->offset[COL_END], c->end, n * sizeof(*c->end)) != 0) return -1;
+    if (col_column(c, &chunk->offset[COL_FLAG], c->flag, n * sizeof(*c->flag)) != 0) return -1;
+    if (col_column(c, &chunk->offset[COL_NH], c->nh, n * sizeof(*c->nh)) != 0) return -1;
+    if (col_column(c, &chunk->offset[COL_STRAND], c->strand, n * sizeof(*c->strand)) != 0) return -1;
+    if (col_column(c, &chunk->offset[COL_CIGAR_OFFSET], c->cigar_offset, (n + 1) * sizeof(*c->cigar_offset)) != 0) return -1;
+    if (col_column(c, &chunk->offset[COL_CIGAR], c->cigar, c->n_cigar * sizeof(*c->cigar)) != 0) return -1;
+    c->n_chunk++;
+    c->n = 0;
+    c->n_cigar = 0;
+    return 0;
+}
+
+static int col_add1(col_t *c, const bam1_t *b){
+    const uint8_t *nh;
+    size_t i = c->n;
+    uint32_t n_cigar = b->core.n_cigar;
+    if (c->n_cigar + n_cigar > c->m_cigar){
+        size_t m = c->m_cigar << 1u;
+        while (m < c->n_cigar + n_cigar) m <<= 1u;
+        uint32_t *new_cigar = realloc(c->cigar, m * sizeof(*new_cigar));
+        if (!new_cigar) return -1;
+        c->cigar = new_cigar;
+        c->m_cigar = m;
+    }
+    c->group_col[i] = c->group;
+    c->tid[i] = b->core.tid;
+    c->pos[i] = b->core.pos;
+    c->end[i] = bam_endpos(b);
+    c->flag[i] = b->core.flag;
+    c->nh[i] = (nh = bam_aux_get(b, "NH"))? (int32_t)bam_aux2i(nh): 0;
+    c->strand[i] = bam_is_rev(b)? 1: 0;
+    c->cigar_offset[i] = c->n_cigar;
+    memcpy(c->cigar + c->n_cigar, bam_get_cigar(b), n_cigar * sizeof(*c->cigar));
+    c->n_cigar += n_cigar;
+    c->cigar_offset[i + 1] = c->n_cigar;
+    if (++c->n == TRANSMAP_COL_CHUNK) return col_flush(c);
+    return 0;
+}
+
+int col_add(col_t *c, bam1_t **r1, bam1_t **r2, int n){
+    int i;
+    for (i = 0; i < n; ++i){
+        if (r1[i]->core.tid != -1 && col_add1(c, r1[i]) != 0) return -1;
+        if (r2[i]->core.tid != -1 && col_add1(c, r2[i]) != 0) return -1;
+    }
+    c->group++;
+    return 0;
+}
+
+col_t *col_init(const char *fn){
+    col_t *c;
+    if (!(c = calloc(1, sizeof(*c)))) return NULL;
+    c->m_cigar = TRANSMAP_COL_CHUNK;
+    if (!(c->group_col = malloc(TRANSMAP_COL_CHUNK * sizeof(*c->group_col)))) goto clean_up;
+    if (!(c->tid = malloc(TRANSMAP_COL_CHUNK * sizeof(*c->tid)))) goto clean_up;
+    if (!(c->pos = malloc(TRANSMAP_COL_CHUNK * sizeof(*c->pos)))) goto clean_up;
+    if (!(c->end = malloc(TRANSMAP_COL_CHUNK * sizeof(*c->end)))) goto clean_up;
+    if (!(c->flag = malloc(TRANSMAP_COL_CHUNK * sizeof(*c->flag)))) goto clean_up;
+    if (!(c->nh = malloc(TRANSMAP_COL_CHUNK * sizeof(*c->nh)))) goto clean_up;
+    if (!(c->strand = malloc(TRANSMAP_COL_CHUNK * sizeof(*c->strand)))) goto clean_up;
+    if (!(c->cigar_offset = malloc((TRANSMAP_COL_CHUNK + 1) * sizeof(*c->cigar_offset)))) goto clean_up;
+    if (!(c->cigar = malloc(c->m_cigar * sizeof(*c->cigar)))) goto clean_up;
+    if (!(c->hf = hopen(fn, "w"))) goto clean_up;
+    if (col_put(c, TRANSMAP_COL_MAGIC, 8) != 0) goto clean_up;
+    return c;
+
+    clean_up:
+    col_destroy(c);
+    return NULL;
+}
+
+int col_close(col_t *c, sam_hdr_t *hdr){
+    col_trailer_t trailer;
+    uint64_t n_target = sam_hdr_nref(hdr);
+    uint64_t i;
+    const char *name;
+    int ret = -1;
+    if (col_flush(c) != 0) goto clean_up;
+    if (col_column(c, &trailer.names_offset, &n_target, sizeof(n_target)) != 0) goto clean_up;
+    for (i = 0; i < n_target; ++i){
+        name = sam_hdr_tid2name(hdr, (int)i);
+        if (col_put(c, name, strlen(name) + 1) != 0) goto clean_up;
+    }
+    if (col_column(c, &trailer.index_offset, c->index, c->n_chunk * sizeof(*c->index)) != 0) goto clean_up;
+    trailer.n_chunk = c->n_chunk;
+    memcpy(trailer.magic, TRANSMAP_COL_MAGIC, 8);
+    if (col_put(c, &trailer, sizeof(trailer)) != 0) goto clean_up;
+    ret = 0;
+
+    clean_up:
+    if (hclose(c->hf) != 0) ret = -1;
+    c->hf = NULL;
+    return ret;
+}
+
+void col_destroy(col_t *c){
+    if (!c) return;
+    if (c->hf) hclose_abruptly(c->hf);
+    free(c->group_col);
+    free(c->tid);
+    free(c->pos);
+    free(c->end);
+    free(c->flag);
+    free(c->nh);
+    free(c->strand);
+    free(c->cigar_offset);
+    free(c->cigar);
+    free(c->index);
+    free(c);
+}
@@ -0,0 +1,79 @@
+/* The MIT License (MIT)
+
+   Copyright (c) 2023 Anrui Liu <liuar6@gmail.com>
+
+   Permission is hereby granted, free of charge, to any person obtaining
+   a copy of this software and associated documentation files (the
+   “Software”), to deal in the Software without restriction, including
+   without limitation the rights to use, copy, modify, merge, publish,
+   distribute, sublicense, and/or sell copies of the Software, and to
+   permit persons to whom the Software is furnished to do so, subject to
+   the following conditions:
+
+   The above copyright notice and this permission notice shall be
+   included in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+   EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+   MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+   NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+   BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+   ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+   CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+ */
+
+#ifndef __TRANSMAP_COL_H
+#define __TRANSMAP_COL_H
+
+#include <stdint.h>
+#include "htslib/sam.h"
+
+/* Columnar file of the mapped alignments, written in the byte order of the host:
+ *
+ *   magic           "TMCOL001"
+ *   chunk * n_chunk the columns of up to TRANSMAP_COL_CHUNK alignments, each column starting at a multiple of 8
+ *   names           n_target as uint64_t, then the nul-terminated target names in tid order
+ *   index           col_chunk_t * n_chunk
+ *   trailer         col_trailer_t
+ *
+ * so that a reader maps the file, locates the index from the trailer and uses the columns in place. */
+#define TRANSMAP_COL_MAGIC "TMCOL001"
+#define TRANSMAP_COL_CHUNK 65536
+
+enum {
+    COL_GROUP,        /* int64_t, index of the query-name group in the input */
+    COL_TID,          /* int32_t, tid in the new header */
+    COL_POS,          /* int64_t, 0-based leftmost position */
+    COL_END,          /* int64_t, 0-based exclusive end */
+    COL_FLAG,         /* uint16_t */
+    COL_NH,           /* int32_t, 0 when the NH tag is missing */
+    COL_STRAND,       /* uint8_t, 0 for forward, 1 for reverse */
+    COL_CIGAR_OFFSET, /* uint64_t * (n_record + 1), the cigar of alignment i is COL_CIGAR[offset[i], offset[i + 1]) */
+    COL_CIGAR,        /* uint32_t, bam encoded cigar operations */
+    COL_N
+};
+
+typedef struct {
+    uint64_t n_record;
+    uint64_t n_cigar;
+    uint64_t offset[COL_N]; /* file offset of each column */
+} col_chunk_t;
+
+typedef struct {
+    uint64_t n_chunk;
+    uint64_t index_offset;
+    uint64_t names_offset;
+    char magic[8];
+} col_trailer_t;
+
+typedef struct col_s col_t;
+
+col_t *col_init(const char *fn);
+/* add the n pairs of one query-name group, the records with a tid of -1 are skipped */
+int col_add(col_t *c, bam1_t **r1, bam1_t **r2, int n);
+/* write the last chunk, the target names of hdr and the index, then close the file */
+int col_close(col_t *c, sam_hdr_t *hdr);
+void col_destroy(col_t *c);
+
+#endif /* __TRANSMAP_COL_H */
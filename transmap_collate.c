@@ -0,0 +1,210 @@
+/* The MIT License (MIT)
+
+   Copyright (c) 2023 Anrui Liu <liuar6@gmail.com>
+
+   Permission is hereby granted, free of charge, to any person obtaining
+   a copy of this software and associated documentation files (the
+   “Software”), to deal in the Software without restriction, including
+   without limitation the rights to use, copy, modify, merge, publish,
+   distribute, sublicense, and/or sell copies of the Software, and to
+   permit persons to whom the Software is furnished to do so, subject to
+   the following conditions:
+
+   The above copyright notice and this permission notice shall be
+   included in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+   EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+   MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+   NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+   BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+   ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+   CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "htslib/sam.h"
+#include "htslib/khash.h"
+#include "transmap_bam.h"
+#include "transmap_collate.h"
+
+static void collate_bucket_file(sam_collate_t *c, int i, char *fn){
+    sprintf(fn, "%s.collate%d.tmp", c->prefix, i);
+}
+
+/* a different hash of the query name for each level, so that the records of a bucket spread over its sub-buckets */
+static inline uint32_t collate_hash(const char *name, int level){
+    uint32_t h = __ac_X31_hash_string(name) + (uint32_t)level * 0x9e3779b9u;
+    h ^= h >> 16u;
+    h *= 0x85ebca6bu;
+    h ^= h >> 13u;
+    h *= 0xc2b2ae35u;
+    h ^= h >> 16u;
+    return h;
+}
+
+/* by query name, then in input order since the records of a bucket are loaded into consecutive slots */
+static int collate_comp(const void *a, const void *b){
+    bam1_t **b1 = *(bam1_t ***)a, **b2 = *(bam1_t ***)b;
+    int ret = strcmp(bam_get_qname(*b1), bam_get_qname(*b2));
+    if (ret) return ret;
+    return (b1 > b2) - (b1 < b2);
+}
+
+/* create n bucket files of the given level, which are pushed to the stack so that they are removed on failure */
+static int collate_open(sam_collate_t *c, sam_hdr_t *hdr, samFile **fp, int n, int level, char *fn){
+    collate_bucket_t *new_bucket;
+    int i;
+    if (c->n_bucket + n > c->m_bucket){
+        if (!(new_bucket = realloc(c->bucket, (c->n_bucket + n) * sizeof(*new_bucket)))) return -1;
+        c->bucket = new_bucket;
+        c->m_bucket = c->n_bucket + n;
+    }
+    for (i = 0; i < n; ++i){
+        collate_bucket_file(c, c->n_file, fn);
+        if (!(fp[i] = sam_open(fn, "wb1"))) return -1;
+        c->bucket[c->n_bucket].id = c->n_file++;
+        c->bucket[c->n_bucket++].level = level;
+        if (c->tpool && c->tpool->pool && hts_set_opt(fp[i], HTS_OPT_THREAD_POOL, c->tpool) != 0) return -1;
+        if (sam_hdr_write(fp[i], hdr) != 0) return -1;
+    }
+    return 0;
+}
+
+static int collate_close(samFile **fp, int n){
+    int i, ret = 0;
+    for (i = 0; i < n; ++i){
+        if (fp[i] && sam_close(fp[i]) != 0) ret = -1;
+        fp[i] = NULL;
+    }
+    return ret;
+}
+
+/* split the bucket of the given level, whose first records are already in c->bv and the rest still in fp */
+static int collate_split(sam_collate_t *c, samFile *fp, sam_hdr_t *hdr, int level, char *fn){
+    samFile *sub[TRANSMAP_COLLATE_SPLIT] = {NULL};
+    bam1_t *b = c->bv->size > 0? c->bv->data[0]: NULL;
+    size_t i;
+    int ret = -1;
+    if (collate_open(c, hdr, sub, TRANSMAP_COLLATE_SPLIT, level + 1, fn) != 0) goto clean_up;
+    for (i = 0; i < c->bv->size; ++i)
+        if (sam_write1(sub[collate_hash(bam_get_qname(c->bv->data[i]), level + 1) % TRANSMAP_COLLATE_SPLIT], hdr, c->bv->data[i]) < 0) goto clean_up;
+    while ((ret = sam_read1(fp, hdr, b)) >= 0)
+        if (sam_write1(sub[collate_hash(bam_get_qname(b), level + 1) % TRANSMAP_COLLATE_SPLIT], hdr, b) < 0) {ret = -2; break;}
+    ret = ret == -1? 0: -1;
+
+    clean_up:
+    if (collate_close(sub, TRANSMAP_COLLATE_SPLIT) != 0) ret = -1;
+    c->bv->size = 0;
+    return ret;
+}
+
+static int collate_load(sam_collate_t *c){
+    samFile *fp;
+    sam_hdr_t *hdr = NULL;
+    bam1_t *b, ***new_order;
+    collate_bucket_t bucket = c->bucket[--c->n_bucket];
+    size_t i, mem = 0;
+    char *fn;
+    int ret = -2;
+    if (!(fn = malloc(strlen(c->prefix) + 32))) return -1;
+    collate_bucket_file(c, bucket.id, fn);
+    c->bv->size = 0;
+    c->n = c->i = 0;
+    if (!(fp = sam_open(fn, "r"))) goto clean_up;
+    if (c->tpool && c->tpool->pool && hts_set_opt(fp, HTS_OPT_THREAD_POOL, c->tpool) != 0) goto clean_up;
+    if (!(hdr = sam_hdr_read(fp))) goto clean_up;
+    while ((b = bam_vector_next(c->bv)) && (ret = sam_read1(fp, hdr, b)) >= 0) {
+        c->bv->size++;
+        mem += sizeof(*b) + b->l_data;
+        /* the records of one query name can not be split, so a bucket is loaded whatever its size at the last level */
+        if (mem > c->max_mem && bucket.level < TRANSMAP_COLLATE_MAX_LEVEL){
+            ret = collate_split(c, fp, hdr, bucket.level, fn) == 0? 0: -2;
+            goto clean_up;
+        }
+    }
+    if (!b || ret < -1) {ret = -2; goto clean_up;}
+    if (c->bv->size > c->m_order){
+        if (!(new_order = realloc(c->order, c->bv->size * sizeof(*new_order)))) {ret = -2; goto clean_up;}
+        c->order = new_order;
+        c->m_order = c->bv->size;
+    }
+    for (i = 0; i < c->bv->size; ++i) c->order[i] = c->bv->data + i;
+    if (c->bv->size > 1) qsort(c->order, c->bv->size, sizeof(*c->order), collate_comp);
+    c->n = c->bv->size;
+    ret = 0;
+
+    clean_up:
+    if (hdr) sam_hdr_destroy(hdr);
+    if (fp) sam_close(fp);
+    collate_bucket_file(c, bucket.id, fn);
+    remove(fn);
+    free(fn);
+    return ret == 0? 0: -1;
+}
+
+int sam_collate_read1(sam_collate_t *c, bam1_t *b){
+    while (c->i == c->n) {
+        if (c->n_bucket == 0) return -1;
+        if (collate_load(c) != 0) return -2;
+    }
+    if (!bam_copy1(b, *c->order[c->i++])) return -2;
+    return 0;
+}
+
+void sam_collate_destroy(sam_collate_t *c){
+    char *fn;
+    int i;
+    if (c->prefix && (fn = malloc(strlen(c->prefix) + 32))){
+        for (i = 0; i < c->n_bucket; ++i) {collate_bucket_file(c, c->bucket[i].id, fn); remove(fn);}
+        free(fn);
+    }
+    if (c->prefix) free(c->prefix);
+    if (c->bucket) free(c->bucket);
+    if (c->bv) bam_vector_destroy(c->bv);
+    if (c->order) free(c->order);
+    free(c);
+}
+
+int sam_parser_collate(sam_parser_t *p, const char *prefix, int n_bucket, size_t max_mem, htsThreadPool *tpool){
+    sam_collate_t *c;
+    samFile **bucket = NULL;
+    bam1_t *b = NULL;
+    char *fn = NULL;
+    int ret, error = -1;
+    if (!(c = calloc(1, sizeof(*c)))) return -1;
+    c->max_mem = max_mem;
+    c->tpool = tpool;
+    if (!(c->prefix = strdup(prefix))) goto clean_up;
+    if (!(c->bv = bam_vector_init())) goto clean_up;
+    if (!(fn = malloc(strlen(prefix) + 32))) goto clean_up;
+    if (!(bucket = calloc(n_bucket, sizeof(*bucket)))) goto clean_up;
+    if (collate_open(c, p->hdr, bucket, n_bucket, 0, fn) != 0) goto clean_up;
+    if (!(b = bam_init1())) goto clean_up;
+    while ((ret = sam_parser_next1(p, &b)) > 0)
+        if (sam_write1(bucket[collate_hash(bam_get_qname(b), 0) % n_bucket], p->hdr, b) < 0) goto clean_up;
+    if (ret < 0) goto clean_up;
+    if (collate_close(bucket, n_bucket) != 0) goto clean_up;
+    /* prime the parser with the first record of the buckets */
+    p->collate = c;
+    if (!(p->b = bam_init1())) goto clean_up;
+    if ((ret = sam_collate_read1(c, p->b)) < -1) goto clean_up;
+    if (ret == -1) {
+        bam_destroy1(p->b);
+        p->b = NULL;
+    }
+    error = 0;
+
+    clean_up:
+    if (bucket){
+        collate_close(bucket, n_bucket);
+        free(bucket);
+    }
+    if (b) bam_destroy1(b);
+    if (fn) free(fn);
+    if (error && !p->collate) sam_collate_destroy(c);
+    return error;
+}
@@ -0,0 +1,72 @@
+/* The MIT License (MIT)
+
+   Copyright (c) 2023 Anrui Liu <liuar6@gmail.com>
+
+   Permission is hereby granted, free of charge, to any person obtaining
+   a copy of this software and associated documentation files (the
+   “Software”), to deal in the Software without restriction, including
+   without limitation the rights to use, copy, modify, merge, publish,
+   distribute, sublicense, and/or sell copies of the Software, and to
+   permit persons to whom the Software is furnished to do so, subject to
+   the following conditions:
+
+   The above copyright notice and this permission notice shall be
+   included in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+   EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+   MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+   NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+   BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+   ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+   CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+ */
+
+#ifndef __TRANSMAP_COLLATE_H
+#define __TRANSMAP_COLLATE_H
+
+#include "htslib/sam.h"
+#include "htslib/thread_pool.h"
+
+/* default number of temporary files the input is partitioned into by --collate */
+#define TRANSMAP_COLLATE_BUCKETS 64
+/* default memory in MB for the records of one bucket */
+#define TRANSMAP_COLLATE_MEMORY 768
+/* a bucket over the memory is split again into this many files, up to TRANSMAP_COLLATE_MAX_LEVEL times */
+#define TRANSMAP_COLLATE_SPLIT 16
+#define TRANSMAP_COLLATE_MAX_LEVEL 4
+
+struct sam_parser_s;
+struct bam_vector_s;
+
+typedef struct collate_bucket_t{
+    int id;    /* the file is <prefix>.collate<id>.tmp */
+    int level; /* number of times its records were split */
+} collate_bucket_t;
+
+/* the records of the current bucket, grouped by query name */
+typedef struct sam_collate_s{
+    char *prefix;
+    size_t max_mem;
+    htsThreadPool *tpool;
+    collate_bucket_t *bucket; /* the bucket files still to be read, as a stack */
+    int n_bucket;
+    int m_bucket;
+    int n_file; /* number of bucket files created so far */
+    struct bam_vector_s *bv;
+    bam1_t ***order;
+    size_t m_order;
+    size_t n;
+    size_t i;
+} sam_collate_t;
+
+/* partition the rest of the input into n_bucket temporary bam files <prefix>.collate<i>.tmp by query name. The
+ * parser then reads the buckets one at a time, each sorted by query name in memory, so only one bucket is held. A
+ * bucket whose records take more than max_mem bytes (e.g. with a skewed input) is split again by another hash of
+ * the query names instead of being loaded. */
+int sam_parser_collate(struct sam_parser_s *p, const char *prefix, int n_bucket, size_t max_mem, htsThreadPool *tpool);
+int sam_collate_read1(sam_collate_t *c, bam1_t *b);
+void sam_collate_destroy(sam_collate_t *c);
+
+#endif /* __TRANSMAP_COLLATE_H */
@@ -0,0 +1,161 @@
+/* The MIT License (MIT)
+
+   Copyright (c) 2023 Anrui Liu <liuar6@gmail.com>
+
+   Permission is hereby granted, free of charge, to any person obtaining
+   a copy of this software and associated documentation files (the
+   “Software”), to deal in the Software without restriction, including
+   without limitation the rights to use, copy, modify, merge, publish,
+   distribute, sublicense, and/or sell copies of the Software, and to
+   permit persons to whom the Software is furnished to do so, subject to
+   the following conditions:
+
+   The above copyright notice and this permission notice shall be
+   included in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+   EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+   MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+   NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+   BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+   ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+   CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "htslib/sam.h"
+#include "htslib/khash.h"
+#include "transmap_count.h"
+
+KHASH_MAP_INIT_STR(group, int32_t)
+
+struct count_s{
+    int mode;
+    int32_t n_target;
+    double *target;
+    int32_t n_group;
+    int32_t *group_of; /* gene index of each target, -1 for none */
+    char **group_name;
+    double *group;
+    int32_t *key; /* distinct targets (or genes) of the current read */
+    size_t m_key;
+};
+
+int transmap_count_mode(const char *name){
+    if (strcmp(name, "unique") == 0) return TRANSMAP_COUNT_UNIQUE;
+    if (strcmp(name, "fractional") == 0) return TRANSMAP_COUNT_FRACTIONAL;
+    if (strcmp(name, "all") == 0) return TRANSMAP_COUNT_ALL;
+    return -1;
+}
+
+count_t *count_init(int n_target, const char **group, int mode){
+    count_t *c;
+    khash_t(group) *index = NULL;
+    khint_t itr;
+    int32_t i;
+    int absent;
+    if (!(c = calloc(1, sizeof(*c)))) return NULL;
+    c->mode = mode;
+    c->n_target = n_target;
+    if (!(c->target = calloc(n_target > 0? n_target: 1, sizeof(*c->target)))) goto clean_up;
+    if (group){
+        /* genes are numbered in the order of their first target */
+        if (!(index = kh_init(group))) goto clean_up;
+        if (!(c->group_of = malloc((n_target > 0? n_target: 1) * sizeof(*c->group_of)))) goto clean_up;
+        if (!(c->group_name = malloc((n_target > 0? n_target: 1) * sizeof(*c->group_name)))) goto clean_up;
+        for (i = 0; i < n_target; ++i){
+            c->group_of[i] = -1;
+            if (!group[i]) continue;
+            itr = kh_put(group, index, group[i], &absent);
+            if (absent < 0) goto clean_up;
+            if (absent) {
+                if (!(c->group_name[c->n_group] = strdup(group[i]))) goto clean_up;
+                kh_key(index, itr) = c->group_name[c->n_group];
+                kh_val(index, itr) = c->n_group++;
+            }
+            c->group_of[i] = kh_val(index, itr);
+        }
+        if (!(c->group = calloc(c->n_group > 0? c->n_group: 1, sizeof(*c->group)))) goto clean_up;
+        kh_destroy(group, index);
+    }
+    return c;
+
+    clean_up:
+    if (index) kh_destroy(group, index);
+    count_destroy(c);
+    return NULL;
+}
+
+static int count_comp(const void *a, const void *b){
+    int32_t x = *(const int32_t *)a, y = *(const int32_t *)b;
+    return (x > y) - (x < y);
+}
+
+/* sort and deduplicate the n ids of key, dropping the negative ones */
+static int count_unique(int32_t *key, int n){
+    int i, k = 0;
+    for (i = 0; i < n; ++i) if (key[i] >= 0) key[k++] = key[i];
+    if (k == 0) return 0;
+    qsort(key, k, sizeof(*key), count_comp);
+    for (i = 1, n = 0; i < k; ++i) if (key[i] != key[n]) key[++n] = key[i];
+    return n + 1;
+}
+
+/* the keys from n_count on take their share of the read but are not counted */
+static void count_update(double *counts, int32_t n_count, const int32_t *key, int n, int mode){
+    int i;
+    if (n == 0 || (mode == TRANSMAP_COUNT_UNIQUE && n > 1)) return;
+    for (i = 0; i < n; ++i)
+        if (key[i] < n_count) counts[key[i]] += mode == TRANSMAP_COUNT_FRACTIONAL? 1.0 / n: 1.0;
+}
+
+int count_add(count_t *c, bam1_t **r1, bam1_t **r2, int n){
+    int32_t *key;
+    int i, k;
+    if (n == 0) return 0;
+    if ((size_t)n > c->m_key){
+        if (!(key = realloc(c->key, n * sizeof(*key)))) return -1;
+        c->key = key;
+        c->m_key = n;
+    }
+    key = c->key;
+    for (i = 0; i < n; ++i) key[i] = r1[i]->core.tid >= 0? r1[i]->core.tid: r2[i]->core.tid;
+    k = count_unique(key, n);
+    count_update(c->target, c->n_target, key, k, c->mode);
+    if (c->group){
+        /* the targets without a gene make one more gene, so that a read on them and on a gene is not unique */
+        for (i = 0; i < k; ++i) key[i] = c->group_of[key[i]] >= 0? c->group_of[key[i]]: c->n_group;
+        k = count_unique(key, k);
+        count_update(c->group, c->n_group, key, k, c->mode);
+    }
+    return 0;
+}
+
+int count_write(count_t *c, const char *fn, sam_hdr_t *hdr){
+    const char *format = c->mode == TRANSMAP_COUNT_FRACTIONAL? "%s\t%s\t%.2f\n": "%s\t%s\t%.0f\n";
+    FILE *f;
+    int32_t i;
+    int ret = 0;
+    if (!(f = strcmp(fn, "-") == 0? stdout: fopen(fn, "w"))) return -1;
+    fprintf(f, "level\tname\tcount\n");
+    for (i = 0; i < c->n_target; ++i) fprintf(f, format, "target", sam_hdr_tid2name(hdr, i), c->target[i]);
+    for (i = 0; i < c->n_group; ++i) fprintf(f, format, "gene", c->group_name[i], c->group[i]);
+    if (ferror(f)) ret = -1;
+    if (f != stdout && fclose(f) != 0) ret = -1;
+    else if (f == stdout && fflush(f) != 0) ret = -1;
+    return ret;
+}
+
+void count_destroy(count_t *c){
+    if (!c) return;
+    for (int32_t i = 0; i < c->n_group; ++i) free(c->group_name[i]);
+    free(c->group_name);
+    free(c->group_of);
+    free(c->group);
+    free(c->target);
+    free(c->key);
+    free(c);
+}
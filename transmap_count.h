@@ -0,0 +1,47 @@
+/* The MIT License (MIT)
+
+   Copyright (c) 2023 Anrui Liu <liuar6@gmail.com>
+
+   Permission is hereby granted, free of charge, to any person obtaining
+   a copy of this software and associated documentation files (the
+   “Software”), to deal in the Software without restriction, including
+   without limitation the rights to use, copy, modify, merge, publish,
+   distribute, sublicense, and/or sell copies of the Software, and to
+   permit persons to whom the Software is furnished to do so, subject to
+   the following conditions:
+
+   The above copyright notice and this permission notice shall be
+   included in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+   EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+   MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+   NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+   BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+   ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+   CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+ */
+
+#ifndef __TRANSMAP_COUNT_H
+#define __TRANSMAP_COUNT_H
+
+#include "htslib/sam.h"
+
+/* how a read mapped to several targets (or genes) is counted */
+#define TRANSMAP_COUNT_UNIQUE 0     /* only reads mapped to a single one */
+#define TRANSMAP_COUNT_FRACTIONAL 1 /* 1/n to each of the n */
+#define TRANSMAP_COUNT_ALL 2        /* 1 to each of the n */
+
+typedef struct count_s count_t;
+
+/* group[tid] is the gene of each of the n_target targets (NULL if it has none), or group is NULL for target counts only */
+count_t *count_init(int n_target, const char **group, int mode);
+/* add a read from its n mapped hits, r1 and r2 as in the r1v and r2v of a batch */
+int count_add(count_t *c, bam1_t **r1, bam1_t **r2, int n);
+/* write a tsv of the target counts followed by the gene counts */
+int count_write(count_t *c, const char *fn, sam_hdr_t *hdr);
+void count_destroy(count_t *c);
+int transmap_count_mode(const char *name);
+
+#endif /* __TRANSMAP_COUNT_H */
@@ -0,0 +1,167 @@
+/* The MIT License (MIT)
+
+   Copyright (c) 2023 Anrui Liu <liuar6@gmail.com>
+
+   Permission is hereby granted, free of charge, to any person obtaining
+   a copy of this software and associated documentation files (the
+   “Software”), to deal in the Software without restriction, including
+   without limitation the rights to use, copy, modify, merge, publish,
+   distribute, sublicense, and/or sell copies of the Software, and to
+   permit persons to whom the Software is furnished to do so, subject to
+   the following conditions:
+
+   The above copyright notice and this permission notice shall be
+   included in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+   EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+   MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+   NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+   BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+   ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+   CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "htslib/sam.h"
+#include "transmap_cov.h"
+
+/* the coverage of a target is kept as the sorted positions where the depth changes, with the change at each, which is
+ * the run-length encoding of the depth. The aligned blocks are appended as +1/-1 events and the events are sorted and
+ * coalesced whenever the array is full, so a target costs memory in the number of its distinct block ends (at most
+ * its length + 1), not in its length, and nothing at all until it gets its first alignment. */
+typedef struct cov_event_t{
+    hts_pos_t pos;
+    int32_t delta;
+} cov_event_t;
+
+typedef struct cov_track_t{
+    cov_event_t *a;
+    size_t n, m;
+} cov_track_t;
+
+struct cov_s{
+    int32_t n_target;
+    hts_pos_t *len;
+    cov_track_t *track;
+};
+
+cov_t *cov_init(sam_hdr_t *hdr){
+    cov_t *c;
+    int32_t i;
+    if (!(c = calloc(1, sizeof(*c)))) return NULL;
+    c->n_target = sam_hdr_nref(hdr);
+    if (!(c->len = malloc((c->n_target > 0? c->n_target: 1) * sizeof(*c->len)))) goto clean_up;
+    if (!(c->track = calloc(c->n_target > 0? c->n_target: 1, sizeof(*c->track)))) goto clean_up;
+    for (i = 0; i < c->n_target; ++i) c->len[i] = sam_hdr_tid2len(hdr, i);
+    return c;
+
+    clean_up:
+    cov_destroy(c);
+    return NULL;
+}
+
+static int cov_event_comp(const void *a, const void *b){
+    const cov_event_t *e1 = a, *e2 = b;
+    return (e1->pos > e2->pos) - (e1->pos < e2->pos);
+}
+
+/* sort the events and keep one non-zero change per position */
+static void cov_compact(cov_track_t *t){
+    size_t i, k = 0;
+    if (t->n == 0) return;
+    qsort(t->a, t->n, sizeof(*t->a), cov_event_comp);
+    for (i = 1; i < t->n; ++i){
+        if (t->a[i].pos == t->a[k].pos) t->a[k].delta += t->a[i].delta;
+        else {
+            if (t->a[k].delta != 0) ++k;
+            t->a[k] = t->a[i];
+        }
+    }
+    t->n = t->a[k].delta != 0? k + 1: k;
+}
+
+static int cov_push(cov_track_t *t, hts_pos_t pos, int32_t delta){
+    cov_event_t *a;
+    size_t m;
+    if (t->n == t->m){
+        cov_compact(t);
+        /* grow unless coalescing freed more than half of the array */
+        if (t->n * 2 >= t->m){
+            m = t->m < 16? 16: t->m << 1;
+            if (!(a = realloc(t->a, m * sizeof(*a)))) return -1;
+            t->a = a;
+            t->m = m;
+        }
+    }
+    t->a[t->n].pos = pos;
+    t->a[t->n].delta = delta;
+    t->n++;
+    return 0;
+}
+
+int cov_add(cov_t *c, const bam1_t *b){
+    const uint32_t *cigar = bam_get_cigar(b);
+    hts_pos_t pos = b->core.pos, end, len;
+    cov_track_t *t;
+    uint32_t i, op;
+    if (b->core.tid < 0 || b->core.tid >= c->n_target || (b->core.flag & BAM_FUNMAP)) return 0;
+    len = c->len[b->core.tid];
+    t = c->track + b->core.tid;
+    for (i = 0; i < b->core.n_cigar && pos < len; ++i){
+        op = bam_cigar_op(cigar[i]);
+        if (!(bam_cigar_type(op) & 2)) continue;
+        end = pos + bam_cigar_oplen(cigar[i]);
+        if (op == BAM_CMATCH || op == BAM_CEQUAL || op == BAM_CDIFF) {
+            if (cov_push(t, pos < 0? 0: pos, 1) != 0) return -1;
+            if (cov_push(t, end < len? end: len, -1) != 0) return -1;
+        }
+        pos = end;
+    }
+    return 0;
+}
+
+int cov_merge(cov_t *dst, const cov_t *src){
+    int32_t i;
+    size_t j;
+    for (i = 0; i < src->n_target && i < dst->n_target; ++i)
+        for (j = 0; j < src->track[i].n; ++j)
+            if (cov_push(dst->track + i, src->track[i].a[j].pos, src->track[i].a[j].delta) != 0) return -1;
+    return 0;
+}
+
+int cov_write(cov_t *c, const char *fn, sam_hdr_t *hdr){
+    FILE *f;
+    cov_track_t *t;
+    int32_t i, depth;
+    size_t j;
+    int ret = 0;
+    if (!(f = strcmp(fn, "-") == 0? stdout: fopen(fn, "w"))) return -1;
+    for (i = 0; i < c->n_target; ++i){
+        t = c->track + i;
+        cov_compact(t);
+        if (t->n == 0) continue;
+        const char *name = sam_hdr_tid2name(hdr, i);
+        /* every event changes the depth, so the runs between two events are maximal */
+        depth = 0;
+        for (j = 0; j + 1 < t->n; ++j){
+            depth += t->a[j].delta;
+            if (depth > 0) fprintf(f, "%s\t%lld\t%lld\t%d\n", name, (long long)t->a[j].pos, (long long)t->a[j + 1].pos, depth);
+        }
+    }
+    if (ferror(f)) ret = -1;
+    if (f != stdout && fclose(f) != 0) ret = -1;
+    else if (f == stdout && fflush(f) != 0) ret = -1;
+    return ret;
+}
+
+void cov_destroy(cov_t *c){
+    if (!c) return;
+    if (c->track) for (int32_t i = 0; i < c->n_target; ++i) free(c->track[i].a);
+    free(c->track);
+    free(c->len);
+    free(c);
+}
@@ -0,0 +1,42 @@
+/* The MIT License (MIT)
+
+   Copyright (c) 2023 Anrui Liu <liuar6@gmail.com>
+
+   Permission is hereby granted, free of charge, to any person obtaining
+   a copy of this software and associated documentation files (the
+   “Software”), to deal in the Software without restriction, including
+   without limitation the rights to use, copy, modify, merge, publish,
+   distribute, sublicense, and/or sell copies of the Software, and to
+   permit persons to whom the Software is furnished to do so, subject to
+   the following conditions:
+
+   The above copyright notice and this permission notice shall be
+   included in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+   EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+   MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+   NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+   BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+   ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+   CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+ */
+
+#ifndef __TRANSMAP_COV_H
+#define __TRANSMAP_COV_H
+
+#include "htslib/sam.h"
+
+typedef struct cov_s cov_t;
+
+/* coverage of the targets of hdr by the aligned bases (M, = and X) of the output */
+cov_t *cov_init(sam_hdr_t *hdr);
+int cov_add(cov_t *c, const bam1_t *b);
+/* add the coverage of src into dst, both built from the same header */
+int cov_merge(cov_t *dst, const cov_t *src);
+/* write the runs of non-zero coverage as bedGraph */
+int cov_write(cov_t *c, const char *fn, sam_hdr_t *hdr);
+void cov_destroy(cov_t *c);
+
+#endif /* __TRANSMAP_COV_H */
@@ -0,0 +1,254 @@
+/* The MIT License (MIT)
+
+   Copyright (c) 2023 Anrui Liu <liuar6@gmail.com>
+
+   Permission is hereby granted, free of charge, to any person obtaining
+   a copy of this software and associated documentation files (the
+   “Software”), to deal in the Software without restriction, including
+   without limitation the rights to use, copy, modify, merge, publish,
+   distribute, sublicense, and/or sell copies of the Software, and to
+   permit persons to whom the Software is furnished to do so, subject to
+   the following conditions:
+
+   The above copyright notice and this permission notice shall be
+   included in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+   EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+   MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+   NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+   BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+   ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+   CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <getopt.h>
+#include "htslib/sam.h"
+#include "transmap.h"
+#include "transmap_io.h"
+#include "transmap_expand.h"
+
+/* the ZH tag written by --compact holds one "tid,±pos,cigar;" entry per folded hit, the cigar is empty when it equals
+ * the one of the record carrying the tag. For pairs, both mates carry a tag with the same number of entries. */
+
+static void transmap_expand_usage(const char *msg){
+    const char *usage_info = "\
+Usage:  transmap expand --fi <compact alignment file> [--fo <output file>] [--fix-NH]\n\
+[options]\n\
+-i/--fi             : bam file written by transmap with --compact.\n\
+-o/--fo             : output bam file. default: stdout (sam).\n\
+-N/--fix-NH         : renumber the NH and HI tags over the expanded records.\n\n";
+    if (msg==NULL || msg[0] == '\0') fprintf(stderr, "%s", usage_info);
+    else fprintf(stderr, "%s\n\n%s", msg, usage_info);
+    exit(1);
+}
+
+/* copy b without its ZH tag */
+static int hit_copy(bam1_t *t, const bam1_t *b){
+    uint8_t *zh;
+    if (!bam_copy1(t, b)) return -1;
+    if ((zh = bam_aux_get(t, "ZH")) && bam_aux_del(t, zh) != 0) return -1;
+    return 0;
+}
+
+/* build the hit of the next entry of *zh from p, which carries the tag */
+static int hit_expand(bam1_t *t, const bam1_t *p, int n_ref, const char **zh, uint32_t **cigar, size_t *m_cigar){
+    const char *s = *zh, *op;
+    char *e;
+    long tid, len;
+    long long pos;
+    uint32_t n_cigar = 0, i, v;
+    int reverse, flip;
+    tid = strtol(s, &e, 10);
+    if (e == s || *e != ',' || (e[1] != '+' && e[1] != '-') || tid < 0 || tid >= n_ref) return -1;
+    reverse = e[1] == '-';
+    s = e + 2;
+    pos = strtoll(s, &e, 10);
+    if (e == s || *e != ',' || pos < 1) return -1;
+    s = e + 1;
+    if (*s == ';') n_cigar = p->core.n_cigar;
+    else for (const char *q = s; *q && *q != ';'; ++q) if (*q < '0' || *q > '9') n_cigar++;
+    if (n_cigar > *m_cigar){
+        uint32_t *new_cigar = realloc(*cigar, n_cigar * sizeof(**cigar));
+        if (!new_cigar) return -1;
+        *cigar = new_cigar;
+        *m_cigar = n_cigar;
+    }
+    if (*s == ';') memcpy(*cigar, bam_get_cigar(p), n_cigar << 2u);
+    else {
+        for (i = 0; i < n_cigar; ++i){
+            len = strtol(s, &e, 10);
+            if (e == s || len < 0 || *e == '\0' || !(op = strchr(BAM_CIGAR_STR, *e))) return -1;
+            (*cigar)[i] = bam_cigar_gen((uint32_t)len, (uint32_t)(op - BAM_CIGAR_STR));
+            s = e + 1;
+        }
+    }
+    if (*s != ';') return -1;
+    *zh = s + 1;
+    /* bam_build() reverses the cigar together with SEQ and QUAL, while the cigar of the entry is already in its final order */
+    flip = reverse != ((p->core.flag & BAM_FREVERSE) != 0);
+    if (flip) for (i = 0; i < n_cigar >> 1u; ++i){
+        v = (*cigar)[i];
+        (*cigar)[i] = (*cigar)[n_cigar - 1 - i];
+        (*cigar)[n_cigar - 1 - i] = v;
+    }
+    if (bam_build(t, p, *cigar, n_cigar, flip? BAM_BUILD_REVERSE: 0) < 0) return -1;
+    t->core.tid = (int32_t)tid;
+    t->core.pos = pos - 1;
+    if (reverse) t->core.flag |= BAM_FREVERSE;
+    else t->core.flag &= ~(uint16_t)BAM_FREVERSE;
+    return bam_aux_del(t, bam_aux_get(t, "ZH"));
+}
+
+/* expand the n records of one query name into ov */
+static int expand_group(bam1_t **b, int n, int n_ref, bam_vector_t *ov, uint32_t **cigar, size_t *m_cigar){
+    bam1_t *p, *m, *t1, *t2;
+    const char *s, *ms = NULL;
+    uint8_t *zh, *mzh = NULL;
+    int i;
+    for (i = 0; i < n; ++i){
+        p = b[i];
+        m = NULL;
+        if (!(t1 = bam_vector_next(ov)) || hit_copy(t1, p) != 0) return -1;
+        ov->size++;
+        if (!(zh = bam_aux_get(p, "ZH"))) continue;
+        if (zh[0] != 'Z') return -1;
+        /* the mates of a compacted pair are written next to each other */
+        if (is_paired(p)){
+            if (!is_read1(p) || i + 1 >= n || !is_read2(b[i + 1]) || !(mzh = bam_aux_get(b[i + 1], "ZH")) || mzh[0] != 'Z') return -1;
+            m = b[++i];
+            if (!(t2 = bam_vector_next(ov)) || hit_copy(t2, m) != 0) return -1;
+            ov->size++;
+            ms = (const char *)mzh + 1;
+        }
+        s = (const char *)zh + 1;
+        while (*s){
+            if (!(t1 = bam_vector_next(ov)) || hit_expand(t1, p, n_ref, &s, cigar, m_cigar) != 0) return -1;
+            ov->size++;
+            if (!m) continue;
+            if (!*ms || !(t2 = bam_vector_next(ov)) || hit_expand(t2, m, n_ref, &ms, cigar, m_cigar) != 0) return -1;
+            ov->size++;
+            fix_mate(t1, t2);
+        }
+        if (m && *ms) return -1;
+    }
+    return 0;
+}
+
+/* NH and HI are numbered separately for the first (or unpaired) and the second mates, as fix_NH() does */
+static int expand_fix_NH(bam_vector_t *ov){
+    int n1 = 0, n2 = 0, i1 = 0, i2 = 0;
+    size_t i;
+    for (i = 0; i < ov->size; ++i) {
+        if (is_read2(ov->data[i])) n2++;
+        else n1++;
+    }
+    for (i = 0; i < ov->size; ++i){
+        bam1_t *b = ov->data[i];
+        if (bam_aux_update_int(b, "NH", is_read2(b)? n2: n1) != 0) return -1;
+        if (bam_aux_update_int(b, "HI", is_read2(b)? ++i2: ++i1) != 0) return -1;
+    }
+    return 0;
+}
+
+static int expand_write(samFile *out, sam_hdr_t *hdr, bam1_t **b, int n, bam_vector_t *ov, int fix_nh, uint32_t **cigar, size_t *m_cigar){
+    ov->size = 0;
+    if (expand_group(b, n, sam_hdr_nref(hdr), ov, cigar, m_cigar) != 0){
+        fprintf(stderr, "[transmap expand] Error: malformed ZH tag of %s.\n", bam_get_qname(b[0]));
+        return -1;
+    }
+    if (fix_nh && expand_fix_NH(ov) != 0) return -1;
+    for (size_t i = 0; i < ov->size; ++i) if (sam_write1(out, hdr, ov->data[i]) < 0) {
+        fprintf(stderr, "[transmap expand] Error: can not write the output file.\n");
+        return -1;
+    }
+    return 0;
+}
+
+int transmap_expand_main(int argc, char *argv[]){
+    const char *in_file = NULL, *out_file = "-";
+    char out_mode[3] = "w";
+    sam_parser_t *sam = NULL;
+    samFile *out = NULL;
+    bam_vector_t *bv = NULL, *ov = NULL;
+    uint32_t *cigar = NULL;
+    size_t m_cigar = 0;
+    bam1_t *t;
+    int fix_nh = 0, c, r, ret = 1;
+    const struct option long_options[] =
+            {
+                    { "help" , no_argument , NULL, 'h' },
+                    { "fi" , required_argument , NULL, 'i' },
+                    { "fo" , required_argument, NULL, 'o' },
+                    { "fix-NH" , no_argument, NULL, 'N' },
+                    {NULL, 0, NULL, 0} ,
+            };
+    if (argc == 1) transmap_expand_usage("");
+    while ((c = getopt_long(argc, argv, "hi:o:N", long_options, NULL)) >= 0){
+        switch (c){
+            case 'h':
+                transmap_expand_usage(NULL);
+                break;
+            case 'i':
+                in_file = optarg;
+                break;
+            case 'o':
+                out_file = optarg;
+                break;
+            case 'N':
+                fix_nh = 1;
+                break;
+            default:
+                transmap_expand_usage("[transmap expand] Error:unrecognized parameter");
+        }
+    }
+    if (argc != optind) transmap_expand_usage("[transmap expand] Error:unrecognized parameter");
+    if (in_file == NULL) transmap_expand_usage("[transmap expand] Error: you should provide the input bam file via --fi.");
+
+    if (!(sam = sam_parser_open(in_file, NULL, TRANSMAP_IO_DEFAULT))){
+        fprintf(stderr, "[transmap expand] Error: can not open the input bam file.\n");
+        goto clean_up;
+    }
+    if (strlen(out_file) >= 4 && strcmp(out_file + strlen(out_file) - 4, ".bam") == 0) out_mode[1] = 'b';
+    if (!(out = sam_open(out_file, out_mode)) || sam_hdr_write(out, sam->hdr) != 0){
+        fprintf(stderr, "[transmap expand] Error: can not write the output file.\n");
+        goto clean_up;
+    }
+    if (!(bv = bam_vector_init()) || !(ov = bam_vector_init())) goto clean_up;
+    /* the records are read in file order, which keeps the mates of a compacted pair together */
+    while (1){
+        if (!bam_vector_next(bv)) goto clean_up;
+        if ((r = sam_parser_next1(sam, &bv->data[bv->size])) < 0){
+            fprintf(stderr, "[transmap expand] Error: can not read the input bam file.\n");
+            goto clean_up;
+        }
+        if (r == 0) break;
+        if (bv->size > 0 && strcmp(bam_get_qname(bv->data[bv->size]), bam_get_qname(bv->data[0])) != 0){
+            if (expand_write(out, sam->hdr, bv->data, bv->size, ov, fix_nh, &cigar, &m_cigar) != 0) goto clean_up;
+            t = bv->data[0];
+            bv->data[0] = bv->data[bv->size];
+            bv->data[bv->size] = t;
+            bv->size = 1;
+        } else bv->size++;
+    }
+    if (bv->size > 0 && expand_write(out, sam->hdr, bv->data, bv->size, ov, fix_nh, &cigar, &m_cigar) != 0) goto clean_up;
+    if (sam_close(out) != 0){
+        out = NULL;
+        fprintf(stderr, "[transmap expand] Error: can not write the output file.\n");
+        goto clean_up;
+    }
+    out = NULL;
+    ret = 0;
+
+    clean_up:
+    if (cigar) free(cigar);
+    if (ov) bam_vector_destroy(ov);
+    if (bv) bam_vector_destroy(bv);
+    if (out) sam_close(out);
+    if (sam) sam_parser_close(sam);
+    return ret;
+}
@@ -0,0 +1,152 @@
+/* The MIT License (MIT)
+
+   Copyright (c) 2023 Anrui Liu <liuar6@gmail.com>
+
+   Permission is hereby granted, free of charge, to any person obtaining
+   a copy of this software and associated documentation files (the
+   “Software”), to deal in the Software without restriction, including
+   without limitation the rights to use, copy, modify, merge, publish,
+   distribute, sublicense, and/or sell copies of the Software, and to
+   permit persons to whom the Software is furnished to do so, subject to
+   the following conditions:
+
+   The above copyright notice and this permission notice shall be
+   included in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+   EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+   MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+   NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+   BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+   ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+   CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "htslib/sam.h"
+#include "htslib/bgzf.h"
+#include "htslib/hfile.h"
+#include "transmap_text.h"
+#include "transmap_frag.h"
+
+struct frag_s{
+    BGZF *bgzf;
+    hFILE *hf;
+    const char **name;
+    size_t *name_len;
+    int n_ref;
+    char *buf;
+    size_t l;
+    size_t m;
+};
+
+static int frag_flush(frag_t *f){
+    if (f->l == 0) return 0;
+    if (f->bgzf){
+        if (bgzf_write(f->bgzf, f->buf, f->l) != (ssize_t)f->l) return -1;
+    } else if (hwrite(f->hf, f->buf, f->l) != (ssize_t)f->l) return -1;
+    f->l = 0;
+    return 0;
+}
+
+static int frag_reserve(frag_t *f, size_t needed){
+    if (f->l + needed <= f->m) return 0;
+    if (frag_flush(f) != 0) return -1;
+    if (needed > f->m){
+        char *new_buf = realloc(f->buf, needed);
+        if (!new_buf) return -1;
+        f->buf = new_buf;
+        f->m = needed;
+    }
+    return 0;
+}
+
+static inline char *frag_target(frag_t *f, char *p, const bam1_t *b){
+    memcpy(p, f->name[b->core.tid], f->name_len[b->core.tid]);
+    p += f->name_len[b->core.tid];
+    *p++ = '\t';
+    p = text_putu(p, (uint64_t)b->core.pos);
+    *p++ = '\t';
+    p = text_putu(p, (uint64_t)bam_endpos(b));
+    *p++ = '\t';
+    return p;
+}
+
+static inline char frag_strand(const bam1_t *b){
+    return bam_is_rev(b)? '-': '+';
+}
+
+int frag_add(frag_t *f, const bam1_t *b1, const bam1_t *b2){
+    const bam1_t *b;
+    const uint8_t *nh;
+    int64_t score = 1;
+    char *p;
+    if (b1->core.tid == -1) {
+        if (b2->core.tid == -1) return 0;
+        b = b2;
+        b2 = b1;
+    } else b = b1;
+    if ((nh = bam_aux_get(b, "NH"))) score = bam_aux2i(nh);
+    /* two targets, six coordinates, the name, the score and the tab separated strands */
+    if (frag_reserve(f, f->name_len[b->core.tid] + (b2->core.tid != -1? f->name_len[b2->core.tid]: 0) + b->core.l_qname + 8 * 21) != 0) return -1;
+    p = frag_target(f, f->buf + f->l, b);
+    if (b2->core.tid != -1) p = frag_target(f, p, b2);
+    memcpy(p, bam_get_qname(b), b->core.l_qname - b->core.l_extranul - 1);
+    p += b->core.l_qname - b->core.l_extranul - 1;
+    *p++ = '\t';
+    p = text_puti(p, score);
+    *p++ = '\t';
+    *p++ = frag_strand(b);
+    if (b2->core.tid != -1){
+        *p++ = '\t';
+        *p++ = frag_strand(b2);
+    }
+    *p++ = '\n';
+    f->l = p - f->buf;
+    return 0;
+}
+
+frag_t *frag_init(const char *fn, sam_hdr_t *hdr){
+    frag_t *f;
+    size_t l = strlen(fn);
+    int i;
+    if (!(f = calloc(1, sizeof(*f)))) return NULL;
+    f->n_ref = sam_hdr_nref(hdr);
+    if (f->n_ref > 0 && (!(f->name = malloc(f->n_ref * sizeof(*f->name))) || !(f->name_len = malloc(f->n_ref * sizeof(*f->name_len))))) goto clean_up;
+    for (i = 0; i < f->n_ref; ++i){
+        f->name[i] = sam_hdr_tid2name(hdr, i);
+        f->name_len[i] = strlen(f->name[i]);
+    }
+    f->m = TRANSMAP_TEXT_BUFFER;
+    if (!(f->buf = malloc(f->m))) goto clean_up;
+    if (l > 3 && strcmp(fn + l - 3, ".gz") == 0){
+        if (!(f->bgzf = bgzf_open(fn, "w"))) goto clean_up;
+    } else if (!(f->hf = hopen(fn, "w"))) goto clean_up;
+    return f;
+
+    clean_up:
+    frag_destroy(f);
+    return NULL;
+}
+
+int frag_close(frag_t *f){
+    int ret = frag_flush(f);
+    if (f->bgzf && bgzf_close(f->bgzf) != 0) ret = -1;
+    if (f->hf && hclose(f->hf) != 0) ret = -1;
+    f->bgzf = NULL;
+    f->hf = NULL;
+    return ret;
+}
+
+void frag_destroy(frag_t *f){
+    if (!f) return;
+    if (f->bgzf) bgzf_close(f->bgzf);
+    if (f->hf) hclose_abruptly(f->hf);
+    free(f->name);
+    free(f->name_len);
+    free(f->buf);
+    free(f);
+}
@@ -0,0 +1,43 @@
+/* The MIT License (MIT)
+
+   Copyright (c) 2023 Anrui Liu <liuar6@gmail.com>
+
+   Permission is hereby granted, free of charge, to any person obtaining
+   a copy of this software and associated documentation files (the
+   “Software”), to deal in the Software without restriction, including
+   without limitation the rights to use, copy, modify, merge, publish,
+   distribute, sublicense, and/or sell copies of the Software, and to
+   permit persons to whom the Software is furnished to do so, subject to
+   the following conditions:
+
+   The above copyright notice and this permission notice shall be
+   included in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+   EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+   MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+   NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+   BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+   ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+   CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+ */
+
+#ifndef __TRANSMAP_FRAG_H
+#define __TRANSMAP_FRAG_H
+
+#include "htslib/sam.h"
+
+typedef struct frag_s frag_t;
+
+/* fragment writer, bgzip compressed when fn ends with .gz. The target names are taken from hdr, which must outlive
+ * the writer. */
+frag_t *frag_init(const char *fn, sam_hdr_t *hdr);
+/* write a BEDPE line when both records are mapped, otherwise a BED6 line for the mapped one. Records with a tid of -1
+ * are not mapped. */
+int frag_add(frag_t *f, const bam1_t *b1, const bam1_t *b2);
+/* flush and close the file */
+int frag_close(frag_t *f);
+void frag_destroy(frag_t *f);
+
+#endif /* __TRANSMAP_FRAG_H */
@@ -23,6 +23,7 @@ void transcript_free(transcript_t *tr){
     }
     if (tr->chrom) free(tr->chrom);
     if (tr->name) free(tr->name);
+    if (tr->group) free(tr->group);
     free(tr);
 }
 
@@ -40,9 +41,41 @@ void gtf_free(gtf_dict_t *gtf){
     }
     free(gtf);
 }
-gtf_dict_t *gtf_parse(const char* fname, const char* used_feature, const char* used_attribute){
+/* find the value of the attribute key in the attribute field of a gtf line and terminate it. NULL if it is missing, or
+ * incomplete when *incomplete is set. */
+static char *gtf_attribute(char *attr_begin, const char *key, int key_len, int *incomplete){
+    char *attr_end;
+    *incomplete = 0;
+    while (attr_begin && (strncmp(attr_begin, key, key_len) != 0 || attr_begin[key_len] != ' ')){
+        attr_begin = strpbrk(attr_begin, ";\"");
+        if (attr_begin && *attr_begin == '\"') {
+            attr_begin = strchr(attr_begin + 1, '\"');
+            if (attr_begin) attr_begin = strchr(attr_begin + 1, ';');
+        }
+        if (attr_begin){
+            attr_begin++;
+            while (*attr_begin == ' ') attr_begin++;
+        }
+
+    }
+    if (!attr_begin) return NULL;
+    attr_begin += key_len;
+    while (*attr_begin == ' ') attr_begin++;
+    if (*attr_begin == '\"') attr_end = strchr(++attr_begin, '\"');
+    else attr_end = strchr(attr_begin, ';');
+    if (!attr_end) {
+        *incomplete = 1;
+        return NULL;
+    }
+    *attr_end = '\0';
+    return attr_begin;
+}
+
+gtf_dict_t *gtf_parse(const char* fname, const char* used_feature, const char* used_attribute, const char *group_attribute, int index_backend){
     int used_attribute_len = strlen(used_attribute);
+    int group_attribute_len = group_attribute? strlen(group_attribute): 0;
     char buffer[2048];
+    char group_buffer[2048];
     char *items[10];
     int new_tid = 0;
     FILE *f = fopen(fname, "r");
@@ -53,42 +86,27 @@ gtf_dict_t *gtf_parse(const char* fname, const char* used_feature, const char* u
     gtf->idx = NULL;
     gtf->record = kh_init(transcript);
     if (!gtf->record) goto clean_up;
-    gtf->idx = bioidx_init();
+    gtf->idx = bioidx_init_backend(index_backend);
     if (!gtf->idx) goto clean_up;
-    int ret;
-    char *attr_begin, *attr_end;
+    int ret, incomplete;
+    char *attr_begin, *group;
     int line_count = 0;
     while (fgets(buffer, 2048, f)){
         line_count++;
         if (buffer[0] == '#') continue;
         strsplit(buffer, items, 10, '\t');
         if (strcmp(items[2], used_feature) != 0) continue;
-        attr_begin = items[8];
-        while (attr_begin && (strncmp(attr_begin, used_attribute, used_attribute_len) != 0 || attr_begin[used_attribute_len] != ' ')){
-            attr_begin = strpbrk(attr_begin, ";\"");
-            if (attr_begin && *attr_begin == '\"') {
-                attr_begin = strchr(attr_begin + 1, '\"');
-                if (attr_begin) attr_begin = strchr(attr_begin + 1, ';');
-            }
-            if (attr_begin){
-                attr_begin++;
-                while (*attr_begin == ' ') attr_begin++;
-            }
-
+        group = NULL;
+        if (group_attribute) {
+            /* the value is terminated in place, so the group is looked up in a copy of the field */
+            strcpy(group_buffer, items[8]);
+            group = gtf_attribute(group_buffer, group_attribute, group_attribute_len, &incomplete);
         }
-        if (!attr_begin) {
-            fprintf(stderr, "[gtf parse] attribute \"%s\" not found for line %d.\n", used_attribute, line_count);
+        if (!(attr_begin = gtf_attribute(items[8], used_attribute, used_attribute_len, &incomplete))) {
+            if (incomplete) fprintf(stderr, "[gtf parse] the attribute field seems to be incomplete for line %d.\n", line_count);
+            else fprintf(stderr, "[gtf parse] attribute \"%s\" not found for line %d.\n", used_attribute, line_count);
             continue;
         }
-        attr_begin += strlen(used_attribute);
-        while (*attr_begin == ' ') attr_begin++;
-        if (*attr_begin == '\"') attr_end = strchr(++attr_begin, '\"');
-        else attr_end = strchr(attr_begin, ';');
-        if (!attr_end) {
-            fprintf(stderr, "[gtf parse] the attribute field seems to be incomplete for line %d.\n", line_count);
-            continue;
-        }
-        *attr_end = '\0';
         khiter_t i = kh_get(transcript, gtf->record, attr_begin);
         transcript_t *tr;
         char *new_str;
@@ -104,6 +122,7 @@ gtf_dict_t *gtf_parse(const char* fname, const char* used_feature, const char* u
             tr->name = new_str;
             tr->strand = items[6][0];
             if (!tr->chrom) goto clean_up;
+            if (group && !(tr->group = strdup(group))) goto clean_up;
             tr->exons = vec_init(exon);
             if (!tr->exons) goto clean_up;
             kh_val(gtf->record, i) = tr;
@@ -158,6 +177,21 @@ gtf_dict_t *gtf_parse(const char* fname, const char* used_feature, const char* u
         }
 
     }
+    /* the transcripts dropped above leave gaps in new_tid, renumber the rest in the order of the gtf file */
+    if (kh_size(gtf->record) != new_tid){
+        transcript_t **trs = calloc(new_tid, sizeof(*trs));
+        if (!trs) {gtf_free(gtf); return NULL;}
+        for (i = 0; i < kh_end(gtf->record); ++i)
+            if (kh_exist(gtf->record, i)) trs[kh_val(gtf->record, i)->new_tid] = kh_val(gtf->record, i);
+        int n_tid = new_tid, k;
+        new_tid = 0;
+        for (j = 0; j < n_tid; ++j){
+            if (!trs[j]) continue;
+            trs[j]->new_tid = new_tid++;
+            for (k = 0; k < trs[j]->exons->size; ++k) trs[j]->exons->data[k]->new_tid = trs[j]->new_tid;
+        }
+        free(trs);
+    }
     return gtf;
     clean_up:
     fclose(f);
@@ -39,6 +39,7 @@ VEC_INIT(exon, exon_t *);
 typedef struct transcript_t{
     char* chrom;
     char *name;
+    char *group; /* value of the group attribute (e.g. gene_id) of the first line, NULL if it is missing */
     char strand;
     hts_pos_t start;
     hts_pos_t end;
@@ -54,7 +55,7 @@ typedef struct gtf_dict_t{
     bioidx_t *idx;
 } gtf_dict_t;
 
-gtf_dict_t *gtf_parse(const char* fname, const char *used_feature, const char *used_attribute);
+gtf_dict_t *gtf_parse(const char* fname, const char *used_feature, const char *used_attribute, const char *group_attribute, int index_backend);
 void gtf_free(gtf_dict_t *);
 
 static int exon_search_comp(const void *a, const void *b){
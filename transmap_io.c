@@ -0,0 +1,120 @@
+/* The MIT License (MIT)
+
+   Copyright (c) 2023 Anrui Liu <liuar6@gmail.com>
+
+   Permission is hereby granted, free of charge, to any person obtaining
+   a copy of this software and associated documentation files (the
+   “Software”), to deal in the Software without restriction, including
+   without limitation the rights to use, copy, modify, merge, publish,
+   distribute, sublicense, and/or sell copies of the Software, and to
+   permit persons to whom the Software is furnished to do so, subject to
+   the following conditions:
+
+   The above copyright notice and this permission notice shall be
+   included in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+   EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+   MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+   NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+   BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+   ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+   CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "htslib/sam.h"
+#include "htslib/hfile.h"
+#include "transmap_io.h"
+
+int transmap_io_backend(const char *name){
+    if (strcmp(name, "default") == 0) return TRANSMAP_IO_DEFAULT;
+    if (strcmp(name, "fadvise") == 0) return TRANSMAP_IO_FADVISE;
+    if (strcmp(name, "readahead") == 0) return TRANSMAP_IO_READAHEAD;
+    return -1;
+}
+
+/* the file offset of fd is moved by the reads of htslib, the thread keeps [offset, offset + window) cached and sleeps
+ * until transmap_io_notify() sees that the reader has freed room for a chunk */
+static void *io_prefetch(void *arg){
+    transmap_io_t *io = arg;
+    int64_t pos, len;
+    pthread_mutex_lock(&io->lock);
+    while (!io->stop && io->prefetched < io->file_size){
+        pos = lseek(io->fd, 0, SEEK_CUR);
+        if (pos >= 0 && io->prefetched < pos + TRANSMAP_IO_WINDOW){
+            if (io->prefetched < pos) io->prefetched = pos;
+            len = io->file_size - io->prefetched;
+            if (len > TRANSMAP_IO_CHUNK) len = TRANSMAP_IO_CHUNK;
+            pthread_mutex_unlock(&io->lock);
+            readahead(io->fd, io->prefetched, len);
+            pthread_mutex_lock(&io->lock);
+            io->prefetched += len;
+            continue;
+        }
+        io->wake_pos = io->prefetched - TRANSMAP_IO_WINDOW + TRANSMAP_IO_CHUNK;
+        pthread_cond_wait(&io->wake, &io->lock);
+        io->wake_pos = -1;
+    }
+    pthread_mutex_unlock(&io->lock);
+    return NULL;
+}
+
+void transmap_io_notify(transmap_io_t *io){
+    int64_t pos = lseek(io->fd, 0, SEEK_CUR);
+    pthread_mutex_lock(&io->lock);
+    if (io->wake_pos >= 0 && pos >= io->wake_pos) pthread_cond_signal(&io->wake);
+    pthread_mutex_unlock(&io->lock);
+}
+
+samFile *transmap_io_open(const char *fn, int backend, transmap_io_t **io){
+    struct stat st;
+    samFile *fp;
+    hFILE *hf;
+    transmap_io_t *new_io;
+    int fd;
+    *io = NULL;
+    if (backend == TRANSMAP_IO_DEFAULT || strcmp(fn, "-") == 0 || stat(fn, &st) != 0 || !S_ISREG(st.st_mode))
+        return sam_open(fn, "r");
+    if ((fd = open(fn, O_RDONLY)) < 0) return NULL;
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    if (!(hf = hdopen(fd, "r"))) {close(fd); return NULL;}
+    if (!(fp = hts_hopen(hf, fn, "r"))) {hclose_abruptly(hf); return NULL;}
+    if (backend != TRANSMAP_IO_READAHEAD) return fp;
+    if (!(new_io = calloc(1, sizeof(*new_io)))) return fp;
+    new_io->fd = fd;
+    new_io->file_size = st.st_size;
+    new_io->wake_pos = -1;
+    pthread_mutex_init(&new_io->lock, NULL);
+    pthread_cond_init(&new_io->wake, NULL);
+    if (pthread_create(&new_io->thread, NULL, io_prefetch, new_io) != 0){
+        /* reading still works without the prefetching */
+        pthread_mutex_destroy(&new_io->lock);
+        pthread_cond_destroy(&new_io->wake);
+        free(new_io);
+        return fp;
+    }
+    new_io->has_thread = 1;
+    *io = new_io;
+    return fp;
+}
+
+void transmap_io_close(transmap_io_t *io){
+    if (io->has_thread){
+        pthread_mutex_lock(&io->lock);
+        io->stop = 1;
+        pthread_cond_signal(&io->wake);
+        pthread_mutex_unlock(&io->lock);
+        pthread_join(io->thread, NULL);
+    }
+    pthread_mutex_destroy(&io->lock);
+    pthread_cond_destroy(&io->wake);
+    free(io);
+}
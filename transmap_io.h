@@ -0,0 +1,72 @@
+/* The MIT License (MIT)
+
+   Copyright (c) 2023 Anrui Liu <liuar6@gmail.com>
+
+   Permission is hereby granted, free of charge, to any person obtaining
+   a copy of this software and associated documentation files (the
+   “Software”), to deal in the Software without restriction, including
+   without limitation the rights to use, copy, modify, merge, publish,
+   distribute, sublicense, and/or sell copies of the Software, and to
+   permit persons to whom the Software is furnished to do so, subject to
+   the following conditions:
+
+   The above copyright notice and this permission notice shall be
+   included in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+   EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+   MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+   NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+   BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+   ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+   CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+ */
+
+#ifndef __TRANSMAP_IO_H
+#define __TRANSMAP_IO_H
+
+#include <stdint.h>
+#include <pthread.h>
+#include "htslib/sam.h"
+
+#define TRANSMAP_IO_DEFAULT 0   /* plain read() through htslib */
+#define TRANSMAP_IO_FADVISE 1   /* read() with the kernel told the file is read sequentially */
+#define TRANSMAP_IO_READAHEAD 2 /* a thread keeps the page cache filled ahead of the reader */
+
+/* size of the window kept in the page cache ahead of the reader by TRANSMAP_IO_READAHEAD */
+#define TRANSMAP_IO_WINDOW (64 << 20)
+#define TRANSMAP_IO_CHUNK (4 << 20)
+/* the reader checks whether the prefetch thread should be woken up every this many records */
+#define TRANSMAP_IO_NOTIFY 1024
+
+typedef struct transmap_io_s{
+    int fd;
+    int64_t file_size;
+    int64_t prefetched;
+    int has_thread;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    int64_t wake_pos; /* file offset of the reader from which the sleeping thread has room for a chunk, -1 if awake */
+    int n_read;       /* records read since the last check, only used by the reader */
+    int stop;
+} transmap_io_t;
+
+/* parse the name given to --io-backend, -1 if unknown */
+int transmap_io_backend(const char *name);
+/* open a local file for reading with the given backend. Anything that is not a regular file, e.g. "-", falls back
+ * to sam_open(). *io is set when a prefetch thread has to be stopped by transmap_io_close() before closing fp. */
+samFile *transmap_io_open(const char *fn, int backend, transmap_io_t **io);
+void transmap_io_close(transmap_io_t *io);
+/* wake the prefetch thread up if the reader has moved far enough since it went to sleep */
+void transmap_io_notify(transmap_io_t *io);
+
+/* called by the reader for each record */
+static inline void transmap_io_read(transmap_io_t *io){
+    if (++io->n_read < TRANSMAP_IO_NOTIFY) return;
+    io->n_read = 0;
+    transmap_io_notify(io);
+}
+
+#endif /* __TRANSMAP_IO_H */
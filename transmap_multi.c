@@ -0,0 +1,135 @@
+/* The MIT License (MIT)
+
+   Copyright (c) 2023 Anrui Liu <liuar6@gmail.com>
+
+   Permission is hereby granted, free of charge, to any person obtaining
+   a copy of this software and associated documentation files (the
+   “Software”), to deal in the Software without restriction, including
+   without limitation the rights to use, copy, modify, merge, publish,
+   distribute, sublicense, and/or sell copies of the Software, and to
+   permit persons to whom the Software is furnished to do so, subject to
+   the following conditions:
+
+   The above copyright notice and this permission notice shall be
+   included in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+   EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+   MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+   NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+   BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+   ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+   CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "htslib/sam.h"
+#include "htslib/thread_pool.h"
+#include "transmap.h"
+#include "transmap_text.h"
+#include "transmap_ref.h"
+#include "transmap_multi.h"
+
+struct transmap_extra_s{
+    const char *in_file;
+    struct transmap_option options;
+    bed_dict_t *bed;
+    gtf_dict_t *gtf;
+    sam_hdr_t *hdr;
+    samFile *fp;
+    char *ref_file; /* reference of a cram output, <out_file>.fa */
+    transmap_worker_t worker;
+    int worker_ready;
+    transmap_batch_t *batch; /* the hits of the annotation, the records are borrowed from the batch of the run */
+    transmap_out_t out;
+};
+
+transmap_extra_t *transmap_extra_init(const char *in_file, uint64_t mode, const char *out_file, sam_hdr_t *hdr, const char *cl, htsThreadPool *tpool, struct transmap_option *options){
+    transmap_extra_t *e;
+    void *dict;
+    size_t l = strlen(out_file);
+    /* the same modes as the main output */
+    char out_mode[3] = "w";
+    if (l > 4 && strcmp(out_file + l - 4, ".bam") == 0) out_mode[1] = 'b';
+    else if (transmap_is_cram(out_file)) out_mode[1] = 'c';
+    if (!(e = calloc(1, sizeof(*e)))) return NULL;
+    e->in_file = in_file;
+    e->options = *options;
+    e->options.in_file = in_file;
+    e->options.out_file = out_file;
+    e->options.tee_file = NULL;
+    e->options.others &= ~(uint64_t)(OPTION_BED_MODE | OPTION_GTF_MODE | OPTION_USE_INDEX | OPTION_NO_OUTPUT | OPTION_NO_RECORD);
+    e->options.others |= mode;
+    if (mode & OPTION_GTF_MODE){
+        if (!(e->gtf = gtf_parse(in_file, options->gtf_feature, options->gtf_attribute, NULL, options->index_backend))) goto clean_up;
+        if (!(e->hdr = hdrmap_gtf(hdr, e->gtf))) goto clean_up;
+        if (e->gtf->record->size > options->index_cutoff) e->options.others |= OPTION_USE_INDEX;
+        dict = e->gtf;
+    } else {
+        if (!(e->bed = bed_parse(in_file, options->index_backend))) goto clean_up;
+        if (!(e->hdr = hdrmap_bed(hdr, e->bed))) goto clean_up;
+        if (e->bed->size > options->index_cutoff) e->options.others |= OPTION_USE_INDEX;
+        dict = e->bed;
+    }
+    if (sam_hdr_add_pg(e->hdr, "transmap", "VN", "0.1", "CL", cl, NULL) != 0) goto clean_up;
+    if (out_mode[1] == 'c'){
+        if (!(e->ref_file = malloc(l + strlen(".fa") + 1))) goto clean_up;
+        sprintf(e->ref_file, "%s.fa", out_file);
+        if (transmap_ref_write(options->genome_file, e->ref_file, dict, mode & OPTION_GTF_MODE, e->hdr) != 0) goto clean_up;
+    }
+    if (!(e->fp = sam_open(out_file, out_mode))) goto clean_up;
+    if (out_mode[1] != '\0' && tpool && tpool->pool && hts_set_opt(e->fp, HTS_OPT_THREAD_POOL, tpool) != 0) goto clean_up;
+    if (out_mode[1] == 'c' && hts_set_opt(e->fp, CRAM_OPT_REFERENCE, e->ref_file) != 0) goto clean_up;
+    if (sam_hdr_write(e->fp, e->hdr) != 0) goto clean_up;
+    if (out_mode[1] == '\0' && !(e->out.text = sam_text_init(e->fp, e->hdr, options->others & OPTION_TEXT_THREAD))) goto clean_up;
+    if (transmap_worker_init(&e->worker, dict, &e->options) != 0) goto clean_up;
+    e->worker_ready = 1;
+    if (!(e->batch = transmap_batch_init())) goto clean_up;
+    e->out.fp = e->fp;
+    e->out.hdr = e->hdr;
+    e->out.keep_tags = options->keep_tags;
+    return e;
+
+    clean_up:
+    transmap_extra_destroy(e);
+    return NULL;
+}
+
+int transmap_extra_run(transmap_extra_t *e, transmap_batch_t *batch){
+    bam_vector_t *bv = e->batch->bv;
+    vec_t(int) *group = e->batch->group;
+    int ret = 0;
+    e->batch->bv = batch->bv;
+    e->batch->group = batch->group;
+    if (transmap_batch_map(e->batch, &e->worker, &e->options) != 0 || transmap_batch_write(e->batch, &e->out) != 0) ret = -1;
+    e->batch->bv = bv;
+    e->batch->group = group;
+    transmap_batch_clear(e->batch);
+    return ret;
+}
+
+int transmap_extra_finish(transmap_extra_t *e){
+    int ret = 0;
+    if (e->out.text && sam_text_finish(e->out.text) != 0) ret = -1;
+    if (sam_close(e->fp) != 0) ret = -1;
+    e->fp = NULL;
+    fprintf(stderr, "\n[%s]\n", e->in_file);
+    transmap_statistic_print(&e->worker.statistics, &e->options);
+    return ret;
+}
+
+void transmap_extra_destroy(transmap_extra_t *e){
+    if (!e) return;
+    if (e->worker_ready) transmap_worker_destroy(&e->worker);
+    if (e->batch) transmap_batch_destroy(e->batch);
+    if (e->out.text) sam_text_destroy(e->out.text);
+    if (e->fp) sam_close(e->fp);
+    free(e->ref_file);
+    if (e->hdr) sam_hdr_destroy(e->hdr);
+    if (e->bed) bed_free(e->bed);
+    if (e->gtf) gtf_free(e->gtf);
+    free(e);
+}
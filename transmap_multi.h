@@ -0,0 +1,48 @@
+/* The MIT License (MIT)
+
+   Copyright (c) 2023 Anrui Liu <liuar6@gmail.com>
+
+   Permission is hereby granted, free of charge, to any person obtaining
+   a copy of this software and associated documentation files (the
+   “Software”), to deal in the Software without restriction, including
+   without limitation the rights to use, copy, modify, merge, publish,
+   distribute, sublicense, and/or sell copies of the Software, and to
+   permit persons to whom the Software is furnished to do so, subject to
+   the following conditions:
+
+   The above copyright notice and this permission notice shall be
+   included in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+   EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+   MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+   NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+   BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+   ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+   CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+ */
+
+#ifndef __TRANSMAP_MULTI_H
+#define __TRANSMAP_MULTI_H
+
+#include "htslib/sam.h"
+#include "htslib/thread_pool.h"
+
+struct transmap_batch_t;
+struct transmap_option;
+
+/* an annotation given after the first one, mapped from the batches read for the first one and written to its own
+ * output file, in the same format as the main one (a cram output gets its own reference, <out_file>.fa). The outputs
+ * other than --fo only apply to the first annotation. */
+typedef struct transmap_extra_s transmap_extra_t;
+
+/* mode is OPTION_BED_MODE or OPTION_GTF_MODE, cl is the command line recorded in the @PG line */
+transmap_extra_t *transmap_extra_init(const char *in_file, uint64_t mode, const char *out_file, sam_hdr_t *hdr, const char *cl, htsThreadPool *tpool, struct transmap_option *options);
+/* map the query-name groups of batch against the annotation and write the alignments */
+int transmap_extra_run(transmap_extra_t *e, struct transmap_batch_t *batch);
+/* close the output file and print the statistics */
+int transmap_extra_finish(transmap_extra_t *e);
+void transmap_extra_destroy(transmap_extra_t *e);
+
+#endif /* __TRANSMAP_MULTI_H */
@@ -0,0 +1,160 @@
+/* The MIT License (MIT)
+
+   Copyright (c) 2023 Anrui Liu <liuar6@gmail.com>
+
+   Permission is hereby granted, free of charge, to any person obtaining
+   a copy of this software and associated documentation files (the
+   “Software”), to deal in the Software without restriction, including
+   without limitation the rights to use, copy, modify, merge, publish,
+   distribute, sublicense, and/or sell copies of the Software, and to
+   permit persons to whom the Software is furnished to do so, subject to
+   the following conditions:
+
+   The above copyright notice and this permission notice shall be
+   included in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+   EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+   MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+   NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+   BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+   ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+   CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include "htslib/sam.h"
+#include "htslib/khash.h"
+#include "transmap_part.h"
+
+struct part_s{
+    sam_hdr_t *hdr;
+    int n_part;
+    int32_t n_target;
+    int32_t *part;  /* file of each target */
+    int32_t *local; /* tid of each target in its file */
+    int32_t *size;  /* target count of each file */
+    char **fn;
+    samFile **fp;
+    sam_hdr_t **part_hdr;
+};
+
+static void part_assign(part_t *p, int mode){
+    int64_t total = 0, before = 0, len;
+    int32_t i;
+    for (i = 0; i < p->n_target; ++i) total += sam_hdr_tid2len(p->hdr, i);
+    for (i = 0; i < p->n_target; ++i){
+        len = sam_hdr_tid2len(p->hdr, i);
+        if (mode == TRANSMAP_PART_HASH) p->part[i] = (int32_t)(kh_str_hash_func(sam_hdr_tid2name(p->hdr, i)) % (khint_t)p->n_part);
+        else if (total > 0) p->part[i] = (int32_t)(before * p->n_part / total);
+        else p->part[i] = (int32_t)((int64_t)i * p->n_part / p->n_target);
+        before += len;
+        p->local[i] = p->size[p->part[i]]++;
+    }
+}
+
+/* the header of a file keeps all lines of hdr but the @SQ lines of the targets of other files */
+static sam_hdr_t *part_hdr(part_t *p, int k){
+    const char *lines = sam_hdr_str(p->hdr);
+    size_t size = sam_hdr_length(p->hdr), i = 0, j;
+    char len[32];
+    sam_hdr_t *h;
+    int32_t t;
+    if (!(h = sam_hdr_init())) return NULL;
+    while (i < size) {
+        const char *e = strchr(lines + i, '\n');
+        j = e? (size_t)(e - lines) + 1: size;
+        if (strncmp(lines + i, "@SQ", 3) != 0 && sam_hdr_add_lines(h, lines + i, j - i) != 0) goto clean_up;
+        i = j;
+    }
+    for (t = 0; t < p->n_target; ++t){
+        if (p->part[t] != k) continue;
+        snprintf(len, sizeof(len), "%" PRId64, (int64_t)sam_hdr_tid2len(p->hdr, t));
+        if (sam_hdr_add_line(h, "SQ", "SN", sam_hdr_tid2name(p->hdr, t), "LN", len, NULL) != 0) goto clean_up;
+    }
+    return h;
+
+    clean_up:
+    sam_hdr_destroy(h);
+    return NULL;
+}
+
+int part_write(part_t *p, bam1_t *b){
+    int32_t tid = b->core.tid, mtid = b->core.mtid;
+    int k = p->part[tid];
+    b->core.tid = p->local[tid];
+    if (mtid >= 0 && p->part[mtid] == k) b->core.mtid = p->local[mtid];
+    else if (mtid >= 0) {
+        b->core.mtid = -1;
+        b->core.mpos = -1;
+        b->core.isize = 0;
+    }
+    return sam_write1(p->fp[k], p->part_hdr[k], b) < 0? -1: 0;
+}
+
+part_t *part_init(const char *prefix, sam_hdr_t *hdr, int n_part, int mode, htsThreadPool *tpool){
+    part_t *p;
+    int k;
+    if (!(p = calloc(1, sizeof(*p)))) return NULL;
+    p->hdr = hdr;
+    p->n_part = n_part;
+    p->n_target = sam_hdr_nref(hdr);
+    if (!(p->part = calloc(p->n_target + 1, sizeof(*p->part)))) goto clean_up;
+    if (!(p->local = calloc(p->n_target + 1, sizeof(*p->local)))) goto clean_up;
+    if (!(p->size = calloc(n_part, sizeof(*p->size)))) goto clean_up;
+    if (!(p->fn = calloc(n_part, sizeof(*p->fn)))) goto clean_up;
+    if (!(p->fp = calloc(n_part, sizeof(*p->fp)))) goto clean_up;
+    if (!(p->part_hdr = calloc(n_part, sizeof(*p->part_hdr)))) goto clean_up;
+    part_assign(p, mode);
+    for (k = 0; k < n_part; ++k){
+        if (!(p->fn[k] = malloc(strlen(prefix) + 16))) goto clean_up;
+        sprintf(p->fn[k], "%s.%d.bam", prefix, k);
+        if (!(p->part_hdr[k] = part_hdr(p, k))) goto clean_up;
+        if (!(p->fp[k] = sam_open(p->fn[k], "wb"))) goto clean_up;
+        if (tpool && tpool->pool && hts_set_opt(p->fp[k], HTS_OPT_THREAD_POOL, tpool) != 0) goto clean_up;
+        if (sam_hdr_write(p->fp[k], p->part_hdr[k]) != 0) goto clean_up;
+    }
+    return p;
+
+    clean_up:
+    part_destroy(p);
+    return NULL;
+}
+
+int part_finish(part_t *p, const char *fn){
+    FILE *f;
+    int32_t t;
+    int k, ret = 0;
+    for (k = 0; k < p->n_part; ++k){
+        if (p->fp[k] && sam_close(p->fp[k]) != 0) ret = -1;
+        p->fp[k] = NULL;
+    }
+    if (ret != 0) return -1;
+    if (!(f = fopen(fn, "w"))) return -1;
+    for (k = 0; k < p->n_part; ++k) fprintf(f, "#part\t%d\t%s\t%d\n", k, p->fn[k], p->size[k]);
+    for (t = 0; t < p->n_target; ++t) fprintf(f, "%s\t%d\n", sam_hdr_tid2name(p->hdr, t), p->part[t]);
+    if (ferror(f)) ret = -1;
+    if (fclose(f) != 0) ret = -1;
+    return ret;
+}
+
+void part_destroy(part_t *p){
+    int k;
+    if (!p) return;
+    for (k = 0; k < p->n_part; ++k){
+        if (p->fp && p->fp[k]) sam_close(p->fp[k]);
+        if (p->part_hdr && p->part_hdr[k]) sam_hdr_destroy(p->part_hdr[k]);
+        if (p->fn) free(p->fn[k]);
+    }
+    free(p->fp);
+    free(p->part_hdr);
+    free(p->fn);
+    free(p->part);
+    free(p->local);
+    free(p->size);
+    free(p);
+}
@@ -0,0 +1,47 @@
+/* The MIT License (MIT)
+
+   Copyright (c) 2023 Anrui Liu <liuar6@gmail.com>
+
+   Permission is hereby granted, free of charge, to any person obtaining
+   a copy of this software and associated documentation files (the
+   “Software”), to deal in the Software without restriction, including
+   without limitation the rights to use, copy, modify, merge, publish,
+   distribute, sublicense, and/or sell copies of the Software, and to
+   permit persons to whom the Software is furnished to do so, subject to
+   the following conditions:
+
+   The above copyright notice and this permission notice shall be
+   included in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+   EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+   MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+   NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+   BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+   ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+   CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+ */
+
+#ifndef __TRANSMAP_PART_H
+#define __TRANSMAP_PART_H
+
+#include "htslib/sam.h"
+#include "htslib/thread_pool.h"
+
+#define TRANSMAP_PART_RANGE 0 /* contiguous ranges of tid holding about the same target length */
+#define TRANSMAP_PART_HASH 1  /* by the hash of the target name, stable across annotations */
+
+typedef struct part_s part_t;
+
+/* write the alignments to n_part files <prefix>.<i>.bam, each holding the targets of hdr assigned to it under its
+ * own header with only their @SQ lines. A mate on a target of another file is reported with RNEXT and PNEXT unset. */
+part_t *part_init(const char *prefix, sam_hdr_t *hdr, int n_part, int mode, htsThreadPool *tpool);
+/* b is moved to the tid of the file of its target */
+int part_write(part_t *p, bam1_t *b);
+/* close the files and write the manifest fn: a "#part\t<i>\t<file>\t<n_target>" line for each file, then a
+ * "<target>\t<i>" line for each target */
+int part_finish(part_t *p, const char *fn);
+void part_destroy(part_t *p);
+
+#endif /* __TRANSMAP_PART_H */
@@ -0,0 +1,211 @@
+/* The MIT License (MIT)
+
+   Copyright (c) 2023 Anrui Liu <liuar6@gmail.com>
+
+   Permission is hereby granted, free of charge, to any person obtaining
+   a copy of this software and associated documentation files (the
+   “Software”), to deal in the Software without restriction, including
+   without limitation the rights to use, copy, modify, merge, publish,
+   distribute, sublicense, and/or sell copies of the Software, and to
+   permit persons to whom the Software is furnished to do so, subject to
+   the following conditions:
+
+   The above copyright notice and this permission notice shall be
+   included in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+   EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+   MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+   NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+   BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+   ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+   CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <pthread.h>
+#include "htslib/sam.h"
+#include "transmap.h"
+#include "transmap_pipe.h"
+
+typedef struct transmap_pipe_t{
+    pthread_mutex_t lock;
+    pthread_cond_t has_free;
+    pthread_cond_t has_input;
+    pthread_cond_t has_done;
+    int depth;
+    transmap_batch_t **batch;  /* all batches owned by the pipeline */
+    transmap_batch_t **free;   /* batches ready to be filled by the reader */
+    int n_free;
+    transmap_batch_t **input;  /* ring of batches waiting for a worker */
+    int input_head;
+    int n_input;
+    transmap_batch_t **done;   /* reorder buffer, indexed by batch id modulo depth */
+    int64_t n_read;
+    int eof;
+    int error;
+    sam_parser_t *sam;
+    struct transmap_option *options;
+} transmap_pipe_t;
+
+typedef struct transmap_pipe_worker_t{
+    transmap_pipe_t *pipe;
+    transmap_worker_t worker;
+} transmap_pipe_worker_t;
+
+static void pipe_fail(transmap_pipe_t *pipe){
+    pthread_mutex_lock(&pipe->lock);
+    pipe->error = 1;
+    pthread_cond_broadcast(&pipe->has_free);
+    pthread_cond_broadcast(&pipe->has_input);
+    pthread_cond_broadcast(&pipe->has_done);
+    pthread_mutex_unlock(&pipe->lock);
+}
+
+static void *pipe_reader(void *arg){
+    transmap_pipe_t *pipe = arg;
+    transmap_batch_t *batch;
+    int ret;
+    while (1){
+        pthread_mutex_lock(&pipe->lock);
+        while (pipe->n_free == 0 && !pipe->error) pthread_cond_wait(&pipe->has_free, &pipe->lock);
+        if (pipe->error) {pthread_mutex_unlock(&pipe->lock); break;}
+        batch = pipe->free[--pipe->n_free];
+        pthread_mutex_unlock(&pipe->lock);
+
+        transmap_batch_clear(batch);
+        if ((ret = transmap_batch_read(pipe->sam, batch, TRANSMAP_BATCH_SIZE)) < 0){
+            fprintf(stderr, "[transmap] Error: can not read the input bam file.\n");
+            pipe_fail(pipe);
+            break;
+        }
+        pthread_mutex_lock(&pipe->lock);
+        if (ret == 0){
+            pipe->free[pipe->n_free++] = batch;
+            pipe->eof = 1;
+            pthread_cond_broadcast(&pipe->has_input);
+            pthread_cond_broadcast(&pipe->has_done);
+            pthread_mutex_unlock(&pipe->lock);
+            break;
+        }
+        batch->id = pipe->n_read++;
+        pipe->input[(pipe->input_head + pipe->n_input++) % pipe->depth] = batch;
+        pthread_cond_signal(&pipe->has_input);
+        pthread_mutex_unlock(&pipe->lock);
+    }
+    return NULL;
+}
+
+static void *pipe_worker(void *arg){
+    transmap_pipe_worker_t *pw = arg;
+    transmap_pipe_t *pipe = pw->pipe;
+    transmap_batch_t *batch;
+    int ret;
+    while (1){
+        pthread_mutex_lock(&pipe->lock);
+        while (pipe->n_input == 0 && !pipe->eof && !pipe->error) pthread_cond_wait(&pipe->has_input, &pipe->lock);
+        if (pipe->n_input == 0 || pipe->error) {pthread_mutex_unlock(&pipe->lock); break;}
+        batch = pipe->input[pipe->input_head];
+        pipe->input_head = (pipe->input_head + 1) % pipe->depth;
+        pipe->n_input--;
+        pthread_mutex_unlock(&pipe->lock);
+
+        ret = transmap_batch_map(batch, &pw->worker, pipe->options);
+
+        pthread_mutex_lock(&pipe->lock);
+        pipe->done[batch->id % pipe->depth] = batch;
+        pthread_cond_broadcast(&pipe->has_done);
+        pthread_mutex_unlock(&pipe->lock);
+        if (ret != 0) {pipe_fail(pipe); break;}
+    }
+    return NULL;
+}
+
+int transmap_pipe_run(sam_parser_t *sam, transmap_out_t *out, void *dict, struct transmap_statistic *statistics, struct transmap_option *options){
+    transmap_pipe_t pipe;
+    transmap_pipe_worker_t *workers = NULL;
+    pthread_t reader, *threads = NULL;
+    transmap_batch_t *batch;
+    int n_workers = options->n_workers;
+    int n_started = 0, reader_started = 0;
+    int64_t next = 0;
+    int i, ret = -1;
+
+    memset(&pipe, 0, sizeof(pipe));
+    pipe.depth = n_workers * TRANSMAP_PIPE_DEPTH;
+    pipe.sam = sam;
+    pipe.options = options;
+    pthread_mutex_init(&pipe.lock, NULL);
+    pthread_cond_init(&pipe.has_free, NULL);
+    pthread_cond_init(&pipe.has_input, NULL);
+    pthread_cond_init(&pipe.has_done, NULL);
+    if (!(pipe.batch = calloc(pipe.depth, sizeof(*pipe.batch)))) goto clean_up;
+    if (!(pipe.free = calloc(pipe.depth, sizeof(*pipe.free)))) goto clean_up;
+    if (!(pipe.input = calloc(pipe.depth, sizeof(*pipe.input)))) goto clean_up;
+    if (!(pipe.done = calloc(pipe.depth, sizeof(*pipe.done)))) goto clean_up;
+    for (i = 0; i < pipe.depth; ++i){
+        if (!(pipe.batch[i] = transmap_batch_init())) goto clean_up;
+        pipe.free[pipe.n_free++] = pipe.batch[i];
+    }
+    if (!(workers = calloc(n_workers, sizeof(*workers)))) goto clean_up;
+    if (!(threads = calloc(n_workers, sizeof(*threads)))) goto clean_up;
+    for (i = 0; i < n_workers; ++i){
+        workers[i].pipe = &pipe;
+        if (transmap_worker_init(&workers[i].worker, dict, options) != 0) goto clean_up;
+    }
+
+    if (pthread_create(&reader, NULL, pipe_reader, &pipe) != 0) goto clean_up;
+    reader_started = 1;
+    for (n_started = 0; n_started < n_workers; ++n_started)
+        if (pthread_create(threads + n_started, NULL, pipe_worker, workers + n_started) != 0) {pipe_fail(&pipe); break;}
+
+    /* the calling thread drains the reorder buffer */
+    while (1){
+        pthread_mutex_lock(&pipe.lock);
+        while (!pipe.done[next % pipe.depth] && !pipe.error && !(pipe.eof && next == pipe.n_read))
+            pthread_cond_wait(&pipe.has_done, &pipe.lock);
+        if (pipe.error || !pipe.done[next % pipe.depth]) {pthread_mutex_unlock(&pipe.lock); break;}
+        batch = pipe.done[next % pipe.depth];
+        pipe.done[next % pipe.depth] = NULL;
+        pthread_mutex_unlock(&pipe.lock);
+
+        if (transmap_batch_write(batch, out) != 0){
+            fprintf(stderr, "[transmap] Error: can not write the output bam file.\n");
+            pipe_fail(&pipe);
+            break;
+        }
+        pthread_mutex_lock(&pipe.lock);
+        pipe.free[pipe.n_free++] = batch;
+        pthread_cond_signal(&pipe.has_free);
+        pthread_mutex_unlock(&pipe.lock);
+        next++;
+    }
+    ret = pipe.error? -1: 0;
+
+    clean_up:
+    if (ret != 0) pipe_fail(&pipe);
+    if (reader_started) pthread_join(reader, NULL);
+    for (i = 0; i < n_started; ++i) pthread_join(threads[i], NULL);
+    if (workers){
+        for (i = 0; i < n_workers; ++i){
+            transmap_statistic_merge(statistics, &workers[i].worker.statistics);
+            transmap_worker_destroy(&workers[i].worker);
+        }
+        free(workers);
+    }
+    if (threads) free(threads);
+    if (pipe.batch){
+        for (i = 0; i < pipe.depth; ++i) if (pipe.batch[i]) transmap_batch_destroy(pipe.batch[i]);
+        free(pipe.batch);
+    }
+    if (pipe.free) free(pipe.free);
+    if (pipe.input) free(pipe.input);
+    if (pipe.done) free(pipe.done);
+    pthread_cond_destroy(&pipe.has_free);
+    pthread_cond_destroy(&pipe.has_input);
+    pthread_cond_destroy(&pipe.has_done);
+    pthread_mutex_destroy(&pipe.lock);
+    return ret;
+}
@@ -0,0 +1,43 @@
+/* The MIT License (MIT)
+
+   Copyright (c) 2023 Anrui Liu <liuar6@gmail.com>
+
+   Permission is hereby granted, free of charge, to any person obtaining
+   a copy of this software and associated documentation files (the
+   “Software”), to deal in the Software without restriction, including
+   without limitation the rights to use, copy, modify, merge, publish,
+   distribute, sublicense, and/or sell copies of the Software, and to
+   permit persons to whom the Software is furnished to do so, subject to
+   the following conditions:
+
+   The above copyright notice and this permission notice shall be
+   included in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+   EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+   MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+   NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+   BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+   ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+   CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+ */
+
+#ifndef __TRANSMAP_PIPE_H
+#define __TRANSMAP_PIPE_H
+
+#include "htslib/sam.h"
+
+/* number of batches kept in flight per worker; this bounds the memory used by the pipeline */
+#define TRANSMAP_PIPE_DEPTH 4
+
+struct sam_parser_s;
+struct transmap_out_s;
+struct transmap_option;
+struct transmap_statistic;
+
+/* one reader thread groups the input into batches, options->n_workers threads map them and the calling thread
+ * writes the results in input order. The statistics of the workers are merged into statistics on return. */
+int transmap_pipe_run(struct sam_parser_s *sam, struct transmap_out_s *out, void *dict, struct transmap_statistic *statistics, struct transmap_option *options);
+
+#endif /* __TRANSMAP_PIPE_H */
@@ -0,0 +1,143 @@
+/* The MIT License (MIT)
+
+   Copyright (c) 2023 Anrui Liu <liuar6@gmail.com>
+
+   Permission is hereby granted, free of charge, to any person obtaining
+   a copy of this software and associated documentation files (the
+   “Software”), to deal in the Software without restriction, including
+   without limitation the rights to use, copy, modify, merge, publish,
+   distribute, sublicense, and/or sell copies of the Software, and to
+   permit persons to whom the Software is furnished to do so, subject to
+   the following conditions:
+
+   The above copyright notice and this permission notice shall be
+   included in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+   EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+   MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+   NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+   BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+   ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+   CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "htslib/sam.h"
+#include "htslib/faidx.h"
+#include "htslib/kstring.h"
+#include "transmap_bed.h"
+#include "transmap_gtf.h"
+#include "transmap_ref.h"
+
+#define TRANSMAP_REF_LINE 60
+
+static inline char ref_comp(char b){
+    switch (b){
+        case 'A': return 'T';
+        case 'T': return 'A';
+        case 'C': return 'G';
+        case 'G': return 'C';
+        case 'a': return 't';
+        case 't': return 'a';
+        case 'c': return 'g';
+        case 'g': return 'c';
+        default: return 'N';
+    }
+}
+
+/* append the bases [start, end) of chrom to seq */
+static int ref_append(const faidx_t *fai, const char *chrom, hts_pos_t start, hts_pos_t end, kstring_t *seq){
+    hts_pos_t len = 0;
+    char *s = NULL;
+    if (end <= start) return 0;
+    /* a reference of N would make every aligned base a substitution, this is mostly a chr prefix mismatch */
+    if (!faidx_has_seq(fai, chrom)){
+        fprintf(stderr, "[transmap] Error: the sequence %s is not found in the genome fasta file.\n", chrom);
+        return -1;
+    }
+    if (!(s = faidx_fetch_seq64(fai, chrom, start, end - 1, &len))) return -1;
+    if (len < 0) len = 0;
+    if (ks_resize(seq, seq->l + (end - start) + 1) != 0) {
+        free(s);
+        return -1;
+    }
+    if (len > 0) memcpy(seq->s + seq->l, s, len);
+    memset(seq->s + seq->l + len, 'N', (end - start) - len);
+    seq->l += end - start;
+    seq->s[seq->l] = '\0';
+    free(s);
+    return 0;
+}
+
+static int ref_put(FILE *f, const char *name, kstring_t *seq, hts_pos_t len, char strand){
+    size_t i, j;
+    if (ks_resize(seq, len + 1) != 0) return -1;
+    /* the header length is the reference */
+    if (seq->l < (size_t)len) memset(seq->s + seq->l, 'N', len - seq->l);
+    seq->l = len;
+    if (strand == '-'){
+        for (i = 0, j = seq->l; i < j--; ++i){
+            char c = seq->s[i];
+            seq->s[i] = ref_comp(seq->s[j]);
+            seq->s[j] = ref_comp(c);
+        }
+    }
+    if (fprintf(f, ">%s\n", name) < 0) return -1;
+    for (i = 0; i < seq->l; i += TRANSMAP_REF_LINE){
+        size_t n = seq->l - i < TRANSMAP_REF_LINE? seq->l - i: TRANSMAP_REF_LINE;
+        if (fwrite(seq->s + i, 1, n, f) != n || fputc('\n', f) == EOF) return -1;
+    }
+    return 0;
+}
+
+int transmap_ref_write(const char *genome, const char *fn, void *dict, int gtf_mode, sam_hdr_t *hdr){
+    faidx_t *fai = NULL;
+    FILE *f = NULL;
+    kstring_t seq = KS_INITIALIZE;
+    transcript_t **tr = NULL;
+    int n_target = sam_hdr_nref(hdr);
+    int i, j, ret = -1;
+    if (!(fai = fai_load(genome))) goto clean_up;
+    if (!(f = fopen(fn, "w"))) goto clean_up;
+    if (gtf_mode){
+        gtf_dict_t *gtf = dict;
+        if (!(tr = calloc(n_target > 0? n_target: 1, sizeof(*tr)))) goto clean_up;
+        for (khiter_t k = 0; k < kh_end(gtf->record); ++k)
+            if (kh_exist(gtf->record, k)) tr[kh_val(gtf->record, k)->new_tid] = kh_val(gtf->record, k);
+        for (i = 0; i < n_target; ++i){
+            seq.l = 0;
+            /* the exons are in the order of the genome and are reverse complemented as a whole */
+            if (tr[i]) for (j = 0; j < tr[i]->exons->size; ++j){
+                exon_t *exon = tr[i]->exons->data[j];
+                if (ref_append(fai, exon->chrom, exon->start, exon->end, &seq) != 0) goto clean_up;
+            }
+            if (ref_put(f, sam_hdr_tid2name(hdr, i), &seq, sam_hdr_tid2len(hdr, i), tr[i]? tr[i]->strand: '+') != 0) goto clean_up;
+        }
+    } else {
+        bed_dict_t *bed = dict;
+        for (i = 0; i < bed->size; ++i){
+            bed_t *record = bed->record[i];
+            seq.l = 0;
+            if (ref_append(fai, record->chrom, record->start, record->end, &seq) != 0) goto clean_up;
+            if (ref_put(f, sam_hdr_tid2name(hdr, record->new_tid), &seq, sam_hdr_tid2len(hdr, record->new_tid), record->strand) != 0) goto clean_up;
+        }
+    }
+    if (fclose(f) != 0) {
+        f = NULL;
+        goto clean_up;
+    }
+    f = NULL;
+    if (fai_build(fn) != 0) goto clean_up;
+    ret = 0;
+
+    clean_up:
+    if (f) fclose(f);
+    if (fai) fai_destroy(fai);
+    free(tr);
+    ks_free(&seq);
+    return ret;
+}
@@ -0,0 +1,37 @@
+/* The MIT License (MIT)
+
+   Copyright (c) 2023 Anrui Liu <liuar6@gmail.com>
+
+   Permission is hereby granted, free of charge, to any person obtaining
+   a copy of this software and associated documentation files (the
+   “Software”), to deal in the Software without restriction, including
+   without limitation the rights to use, copy, modify, merge, publish,
+   distribute, sublicense, and/or sell copies of the Software, and to
+   permit persons to whom the Software is furnished to do so, subject to
+   the following conditions:
+
+   The above copyright notice and this permission notice shall be
+   included in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+   EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+   MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+   NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+   BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+   ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+   CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+ */
+
+#ifndef __TRANSMAP_REF_H
+#define __TRANSMAP_REF_H
+
+#include "htslib/sam.h"
+
+/* write the sequence of each target of hdr, in tid order, to the fasta file fn and index it for use as a CRAM
+ * reference. The sequences are cut from the faidx indexed genome along the records of dict, a gtf_dict_t with
+ * gtf_mode and a bed_dict_t otherwise, and reverse complemented for the targets on the minus strand. Bases outside
+ * of the genome are written as N. */
+int transmap_ref_write(const char *genome, const char *fn, void *dict, int gtf_mode, sam_hdr_t *hdr);
+
+#endif /* __TRANSMAP_REF_H */
@@ -0,0 +1,216 @@
+/* The MIT License (MIT)
+
+   Copyright (c) 2023 Anrui Liu <liuar6@gmail.com>
+
+   Permission is hereby granted, free of charge, to any person obtaining
+   a copy of this software and associated documentation files (the
+   “Software”), to deal in the Software without restriction, including
+   without limitation the rights to use, copy, modify, merge, publish,
+   distribute, sublicense, and/or sell copies of the Software, and to
+   permit persons to whom the Software is furnished to do so, subject to
+   the following conditions:
+
+   The above copyright notice and this permission notice shall be
+   included in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+   EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+   MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+   NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+   BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+   ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+   CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include "htslib/sam.h"
+#include "htslib/bgzf.h"
+#include "transmap.h"
+#include "transmap_split.h"
+#include "transmap_shard.h"
+
+/* the manifest is a tab separated text file:
+ * #transmap manifest   <input file>
+ * <shard>  <start virtual offset>  <end virtual offset, -1 for the end of file> */
+
+static void transmap_plan_usage(const char *msg){
+    const char *usage_info = "\
+Usage:  transmap plan --fi <alignment file> --shards <number of shards> [--fo <manifest file>]\n\
+[options]\n\
+-i/--fi             : input bam file sorted (or grouped) by query name.\n\
+-n/--shards         : number of shards.\n\
+-o/--fo             : output manifest file. default: stdout.\n\n";
+    if (msg==NULL || msg[0] == '\0') fprintf(stderr, "%s", usage_info);
+    else fprintf(stderr, "%s\n\n%s", msg, usage_info);
+    exit(1);
+}
+
+int transmap_plan_main(int argc, char *argv[]){
+    const char *in_file = NULL, *out_file = "-";
+    int64_t *offsets = NULL;
+    int n_shard = 0, n_range, i, c, ret = 1;
+    FILE *f = NULL;
+    const struct option long_options[] =
+            {
+                    { "help" , no_argument , NULL, 'h' },
+                    { "fi" , required_argument , NULL, 'i' },
+                    { "fo" , required_argument, NULL, 'o' },
+                    { "shards" , required_argument, NULL, 'n' },
+                    {NULL, 0, NULL, 0} ,
+            };
+    if (argc == 1) transmap_plan_usage("");
+    while ((c = getopt_long(argc, argv, "hi:o:n:", long_options, NULL)) >= 0){
+        switch (c){
+            case 'h':
+                transmap_plan_usage(NULL);
+                break;
+            case 'i':
+                in_file = optarg;
+                break;
+            case 'o':
+                out_file = optarg;
+                break;
+            case 'n':
+                n_shard = strtol(optarg, NULL, 10);
+                break;
+            default:
+                transmap_plan_usage("[transmap plan] Error:unrecognized parameter");
+        }
+    }
+    if (argc != optind) transmap_plan_usage("[transmap plan] Error:unrecognized parameter");
+    if (in_file == NULL) transmap_plan_usage("[transmap plan] Error: you should provide the input bam file via --fi.");
+    if (n_shard < 1) transmap_plan_usage("[transmap plan] Error: --shards should be a positive integer.");
+
+    if (!(offsets = malloc((n_shard + 1) * sizeof(*offsets)))) goto clean_up;
+    if ((n_range = bam_split_plan(in_file, n_shard, offsets)) < 0){
+        fprintf(stderr, "[transmap plan] Error: can not split the input bam file.\n");
+        goto clean_up;
+    }
+    if (n_range < n_shard) fprintf(stderr, "[transmap plan] Warning: the input can only be split into %d shards.\n", n_range);
+    if (!(f = strcmp(out_file, "-") == 0? stdout: fopen(out_file, "w"))){
+        fprintf(stderr, "[transmap plan] Error: can not open the manifest file.\n");
+        goto clean_up;
+    }
+    fprintf(f, "#transmap manifest\t%s\n", in_file);
+    for (i = 0; i < n_range; ++i) fprintf(f, "%d\t%" PRId64 "\t%" PRId64 "\n", i, offsets[i], offsets[i + 1]);
+    ret = 0;
+
+    clean_up:
+    if (f && f != stdout && fclose(f) != 0) ret = 1;
+    if (offsets) free(offsets);
+    return ret;
+}
+
+int transmap_manifest_read(const char *fn, int shard, int64_t *start, int64_t *end){
+    char buffer[1024];
+    int64_t s, e;
+    int i, ret = -1;
+    FILE *f;
+    if (!(f = fopen(fn, "r"))) return -1;
+    while (fgets(buffer, sizeof(buffer), f)){
+        if (buffer[0] == '#') continue;
+        if (sscanf(buffer, "%d\t%" SCNd64 "\t%" SCNd64, &i, &s, &e) != 3) break;
+        if (i != shard) continue;
+        *start = s;
+        *end = e;
+        ret = 0;
+        break;
+    }
+    fclose(f);
+    return ret;
+}
+
+static void transmap_merge_usage(const char *msg){
+    const char *usage_info = "\
+Usage:  transmap merge --fo <output file> <shard bam file> [<shard bam file> ...]\n\
+[options]\n\
+-o/--fo             : output bam file. the shard statistics (<shard bam file>.stats) are added up into <output file>.stats.\n\n";
+    if (msg==NULL || msg[0] == '\0') fprintf(stderr, "%s", usage_info);
+    else fprintf(stderr, "%s\n\n%s", msg, usage_info);
+    exit(1);
+}
+
+int transmap_merge_main(int argc, char *argv[]){
+    const char *out_file = NULL;
+    struct transmap_option options;
+    struct transmap_statistic statistics;
+    BGZF *in = NULL, *out = NULL;
+    bam_hdr_t *hdr = NULL;
+    char *stats_file = NULL;
+    int i, c, n_stats = 0, ret = 1;
+    const struct option long_options[] =
+            {
+                    { "help" , no_argument , NULL, 'h' },
+                    { "fo" , required_argument, NULL, 'o' },
+                    {NULL, 0, NULL, 0} ,
+            };
+    if (argc == 1) transmap_merge_usage("");
+    while ((c = getopt_long(argc, argv, "ho:", long_options, NULL)) >= 0){
+        switch (c){
+            case 'h':
+                transmap_merge_usage(NULL);
+                break;
+            case 'o':
+                out_file = optarg;
+                break;
+            default:
+                transmap_merge_usage("[transmap merge] Error:unrecognized parameter");
+        }
+    }
+    if (out_file == NULL) transmap_merge_usage("[transmap merge] Error: you should provide the output bam file via --fo.");
+    if (optind == argc) transmap_merge_usage("[transmap merge] Error: you should provide at least one shard bam file.");
+    memset(&options, 0, sizeof(options));
+    memset(&statistics, 0, sizeof(statistics));
+
+    /* the header of the first shard is used for the merged output */
+    if (!(in = bgzf_open(argv[optind], "r")) || !(hdr = bam_hdr_read(in))){
+        fprintf(stderr, "[transmap merge] Error: can not read the header of %s.\n", argv[optind]);
+        goto clean_up;
+    }
+    if (!(out = bgzf_open(out_file, "w")) || bam_hdr_write(out, hdr) != 0){
+        fprintf(stderr, "[transmap merge] Error: can not write the output bam file.\n");
+        goto clean_up;
+    }
+    for (i = optind; i < argc; ++i){
+        if (bam_concat(out, argv[i], 1) != 0){
+            fprintf(stderr, "[transmap merge] Error: can not append %s to the output bam file.\n", argv[i]);
+            goto clean_up;
+        }
+    }
+    if (bgzf_close(out) != 0){
+        out = NULL;
+        fprintf(stderr, "[transmap merge] Error: can not write the output bam file.\n");
+        goto clean_up;
+    }
+    out = NULL;
+
+    if (!(stats_file = malloc(strlen(out_file) + strlen(".stats") + 1))) goto clean_up;
+    for (i = optind; i < argc; ++i){
+        char *fn = malloc(strlen(argv[i]) + strlen(".stats") + 1);
+        if (!fn) goto clean_up;
+        sprintf(fn, "%s.stats", argv[i]);
+        if (transmap_statistic_read(fn, &statistics, &options.others) == 0) n_stats++;
+        free(fn);
+    }
+    if (n_stats == argc - optind){
+        sprintf(stats_file, "%s.stats", out_file);
+        transmap_statistic_print(&statistics, &options);
+        if (transmap_statistic_write(stats_file, &statistics, &options) != 0){
+            fprintf(stderr, "[transmap merge] Error: can not write the statistics file.\n");
+            goto clean_up;
+        }
+    } else if (n_stats > 0) fprintf(stderr, "[transmap merge] Warning: statistics are missing for some shards and are not merged.\n");
+    ret = 0;
+
+    clean_up:
+    if (stats_file) free(stats_file);
+    if (out) bgzf_close(out);
+    if (hdr) bam_hdr_destroy(hdr);
+    if (in) bgzf_close(in);
+    return ret;
+}
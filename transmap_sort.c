@@ -0,0 +1,257 @@
+/* The MIT License (MIT)
+
+   Copyright (c) 2023 Anrui Liu <liuar6@gmail.com>
+
+   Permission is hereby granted, free of charge, to any person obtaining
+   a copy of this software and associated documentation files (the
+   “Software”), to deal in the Software without restriction, including
+   without limitation the rights to use, copy, modify, merge, publish,
+   distribute, sublicense, and/or sell copies of the Software, and to
+   permit persons to whom the Software is furnished to do so, subject to
+   the following conditions:
+
+   The above copyright notice and this permission notice shall be
+   included in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+   EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+   MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+   NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+   BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+   ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+   CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "htslib/sam.h"
+#include "transmap_sort.h"
+
+#define BAM_SORT_RECORD_SIZE(b) (sizeof(bam1_core_t) + sizeof(int32_t) + (b)->l_data)
+#define BAM_SORT_REVERSE (1ull << 63u)
+
+static inline uint64_t bam_sort_key(const bam1_t *b){
+    return ((uint64_t)(uint32_t)b->core.tid << 32u) | (uint32_t)(b->core.pos + 1);
+}
+
+/* the same order as samtools sort: tid, position, strand, then input order */
+static int bam_sort_entry_comp(const void *a, const void *b){
+    const bam_sort_entry_t *e1 = a, *e2 = b;
+    if (e1->key != e2->key) return e1->key < e2->key? -1: 1;
+    return (e1->order > e2->order) - (e1->order < e2->order);
+}
+
+static int bam_sort_load(const uint8_t *p, bam1_t *b){
+    int32_t l_data;
+    memcpy(&b->core, p, sizeof(bam1_core_t));
+    memcpy(&l_data, p + sizeof(bam1_core_t), sizeof(int32_t));
+    if ((uint32_t)l_data > b->m_data){
+        uint8_t *new_data = realloc(b->data, l_data);
+        if (!new_data) return -1;
+        b->data = new_data;
+        b->m_data = l_data;
+    }
+    memcpy(b->data, p + sizeof(bam1_core_t) + sizeof(int32_t), l_data);
+    b->l_data = l_data;
+    return 0;
+}
+
+static int bam_sort_write_arena(bam_sort_t *s, samFile *out){
+    bam1_t *b;
+    size_t i;
+    int ret = 0;
+    if (!(b = bam_init1())) return -1;
+    for (i = 0; i < s->n_entry && ret == 0; ++i){
+        if (bam_sort_load(s->arena + (s->entry[i].order & ~BAM_SORT_REVERSE), b) != 0) ret = -1;
+        else if (sam_write1(out, s->hdr, b) < 0) ret = -1;
+    }
+    bam_destroy1(b);
+    return ret;
+}
+
+static void bam_sort_run_file(bam_sort_t *s, int i, char *fn){
+    sprintf(fn, "%s.sort%d.tmp", s->prefix, i);
+}
+
+static void bam_sort_arena(bam_sort_t *s){
+    if (s->n_entry > 1) qsort(s->entry, s->n_entry, sizeof(bam_sort_entry_t), bam_sort_entry_comp);
+}
+
+/* sort the arena and write it as the next run */
+static int bam_sort_flush(bam_sort_t *s){
+    samFile *fp;
+    char *fn;
+    int ret = -1;
+    if (!(fn = malloc(strlen(s->prefix) + 32))) return -1;
+    bam_sort_run_file(s, s->n_run, fn);
+    bam_sort_arena(s);
+    if ((fp = sam_open(fn, "wb1"))){
+        s->n_run++;
+        if ((!s->tpool || !s->tpool->pool || hts_set_opt(fp, HTS_OPT_THREAD_POOL, s->tpool) == 0) &&
+            sam_hdr_write(fp, s->hdr) == 0 && bam_sort_write_arena(s, fp) == 0) ret = 0;
+        if (sam_close(fp) != 0) ret = -1;
+    }
+    free(fn);
+    s->size = 0;
+    s->n_entry = 0;
+    return ret;
+}
+
+bam_sort_t *bam_sort_init(const char *prefix, sam_hdr_t *hdr, size_t max_size, htsThreadPool *tpool){
+    bam_sort_t *s;
+    if (!(s = calloc(1, sizeof(*s)))) return NULL;
+    s->hdr = hdr;
+    s->tpool = tpool;
+    s->max_size = max_size;
+    if (!(s->prefix = strdup(prefix))) goto clean_up;
+    if (!(s->arena = malloc(max_size))) goto clean_up;
+    return s;
+
+    clean_up:
+    bam_sort_destroy(s);
+    return NULL;
+}
+
+int bam_sort_add(bam_sort_t *s, const bam1_t *b){
+    size_t need = BAM_SORT_RECORD_SIZE(b);
+    int32_t l_data = b->l_data;
+    uint8_t *p;
+    if (s->size + need > s->max_size && s->n_entry > 0 && bam_sort_flush(s) != 0) return -1;
+    if (need > s->max_size){
+        if (!(p = realloc(s->arena, need))) return -1;
+        s->arena = p;
+        s->max_size = need;
+    }
+    if (s->n_entry == s->m_entry){
+        size_t new_m = s->m_entry? s->m_entry << 1u: 1024;
+        bam_sort_entry_t *new_entry = realloc(s->entry, new_m * sizeof(*new_entry));
+        if (!new_entry) return -1;
+        s->entry = new_entry;
+        s->m_entry = new_m;
+    }
+    s->entry[s->n_entry].key = bam_sort_key(b);
+    s->entry[s->n_entry++].order = (b->core.flag & BAM_FREVERSE? BAM_SORT_REVERSE: 0) | s->size;
+    p = s->arena + s->size;
+    memcpy(p, &b->core, sizeof(bam1_core_t));
+    memcpy(p + sizeof(bam1_core_t), &l_data, sizeof(int32_t));
+    memcpy(p + sizeof(bam1_core_t) + sizeof(int32_t), b->data, l_data);
+    s->size += need;
+    return 0;
+}
+
+/* a binary min-heap of the head record of each run */
+typedef struct bam_sort_head_t{
+    uint64_t key;
+    int run;
+    bam1_t *b;
+} bam_sort_head_t;
+
+static inline int bam_sort_head_less(const bam_sort_head_t *h1, const bam_sort_head_t *h2){
+    if (h1->key != h2->key) return h1->key < h2->key;
+    if ((h1->b->core.flag & BAM_FREVERSE) != (h2->b->core.flag & BAM_FREVERSE)) return !(h1->b->core.flag & BAM_FREVERSE);
+    return h1->run < h2->run;
+}
+
+static void bam_sort_heap_down(bam_sort_head_t *heap, int n, int i){
+    bam_sort_head_t tmp;
+    int j;
+    while ((j = 2 * i + 1) < n){
+        if (j + 1 < n && bam_sort_head_less(heap + j + 1, heap + j)) j++;
+        if (!bam_sort_head_less(heap + j, heap + i)) break;
+        tmp = heap[i];
+        heap[i] = heap[j];
+        heap[j] = tmp;
+        i = j;
+    }
+}
+
+static int bam_sort_merge(bam_sort_t *s, samFile *out){
+    samFile **run = NULL;
+    bam_sort_head_t *heap = NULL;
+    sam_hdr_t *hdr;
+    char *fn = NULL;
+    int i, n = 0, ret, error = -1;
+    if (!(fn = malloc(strlen(s->prefix) + 32))) return -1;
+    if (!(run = calloc(s->n_run, sizeof(*run)))) goto clean_up;
+    if (!(heap = calloc(s->n_run, sizeof(*heap)))) goto clean_up;
+    for (i = 0; i < s->n_run; ++i){
+        bam_sort_run_file(s, i, fn);
+        if (!(run[i] = sam_open(fn, "r"))) goto clean_up;
+        if (s->tpool && s->tpool->pool && hts_set_opt(run[i], HTS_OPT_THREAD_POOL, s->tpool) != 0) goto clean_up;
+        if (!(hdr = sam_hdr_read(run[i]))) goto clean_up;
+        sam_hdr_destroy(hdr);
+        if (!(heap[n].b = bam_init1())) goto clean_up;
+        if ((ret = sam_read1(run[i], s->hdr, heap[n].b)) < -1) {n++; goto clean_up;}
+        if (ret == -1) {bam_destroy1(heap[n].b); heap[n].b = NULL; continue;}
+        heap[n].run = i;
+        heap[n].key = bam_sort_key(heap[n].b);
+        n++;
+    }
+    for (i = n / 2 - 1; i >= 0; --i) bam_sort_heap_down(heap, n, i);
+    while (n > 0){
+        if (sam_write1(out, s->hdr, heap[0].b) < 0) goto clean_up;
+        if ((ret = sam_read1(run[heap[0].run], s->hdr, heap[0].b)) < -1) goto clean_up;
+        if (ret == -1){
+            bam_destroy1(heap[0].b);
+            heap[0] = heap[--n];
+            heap[n].b = NULL;
+        } else heap[0].key = bam_sort_key(heap[0].b);
+        bam_sort_heap_down(heap, n, 0);
+    }
+    error = 0;
+
+    clean_up:
+    if (heap){
+        for (i = 0; i < n; ++i) if (heap[i].b) bam_destroy1(heap[i].b);
+        free(heap);
+    }
+    if (run){
+        for (i = 0; i < s->n_run; ++i) if (run[i]) sam_close(run[i]);
+        free(run);
+    }
+    free(fn);
+    return error;
+}
+
+int bam_sort_finish(bam_sort_t *s, samFile *out){
+    char *fnidx;
+    int i, min_shift = 0, error = -1;
+    for (i = 0; i < s->hdr->n_targets; ++i)
+        if (s->hdr->target_len[i] >= TRANSMAP_BAI_MAX_LEN) min_shift = 14;
+    if (s->n_run > 0 && s->n_entry > 0 && bam_sort_flush(s) != 0) return -1;
+    /* the prefix is the name of the output bam file */
+    if (!(fnidx = malloc(strlen(s->prefix) + 5))) return -1;
+    sprintf(fnidx, "%s.%s", s->prefix, min_shift > 0? "csi": "bai");
+    if (sam_idx_init(out, s->hdr, min_shift, fnidx) != 0){
+        fprintf(stderr, "[transmap] Error: can not initialize the index of the output bam file.\n");
+        goto clean_up;
+    }
+    if (s->n_run == 0){
+        bam_sort_arena(s);
+        if (bam_sort_write_arena(s, out) != 0) goto clean_up;
+    } else if (bam_sort_merge(s, out) != 0) goto clean_up;
+    if (sam_idx_save(out) != 0){
+        fprintf(stderr, "[transmap] Error: can not write the index of the output bam file.\n");
+        goto clean_up;
+    }
+    error = 0;
+
+    clean_up:
+    free(fnidx);
+    return error;
+}
+
+void bam_sort_destroy(bam_sort_t *s){
+    char *fn;
+    int i;
+    if (s->prefix && (fn = malloc(strlen(s->prefix) + 32))){
+        for (i = 0; i < s->n_run; ++i) {bam_sort_run_file(s, i, fn); remove(fn);}
+        free(fn);
+    }
+    if (s->prefix) free(s->prefix);
+    if (s->arena) free(s->arena);
+    if (s->entry) free(s->entry);
+    free(s);
+}
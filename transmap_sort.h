@@ -0,0 +1,65 @@
+/* The MIT License (MIT)
+
+   Copyright (c) 2023 Anrui Liu <liuar6@gmail.com>
+
+   Permission is hereby granted, free of charge, to any person obtaining
+   a copy of this software and associated documentation files (the
+   “Software”), to deal in the Software without restriction, including
+   without limitation the rights to use, copy, modify, merge, publish,
+   distribute, sublicense, and/or sell copies of the Software, and to
+   permit persons to whom the Software is furnished to do so, subject to
+   the following conditions:
+
+   The above copyright notice and this permission notice shall be
+   included in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+   EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+   MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+   NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+   BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+   ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+   CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+ */
+
+#ifndef __TRANSMAP_SORT_H
+#define __TRANSMAP_SORT_H
+
+#include <stdint.h>
+#include "htslib/sam.h"
+#include "htslib/thread_pool.h"
+
+/* default memory in MB for the records sorted in memory by --sort */
+#define TRANSMAP_SORT_MEMORY 768
+/* targets longer than this can not be indexed by bai */
+#define TRANSMAP_BAI_MAX_LEN (1 << 29)
+
+typedef struct bam_sort_entry_t{
+    uint64_t key;    /* tid (unmapped last) and position */
+    uint64_t order;  /* the reverse strand flag in the top bit, then the offset of the record in the arena */
+} bam_sort_entry_t;
+
+/* records are collected in an arena of at most max_size bytes. A full arena is sorted and written as a run to
+ * <prefix>.sort<i>.tmp, and the runs are merged when the output is written. */
+typedef struct bam_sort_s{
+    char *prefix;
+    sam_hdr_t *hdr;
+    htsThreadPool *tpool;
+    uint8_t *arena;
+    size_t size;
+    size_t max_size;
+    bam_sort_entry_t *entry;
+    size_t n_entry;
+    size_t m_entry;
+    int n_run;
+} bam_sort_t;
+
+bam_sort_t *bam_sort_init(const char *prefix, sam_hdr_t *hdr, size_t max_size, htsThreadPool *tpool);
+int bam_sort_add(bam_sort_t *s, const bam1_t *b);
+/* write the sorted records to out, whose header is already written, and build the bai (or csi when a target is
+ * too long for bai) index next to it */
+int bam_sort_finish(bam_sort_t *s, samFile *out);
+void bam_sort_destroy(bam_sort_t *s);
+
+#endif /* __TRANSMAP_SORT_H */
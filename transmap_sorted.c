@@ -0,0 +1,739 @@
+/* The MIT License (MIT)
+
+   Copyright (c) 2023 Anrui Liu <liuar6@gmail.com>
+
+   Permission is hereby granted, free of charge, to any person obtaining
+   a copy of this software and associated documentation files (the
+   “Software”), to deal in the Software without restriction, including
+   without limitation the rights to use, copy, modify, merge, publish,
+   distribute, sublicense, and/or sell copies of the Software, and to
+   permit persons to whom the Software is furnished to do so, subject to
+   the following conditions:
+
+   The above copyright notice and this permission notice shall be
+   included in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+   EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+   MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+   NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+   BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+   ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+   CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include "htslib/sam.h"
+#include "htslib/khash.h"
+#include "transmap.h"
+#include "transmap_sorted.h"
+
+static int sweep_item_comp(const void *a, const void *b){
+    const sweep_item_t *i1 = a, *i2 = b;
+    if (i1->start != i2->start) return i1->start < i2->start? -1: 1;
+    return (i1->end > i2->end) - (i1->end < i2->end);
+}
+
+/* the first pass only counts the targets of each lane, the second one fills them in */
+static inline void sweep_add(sweep_t *sw, int32_t key, hts_pos_t start, hts_pos_t end, void *data, int fill){
+    sweep_lane_t *lane;
+    if (key < 0 || key >= sw->n_lane || end <= start) return;
+    lane = sw->lane + key;
+    if (fill) {
+        lane->item[lane->n].start = start;
+        lane->item[lane->n].end = end;
+        lane->item[lane->n].data = data;
+    }
+    lane->n++;
+}
+
+sweep_t *sweep_init(void *dict, int n_key, uint64_t others){
+    sweep_t *sw;
+    transcript_t *tr;
+    bed_dict_t *bed;
+    khiter_t k;
+    int64_t i;
+    int j, fill;
+    if (!(sw = calloc(1, sizeof(*sw)))) return NULL;
+    sw->others = others;
+    sw->key = -1;
+    sw->pos = -1;
+    sw->n_lane = n_key;
+    if (n_key > 0 && !(sw->lane = calloc(n_key, sizeof(*sw->lane)))) goto clean_up;
+    for (fill = 0; fill < 2; ++fill){
+        if (others & OPTION_GTF_MODE){
+            khash_t(transcript) *record = ((gtf_dict_t *)dict)->record;
+            for (k = 0; k < kh_end(record); ++k){
+                if (!kh_exist(record, k)) continue;
+                tr = kh_val(record, k);
+                for (j = 0; j < tr->exons->size; ++j)
+                    sweep_add(sw, tr->tid, tr->exons->data[j]->start, tr->exons->data[j]->end, tr->exons->data[j], fill);
+            }
+        } else {
+            bed = dict;
+            for (i = 0; i < bed->size; ++i)
+                sweep_add(sw, bed->record[i]->tid, bed->record[i]->start, bed->record[i]->end, bed->record[i], fill);
+        }
+        for (j = 0; j < n_key; ++j){
+            if (fill) {
+                if (sw->lane[j].n > 1) qsort(sw->lane[j].item, sw->lane[j].n, sizeof(sweep_item_t), sweep_item_comp);
+                continue;
+            }
+            if (sw->lane[j].n && !(sw->lane[j].item = malloc(sw->lane[j].n * sizeof(sweep_item_t)))) goto clean_up;
+            sw->lane[j].n = 0;
+        }
+    }
+    return sw;
+
+    clean_up:
+    sweep_destroy(sw);
+    return NULL;
+}
+
+void sweep_destroy(sweep_t *sw){
+    int i;
+    if (sw->lane){
+        for (i = 0; i < sw->n_lane; ++i) if (sw->lane[i].item) free(sw->lane[i].item);
+        free(sw->lane);
+    }
+    if (sw->active) free(sw->active);
+    free(sw);
+}
+
+int sweep_search(sweep_t *sw, int32_t key, int32_t start, int32_t end, void *hits){
+    sweep_lane_t *lane;
+    sweep_item_t *item, **new_active;
+    int i, j;
+    if (sw->others & OPTION_GTF_MODE) vec_clear(exon, hits);
+    else vec_clear(bed, hits);
+    if (key < sw->key || (key == sw->key && start < sw->pos)) return -1;
+    if (key != sw->key){
+        sw->key = key;
+        sw->next = 0;
+        sw->n_active = 0;
+    }
+    sw->pos = start;
+    if (key >= sw->n_lane) return 0;
+    lane = sw->lane + key;
+    /* the starts only grow, so a target ending before this alignment can not overlap any later one */
+    for (i = j = 0; i < sw->n_active; ++i)
+        if (sw->active[i]->end > start) sw->active[j++] = sw->active[i];
+    sw->n_active = j;
+    for (; sw->next < lane->n && lane->item[sw->next].start < end; ++sw->next){
+        item = lane->item + sw->next;
+        if (item->end <= start) continue;
+        if (sw->n_active == sw->m_active){
+            int new_m = sw->m_active? sw->m_active << 1u: 16;
+            if (!(new_active = realloc(sw->active, new_m * sizeof(*new_active)))) return -2;
+            sw->active = new_active;
+            sw->m_active = new_m;
+        }
+        sw->active[sw->n_active++] = item;
+    }
+    /* a longer alignment before this one may have pulled in targets starting after its end */
+    for (i = 0; i < sw->n_active; ++i){
+        item = sw->active[i];
+        if (item->start >= end) continue;
+        if (sw->others & OPTION_GTF_MODE) {if (vec_add(exon, hits, item->data) != 0) return -2;}
+        else if (vec_add(bed, hits, item->data) != 0) return -2;
+    }
+    if (sw->others & OPTION_GTF_MODE){
+        vec_t(exon) *v = hits;
+        if (v->size > 1){
+            qsort(v->data, v->size, sizeof(*(v->data)), exon_search_comp);
+            for (i = 0, j = 1; j < v->size; ++j){
+                if (v->data[j]->new_tid != v->data[i]->new_tid) v->data[++i] = v->data[j];
+            }
+            v->size = i + 1;
+        }
+    } else {
+        vec_t(bed) *v = hits;
+        if (v->size > 1) qsort(v->data, v->size, sizeof(*(v->data)), bed_search_comp);
+    }
+    return 0;
+}
+
+/* merge the targets of each input reference into the regions read from an indexed input. Returns NULL with
+ * *n_reg set to -1 on error. */
+static hts_reglist_t *sweep_regions(sweep_t *sw, sam_hdr_t *hdr, int *n_reg){
+    hts_reglist_t *reglist, *reg;
+    sweep_lane_t *lane;
+    int i, j, n = 0;
+    *n_reg = -1;
+    for (i = 0; i < sw->n_lane; ++i) if (sw->lane[i].n) n++;
+    if (!(reglist = calloc(n? n: 1, sizeof(*reglist)))) return NULL;
+    for (i = 0, n = 0; i < sw->n_lane; ++i){
+        lane = sw->lane + i;
+        if (!lane->n) continue;
+        reg = reglist + n++;
+        reg->reg = sam_hdr_tid2name(hdr, i);
+        reg->tid = i;
+        if (!(reg->intervals = malloc(lane->n * sizeof(hts_pair_pos_t)))) {hts_reglist_free(reglist, n); return NULL;}
+        reg->intervals[0].beg = lane->item[0].start;
+        reg->intervals[0].end = lane->item[0].end;
+        reg->count = 1;
+        for (j = 1; j < lane->n; ++j){
+            if (lane->item[j].start <= reg->intervals[reg->count - 1].end) {
+                reg->intervals[reg->count - 1].end = max(reg->intervals[reg->count - 1].end, lane->item[j].end);
+            } else {
+                reg->intervals[reg->count].beg = lane->item[j].start;
+                reg->intervals[reg->count++].end = lane->item[j].end;
+            }
+        }
+        reg->min_beg = reg->intervals[0].beg;
+        reg->max_end = reg->intervals[reg->count - 1].end;
+    }
+    *n_reg = n;
+    return reglist;
+}
+
+/* combine the hits of the second mate in hits with the ones of the first mate like gtf_search_any and
+ * bed_search_any, or like gtf_search_both and bed_search_both with --both-mate */
+static int sweep_pair(void *hits, void **mate_hits, int n_mate_hits, uint64_t others){
+    int i, j;
+    if (others & OPTION_GTF_MODE){
+        vec_t(exon) *v = hits;
+        for (i = 0; i < n_mate_hits; ++i) if (vec_add(exon, v, mate_hits[i]) != 0) return -1;
+        if (v->size == 0) return 0;
+        qsort(v->data, v->size, sizeof(*(v->data)), exon_search_comp);
+        if (others & OPTION_REQUIRE_BOTH_MATE){
+            for (i = 0, j = 0; j + 1 < v->size; ++j)
+                if (v->data[j]->new_tid == v->data[j + 1]->new_tid) v->data[i++] = v->data[j];
+            v->size = i;
+        } else {
+            for (i = 0, j = 1; j < v->size; ++j)
+                if (v->data[j]->new_tid != v->data[i]->new_tid) v->data[++i] = v->data[j];
+            v->size = i + 1;
+        }
+    } else {
+        vec_t(bed) *v = hits;
+        for (i = 0; i < n_mate_hits; ++i) if (vec_add(bed, v, mate_hits[i]) != 0) return -1;
+        if (v->size == 0) return 0;
+        qsort(v->data, v->size, sizeof(*(v->data)), bed_search_comp);
+        if (others & OPTION_REQUIRE_BOTH_MATE){
+            for (i = 0, j = 0; j + 1 < v->size; ++j)
+                if (v->data[j]->new_tid == v->data[j + 1]->new_tid) v->data[i++] = v->data[j];
+            v->size = i;
+        } else {
+            for (i = 0, j = 1; j < v->size; ++j)
+                if (v->data[j]->new_tid != v->data[i]->new_tid) v->data[++i] = v->data[j];
+            v->size = i + 1;
+        }
+    }
+    return 0;
+}
+
+KHASH_MAP_INIT_STR(pending, int64_t)
+
+/* a read with more than one alignment whose remaining alignments are still to come */
+typedef struct pending_t{
+    char *qname; /* NULL when the slot is free */
+    int expected;
+    int seen;
+    int status;
+    int n_mapped;
+    bam_vector_t *held1; /* mapped alignments waiting for --fix-NH, same layout as r1v and r2v */
+    bam_vector_t *held2;
+} pending_t;
+
+/* the pending reads in a ring, oldest first. When the ring is full the oldest read is flushed as it is. */
+typedef struct pending_table_t{
+    khash_t(pending) *index;
+    pending_t *ring;
+    int64_t head;
+    int64_t tail;
+    int capacity;
+    int64_t n_flushed;
+} pending_table_t;
+
+/* a mapped mate waiting for the other one */
+typedef struct mate_t{
+    char *key;
+    bam1_t *b;
+    void **hits;
+    int n_hits;
+    struct mate_t *prev;
+    struct mate_t *next;
+} mate_t;
+
+KHASH_MAP_INIT_STR(mate, mate_t *)
+
+/* the unpaired mates, oldest first. Past max_size bytes the oldest mates are spilled to n_bucket temporary bam
+ * files partitioned by query name, which are paired one at a time after the end of input. */
+typedef struct mate_table_t{
+    khash_t(mate) *index;
+    mate_t *head;
+    mate_t *tail;
+    size_t size;
+    size_t max_size;
+    char *prefix;
+    samFile **bucket;
+    int n_bucket;
+    int64_t n_spilled;
+} mate_table_t;
+
+typedef struct transmap_sorted_t{
+    transmap_out_t *out;
+    sam_hdr_t *in_hdr;
+    void *dict;
+    sweep_t *sw;
+    transmap_worker_t worker;
+    pending_table_t pending;
+    mate_table_t mates;
+    bam_vector_t *r1v;
+    bam_vector_t *r2v;
+    struct transmap_statistic *statistics;
+    struct transmap_option record_options;
+    uint64_t others;
+} transmap_sorted_t;
+
+static int pending_init(pending_table_t *table, int capacity){
+    memset(table, 0, sizeof(*table));
+    table->capacity = capacity;
+    if (!(table->index = kh_init(pending))) return -1;
+    if (!(table->ring = calloc(capacity, sizeof(pending_t)))) return -1;
+    return 0;
+}
+
+static void pending_free(pending_table_t *table){
+    int i;
+    if (table->ring){
+        for (i = 0; i < table->capacity; ++i){
+            if (table->ring[i].qname) free(table->ring[i].qname);
+            if (table->ring[i].held1) bam_vector_destroy(table->ring[i].held1);
+            if (table->ring[i].held2) bam_vector_destroy(table->ring[i].held2);
+        }
+        free(table->ring);
+    }
+    if (table->index) kh_destroy(pending, table->index);
+}
+
+static int pending_finish(transmap_sorted_t *st, pending_t *p){
+    struct transmap_statistic *statistics = st->statistics;
+    int i, n;
+    statistics->n_read_processed++;
+    if (p->n_mapped > 1) statistics->read_statistics[TRANSMAP_MULTI_MAPPED]++;
+    else statistics->read_statistics[p->status]++;
+    if (!p->held1 || !(n = p->held1->size)) return 0;
+    if (st->others & OPTION_FIX_NH){
+        if (fix_NH(p->held1->data, n) != 0) return -1;
+        if (fix_NH(p->held2->data, n) != 0) return -1;
+    }
+    for (i = 0; i < n; ++i)
+        if (transmap_out_pair(st->out, p->held1->data[i], p->held2->data[i]) != 0) return -1;
+    p->held1->size = 0;
+    p->held2->size = 0;
+    return 0;
+}
+
+static int pending_done(transmap_sorted_t *st, pending_t *p){
+    khiter_t k;
+    if (pending_finish(st, p) != 0) return -1;
+    if ((k = kh_get(pending, st->pending.index, p->qname)) != kh_end(st->pending.index)) kh_del(pending, st->pending.index, k);
+    free(p->qname);
+    p->qname = NULL;
+    return 0;
+}
+
+static pending_t *pending_get(transmap_sorted_t *st, const char *qname, int expected){
+    pending_table_t *table = &st->pending;
+    pending_t *p;
+    khiter_t k;
+    int absent;
+    if ((k = kh_get(pending, table->index, qname)) != kh_end(table->index))
+        return table->ring + kh_val(table->index, k) % table->capacity;
+    while (table->head < table->tail && !table->ring[table->head % table->capacity].qname) table->head++;
+    if (table->tail - table->head == table->capacity){
+        p = table->ring + table->head % table->capacity;
+        table->n_flushed++;
+        if (pending_done(st, p) != 0) return NULL;
+        table->head++;
+    }
+    p = table->ring + table->tail % table->capacity;
+    if (!(p->qname = strdup(qname))) return NULL;
+    k = kh_put(pending, table->index, p->qname, &absent);
+    if (absent < 0) {free(p->qname); p->qname = NULL; return NULL;}
+    kh_val(table->index, k) = table->tail++;
+    p->expected = expected;
+    p->seen = 0;
+    p->status = TRANSMAP_UNALIGNED;
+    p->n_mapped = 0;
+    if ((st->others & OPTION_FIX_NH) && !p->held1){
+        if (!(p->held1 = bam_vector_init()) || !(p->held2 = bam_vector_init())) return NULL;
+    }
+    return p;
+}
+
+static int held_add(bam_vector_t *held, bam1_t *b){
+    bam1_t *t;
+    if (!(t = bam_vector_next(held)) || !bam_copy1(t, b)) return -1;
+    held->size++;
+    return 0;
+}
+
+/* map one alignment of a read: a single-end record, a pair of mates or a mate whose mate is unmapped. The
+ * candidates are in worker.candidate unless use_index is set. */
+static int sorted_map(transmap_sorted_t *st, bam1_t **bam, int count, int use_index){
+    struct transmap_option *options = &st->record_options;
+    struct transmap_statistic record_statistics;
+    bam_vector_t *r1v = st->r1v, *r2v = st->r2v;
+    pending_t single, *p;
+    uint8_t *aux = NULL;
+    int i, ret, status, expected;
+
+    options->others = st->others & ~(OPTION_USE_INDEX | OPTION_FIX_NH);
+    if (use_index) options->others |= st->others & OPTION_USE_INDEX;
+    memset(&record_statistics, 0, sizeof(record_statistics));
+    if (is_paired(bam[0])) ret = transmap_paired(bam, count, st->dict, r1v, r2v, st->worker.candidate, &st->worker.buffer, &st->worker.buffer_size, &record_statistics, options);
+    else ret = transmap_single(bam, count, st->dict, r1v, r2v, st->worker.candidate, &st->worker.buffer, &st->worker.buffer_size, &record_statistics, options);
+    if (ret != 0) return -1;
+    st->statistics->n_align_processed += record_statistics.n_align_processed;
+    for (i = 0; i < 10; ++i) st->statistics->align_statistics[i] += record_statistics.align_statistics[i];
+    for (status = 0; status < TRANSMAP_UNALIGNED && !record_statistics.read_statistics[status]; ++status);
+    if (status == TRANSMAP_MULTI_MAPPED) status = TRANSMAP_MAPPED;
+
+    for (i = 0; i < count && !aux; ++i) if (!is_unmap(bam[i])) aux = bam_aux_get(bam[i], "NH");
+    expected = aux? bam_aux2i(aux): 1;
+    if (expected <= 1){
+        memset(&single, 0, sizeof(single));
+        single.status = status;
+        single.n_mapped = r1v->size;
+        single.held1 = r1v;
+        single.held2 = r2v;
+        if (pending_finish(st, &single) != 0) return -1;
+    } else {
+        if (!(p = pending_get(st, bam_get_qname(bam[0]), expected))) return -1;
+        p->seen++;
+        p->status = min(p->status, status);
+        p->n_mapped += r1v->size;
+        for (i = 0; i < r1v->size; ++i){
+            if (st->others & OPTION_FIX_NH){
+                if (held_add(p->held1, r1v->data[i]) != 0) return -1;
+                if (held_add(p->held2, r2v->data[i]) != 0) return -1;
+            } else if (transmap_out_pair(st->out, r1v->data[i], r2v->data[i]) != 0) return -1;
+        }
+        if (p->seen >= p->expected && pending_done(st, p) != 0) return -1;
+    }
+    r1v->size = 0;
+    r2v->size = 0;
+    return 0;
+}
+
+/* map two mates, read 1 first as transmap_paired expects */
+static int sorted_map_pair(transmap_sorted_t *st, bam1_t *b1, bam1_t *b2, int use_index){
+    bam1_t *bam[2];
+    if (is_read1(b2) && !is_read1(b1)) {bam[0] = b2; bam[1] = b1;}
+    else {bam[0] = b1; bam[1] = b2;}
+    return sorted_map(st, bam, 2, use_index);
+}
+
+/* the key of a mate is its query name, HI and the positions of both mates. A mate is looked up with its own
+ * position first and is stored with the position of its mate first, so that the two keys of a pair meet. */
+static void mate_key(bam1_t *b, int own_first, char *key, size_t key_size){
+    uint8_t *aux = bam_aux_get(b, "HI");
+    int64_t hi = aux? bam_aux2i(aux): -1;
+    if (own_first) snprintf(key, key_size, "%s\t%" PRId64 "\t%d\t%" PRId64 "\t%d\t%" PRId64, bam_get_qname(b), hi,
+                            b->core.tid, (int64_t)b->core.pos, b->core.mtid, (int64_t)b->core.mpos);
+    else snprintf(key, key_size, "%s\t%" PRId64 "\t%d\t%" PRId64 "\t%d\t%" PRId64, bam_get_qname(b), hi,
+                  b->core.mtid, (int64_t)b->core.mpos, b->core.tid, (int64_t)b->core.pos);
+}
+
+static inline int expect_mate(bam1_t *b){
+    return is_paired(b) && !is_unmap(b) && !(b->core.flag & BAM_FMUNMAP);
+}
+
+static void mate_free(mate_t *m){
+    if (m->key) free(m->key);
+    if (m->b) bam_destroy1(m->b);
+    if (m->hits) free(m->hits);
+    free(m);
+}
+
+static inline size_t mate_size(mate_t *m){
+    return sizeof(*m) + sizeof(bam1_t) + m->b->l_data + strlen(m->key) + 1 + m->n_hits * sizeof(void *);
+}
+
+static void mate_unlink(mate_table_t *table, mate_t *m){
+    khiter_t k;
+    if ((k = kh_get(mate, table->index, m->key)) != kh_end(table->index)) kh_del(mate, table->index, k);
+    if (m->prev) m->prev->next = m->next;
+    else table->head = m->next;
+    if (m->next) m->next->prev = m->prev;
+    else table->tail = m->prev;
+    table->size -= mate_size(m);
+}
+
+static int mate_init(mate_table_t *table, const char *out_file, size_t max_size, int n_bucket){
+    memset(table, 0, sizeof(*table));
+    table->max_size = max_size;
+    table->n_bucket = n_bucket;
+    if (!(table->index = kh_init(mate))) return -1;
+    if (strcmp(out_file, "-") == 0){
+        if (!(table->prefix = malloc(32))) return -1;
+        sprintf(table->prefix, "transmap.%d", (int)getpid());
+    } else if (!(table->prefix = strdup(out_file))) return -1;
+    if (!(table->bucket = calloc(n_bucket, sizeof(samFile *)))) return -1;
+    return 0;
+}
+
+static void mate_bucket_file(mate_table_t *table, int i, char *fn){
+    sprintf(fn, "%s.pair%d.tmp", table->prefix, i);
+}
+
+static void mate_free_table(mate_table_t *table){
+    mate_t *m, *next;
+    char *fn;
+    int i;
+    for (m = table->head; m; m = next) {next = m->next; mate_free(m);}
+    if (table->index) kh_destroy(mate, table->index);
+    if (table->bucket){
+        fn = table->prefix? malloc(strlen(table->prefix) + 32): NULL;
+        for (i = 0; i < table->n_bucket; ++i){
+            if (!table->bucket[i]) continue;
+            sam_close(table->bucket[i]);
+            if (fn) {mate_bucket_file(table, i, fn); remove(fn);}
+        }
+        if (fn) free(fn);
+        free(table->bucket);
+    }
+    if (table->prefix) free(table->prefix);
+}
+
+/* write a mate to the bucket of its query name */
+static int mate_spill1(transmap_sorted_t *st, bam1_t *b){
+    mate_table_t *table = &st->mates;
+    char *fn;
+    int i = __ac_X31_hash_string(bam_get_qname(b)) % table->n_bucket;
+    if (!table->bucket[i]){
+        if (!(fn = malloc(strlen(table->prefix) + 32))) return -1;
+        mate_bucket_file(table, i, fn);
+        table->bucket[i] = sam_open(fn, "wbu");
+        free(fn);
+        if (!table->bucket[i] || sam_hdr_write(table->bucket[i], st->in_hdr) != 0) {
+            fprintf(stderr, "[transmap] Error: can not open the temporary file for the unpaired mates.\n");
+            return -1;
+        }
+    }
+    if (sam_write1(table->bucket[i], st->in_hdr, b) < 0) return -1;
+    table->n_spilled++;
+    return 0;
+}
+
+static int mate_spill(transmap_sorted_t *st){
+    mate_t *m = st->mates.head;
+    if (mate_spill1(st, m->b) != 0) return -1;
+    mate_unlink(&st->mates, m);
+    mate_free(m);
+    return 0;
+}
+
+/* pair b with a waiting mate, or keep it (with its hits from the sweep line) until the mate shows up */
+static int mate_add(transmap_sorted_t *st, bam1_t *b){
+    mate_table_t *table = &st->mates;
+    mate_t *m;
+    khiter_t k;
+    char key[1024];
+    int ret, absent;
+    mate_key(b, 1, key, sizeof(key));
+    if ((k = kh_get(mate, table->index, key)) != kh_end(table->index)){
+        m = kh_val(table->index, k);
+        mate_unlink(table, m);
+        if (sweep_pair(st->worker.candidate, m->hits, m->n_hits, st->others) != 0) {mate_free(m); return -1;}
+        ret = sorted_map_pair(st, m->b, b, 0);
+        mate_free(m);
+        return ret;
+    }
+    mate_key(b, 0, key, sizeof(key));
+    /* another mate is already waiting with this key, e.g. a duplicate; leave this one to the spilled pairing */
+    if (kh_get(mate, table->index, key) != kh_end(table->index)) return mate_spill1(st, b);
+    if (!(m = calloc(1, sizeof(*m)))) return -1;
+    if (!(m->key = strdup(key)) || !(m->b = bam_dup1(b))) {mate_free(m); return -1;}
+    if (st->others & OPTION_GTF_MODE) {
+        vec_t(exon) *v = st->worker.candidate;
+        m->n_hits = v->size;
+        if (m->n_hits && !(m->hits = malloc(m->n_hits * sizeof(void *)))) {mate_free(m); return -1;}
+        if (m->n_hits) memcpy(m->hits, v->data, m->n_hits * sizeof(void *));
+    } else {
+        vec_t(bed) *v = st->worker.candidate;
+        m->n_hits = v->size;
+        if (m->n_hits && !(m->hits = malloc(m->n_hits * sizeof(void *)))) {mate_free(m); return -1;}
+        if (m->n_hits) memcpy(m->hits, v->data, m->n_hits * sizeof(void *));
+    }
+    k = kh_put(mate, table->index, m->key, &absent);
+    if (absent < 0) {mate_free(m); return -1;}
+    kh_val(table->index, k) = m;
+    m->prev = table->tail;
+    if (table->tail) table->tail->next = m;
+    else table->head = m;
+    table->tail = m;
+    table->size += mate_size(m);
+    while (table->size > table->max_size && table->head) if (mate_spill(st) != 0) return -1;
+    return 0;
+}
+
+KHASH_MAP_INIT_STR(spill, bam1_t *)
+
+static void spill_clear(khash_t(spill) *index){
+    khiter_t k;
+    for (k = 0; k < kh_end(index); ++k){
+        if (!kh_exist(index, k)) continue;
+        free((char *)kh_key(index, k));
+        bam_destroy1(kh_val(index, k));
+    }
+    kh_clear(spill, index);
+}
+
+/* pair the mates of one bucket in memory, the candidates come from the index */
+static int mate_bucket(transmap_sorted_t *st, const char *fn, khash_t(spill) *index){
+    samFile *fp;
+    sam_hdr_t *hdr = NULL;
+    bam1_t *b = NULL, *mate;
+    khiter_t k;
+    char key[1024], *new_key;
+    int ret, absent, error = -1;
+    if (!(fp = sam_open(fn, "r"))) return -1;
+    if (!(hdr = sam_hdr_read(fp))) goto clean_up;
+    while (1){
+        if (!b && !(b = bam_init1())) goto clean_up;
+        if ((ret = sam_read1(fp, hdr, b)) < -1) goto clean_up;
+        if (ret == -1) break;
+        mate_key(b, 1, key, sizeof(key));
+        if ((k = kh_get(spill, index, key)) != kh_end(index)){
+            mate = kh_val(index, k);
+            free((char *)kh_key(index, k));
+            kh_del(spill, index, k);
+            ret = sorted_map_pair(st, mate, b, 1);
+            bam_destroy1(mate);
+            if (ret != 0) goto clean_up;
+            continue;
+        }
+        mate_key(b, 0, key, sizeof(key));
+        if (kh_get(spill, index, key) != kh_end(index)){
+            if (sorted_map(st, &b, 1, 1) != 0) goto clean_up;
+            continue;
+        }
+        if (!(new_key = strdup(key))) goto clean_up;
+        k = kh_put(spill, index, new_key, &absent);
+        if (absent < 0) {free(new_key); goto clean_up;}
+        kh_val(index, k) = b;
+        b = NULL;
+    }
+    /* the mates that were never paired */
+    for (k = 0; k < kh_end(index); ++k){
+        if (!kh_exist(index, k)) continue;
+        if (sorted_map(st, &kh_val(index, k), 1, 1) != 0) goto clean_up;
+    }
+    error = 0;
+
+    clean_up:
+    spill_clear(index);
+    if (b) bam_destroy1(b);
+    if (hdr) sam_hdr_destroy(hdr);
+    sam_close(fp);
+    return error;
+}
+
+/* spill what is left and pair the spilled mates one bucket at a time */
+static int mate_finish(transmap_sorted_t *st){
+    mate_table_t *table = &st->mates;
+    khash_t(spill) *index = NULL;
+    char *fn = NULL;
+    int i, error = -1;
+    while (table->head) if (mate_spill(st) != 0) return -1;
+    if (!table->n_spilled) return 0;
+    if (!(fn = malloc(strlen(table->prefix) + 32))) return -1;
+    if (!(index = kh_init(spill))) goto clean_up;
+    for (i = 0; i < table->n_bucket; ++i){
+        if (!table->bucket[i]) continue;
+        if (sam_close(table->bucket[i]) != 0) {table->bucket[i] = NULL; goto clean_up;}
+        table->bucket[i] = NULL;
+        mate_bucket_file(table, i, fn);
+        if (mate_bucket(st, fn, index) != 0) {remove(fn); goto clean_up;}
+        remove(fn);
+    }
+    error = 0;
+
+    clean_up:
+    if (index) kh_destroy(spill, index);
+    free(fn);
+    return error;
+}
+
+int transmap_sorted_run(sam_parser_t *sam, transmap_out_t *out, void *dict, struct transmap_statistic *statistics, struct transmap_option *options){
+    transmap_sorted_t st;
+    pending_t *p;
+    bam1_t *b = NULL;
+    int64_t slot, n_incomplete = 0;
+    int ret, error = -1;
+
+    memset(&st, 0, sizeof(st));
+    st.out = out;
+    st.in_hdr = sam->hdr;
+    st.dict = dict;
+    st.statistics = statistics;
+    st.record_options = *options;
+    st.others = options->others;
+    if (transmap_worker_init(&st.worker, dict, options) != 0) goto clean_up;
+    if (!(st.sw = sweep_init(dict, sam_hdr_nref(sam->hdr), st.others))) goto clean_up;
+    if (pending_init(&st.pending, options->max_pending) != 0) goto clean_up;
+    if (st.others & OPTION_RESTRICT) {
+        hts_reglist_t *reglist;
+        int n_reg;
+        if (!(reglist = sweep_regions(st.sw, sam->hdr, &n_reg)) && n_reg < 0) goto clean_up;
+        if (sam_parser_regions(sam, reglist, n_reg) != 0) {
+            fprintf(stderr, "[transmap] Error: can not read the targets through the index of the input bam file.\n");
+            goto clean_up;
+        }
+    }
+    if (mate_init(&st.mates, options->out_file, (size_t)options->pair_memory << 20u, TRANSMAP_PAIR_BUCKETS) != 0) goto clean_up;
+    if (!(st.r1v = bam_vector_init()) || !(st.r2v = bam_vector_init())) goto clean_up;
+    if (!(b = bam_init1())) goto clean_up;
+
+    while ((ret = sam_parser_next1(sam, &b)) > 0){
+        if (b->core.flag & BAM_FSUPPLEMENTARY) continue;
+        if (!is_unmap(b) && (ret = sweep_search(st.sw, b->core.tid, b->core.pos, bam_endpos(b), st.worker.candidate)) != 0){
+            if (ret == -1) fprintf(stderr, "[transmap] Error: the input bam file is not sorted by coordinate.\n");
+            goto clean_up;
+        }
+        if (expect_mate(b)) ret = mate_add(&st, b);
+        else if (is_paired(b) && is_unmap(b) && (!(b->core.flag & BAM_FMUNMAP) || !is_read1(b))) continue; /* counted with its mate */
+        else ret = sorted_map(&st, &b, 1, 0);
+        if (ret != 0) goto clean_up;
+    }
+    if (ret < 0) {
+        fprintf(stderr, "[transmap] Error: can not read the input bam file.\n");
+        goto clean_up;
+    }
+    if (mate_finish(&st) != 0) {
+        fprintf(stderr, "[transmap] Error: can not pair the spilled mates.\n");
+        goto clean_up;
+    }
+    for (slot = st.pending.head; slot < st.pending.tail; ++slot){
+        p = st.pending.ring + slot % st.pending.capacity;
+        if (!p->qname) continue;
+        n_incomplete++;
+        if (pending_done(&st, p) != 0) goto clean_up;
+    }
+    if (st.mates.n_spilled > 0)
+        fprintf(stderr, "[transmap] %" PRId64 " mates were spilled to temporary files and paired after the end of input.\n", st.mates.n_spilled);
+    /* with --restrict the alignments outside of the targets are never seen */
+    if (!(st.others & OPTION_RESTRICT) && (st.pending.n_flushed > 0 || n_incomplete > 0))
+        fprintf(stderr, "[transmap] Warning: %" PRId64 " reads were reported before all of their alignments were seen (%" PRId64 " flushed by --max-pending, %" PRId64 " incomplete at the end of input), their NH/HI tags and read statistics may be inexact.\n",
+                st.pending.n_flushed + n_incomplete, st.pending.n_flushed, n_incomplete);
+    error = 0;
+
+    clean_up:
+    transmap_worker_destroy(&st.worker);
+    pending_free(&st.pending);
+    mate_free_table(&st.mates);
+    if (st.sw) sweep_destroy(st.sw);
+    if (st.r1v) bam_vector_destroy(st.r1v);
+    if (st.r2v) bam_vector_destroy(st.r2v);
+    if (b) bam_destroy1(b);
+    return error;
+}
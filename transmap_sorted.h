@@ -0,0 +1,81 @@
+/* The MIT License (MIT)
+
+   Copyright (c) 2023 Anrui Liu <liuar6@gmail.com>
+
+   Permission is hereby granted, free of charge, to any person obtaining
+   a copy of this software and associated documentation files (the
+   “Software”), to deal in the Software without restriction, including
+   without limitation the rights to use, copy, modify, merge, publish,
+   distribute, sublicense, and/or sell copies of the Software, and to
+   permit persons to whom the Software is furnished to do so, subject to
+   the following conditions:
+
+   The above copyright notice and this permission notice shall be
+   included in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+   EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+   MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+   NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+   BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+   ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+   CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+ */
+
+#ifndef __TRANSMAP_SORTED_H
+#define __TRANSMAP_SORTED_H
+
+#include <stdint.h>
+#include "htslib/sam.h"
+
+/* default number of multi-mapped reads waiting for their remaining alignments in coordinate-sorted mode */
+#define TRANSMAP_MAX_PENDING (1 << 20)
+/* default memory in MB for the mates waiting for their mate in coordinate-sorted mode */
+#define TRANSMAP_PAIR_MEMORY 1024
+/* number of temporary files the mates are spilled to once the memory is used up */
+#define TRANSMAP_PAIR_BUCKETS 16
+
+struct sam_parser_s;
+struct transmap_out_s;
+struct transmap_option;
+struct transmap_statistic;
+
+typedef struct sweep_item_t{
+    int32_t start;
+    int32_t end;
+    void *data; /* exon_t * in gtf mode, bed_t * in bed mode */
+} sweep_item_t;
+
+typedef struct sweep_lane_t{
+    sweep_item_t *item; /* targets of one input reference sorted by start */
+    int n;
+} sweep_lane_t;
+
+/* a sweep line over the targets for alignments sorted by coordinate. The active window holds the targets that
+ * started before the current alignment and may still overlap it or a later one. */
+typedef struct sweep_t{
+    sweep_lane_t *lane;
+    int n_lane;
+    int32_t key;
+    int32_t pos;
+    int next;
+    sweep_item_t **active;
+    int n_active;
+    int m_active;
+    uint64_t others;
+} sweep_t;
+
+sweep_t *sweep_init(void *dict, int n_key, uint64_t others);
+void sweep_destroy(sweep_t *sw);
+/* fill hits (vec_t(exon) or vec_t(bed)) like gtf_search_one and bed_search_one. Returns -1 when key and start go
+ * backwards, i.e. the input is not sorted by coordinate. */
+int sweep_search(sweep_t *sw, int32_t key, int32_t start, int32_t end, void *hits);
+
+/* map a coordinate-sorted input record by record. A mate is kept until the other mate shows up, in at most
+ * options->pair_memory MB, the rest is spilled to disk and paired at the end. Reads with more than one alignment are
+ * kept in a table of at most options->max_pending entries until all their alignments are seen, for --fix-NH and the
+ * read statistics. */
+int transmap_sorted_run(struct sam_parser_s *sam, struct transmap_out_s *out, void *dict, struct transmap_statistic *statistics, struct transmap_option *options);
+
+#endif /* __TRANSMAP_SORTED_H */
@@ -0,0 +1,342 @@
+/* The MIT License (MIT)
+
+   Copyright (c) 2023 Anrui Liu <liuar6@gmail.com>
+
+   Permission is hereby granted, free of charge, to any person obtaining
+   a copy of this software and associated documentation files (the
+   “Software”), to deal in the Software without restriction, including
+   without limitation the rights to use, copy, modify, merge, publish,
+   distribute, sublicense, and/or sell copies of the Software, and to
+   permit persons to whom the Software is furnished to do so, subject to
+   the following conditions:
+
+   The above copyright notice and this permission notice shall be
+   included in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+   EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+   MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+   NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+   BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+   ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+   CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include "htslib/sam.h"
+#include "htslib/bgzf.h"
+#include "htslib/hfile.h"
+#include "htslib/hts_endian.h"
+#include "transmap.h"
+#include "transmap_split.h"
+#include "transmap_cov.h"
+
+#define BGZF_HEADER_SIZE 18
+#define BGZF_EOF_SIZE 28
+#define BGZF_SCAN_SIZE (BGZF_MAX_BLOCK_SIZE << 2u)
+#define BAM_CORE_SIZE 36
+#define BAM_MAX_RECORD_SIZE (1 << 28)
+#define BAM_GUESS_RECORDS 4
+#define BAM_CONCAT_BUFFER_SIZE (1 << 20)
+
+static const uint8_t bgzf_eof[BGZF_EOF_SIZE] = "\037\213\010\4\0\0\0\0\0\377\6\0\102\103\2\0\033\0\3\0\0\0\0\0\0\0\0\0";
+
+static inline int bgzf_is_header(const uint8_t *s){
+    return s[0] == 31 && s[1] == 139 && s[2] == 8 && (s[3] & 4u) && s[10] == 6 && s[11] == 0 &&
+           s[12] == 'B' && s[13] == 'C' && s[14] == 2 && s[15] == 0;
+}
+
+/* find the first bgzf block starting at or after offset. A candidate header is only accepted when another block
+ * header (or the end of file) follows right after it. Returns 0 when found, 1 when no block is left and -1 on error. */
+static int bgzf_find_block(hFILE *hf, uint8_t *buf, int64_t offset, int64_t file_size, int64_t *coffset, int *isize){
+    int64_t i, n, limit, block_size;
+    while (offset < file_size){
+        if (hseek(hf, offset, SEEK_SET) < 0) return -1;
+        if ((n = hread(hf, buf, BGZF_SCAN_SIZE)) <= 0) return -1;
+        limit = (offset + n >= file_size)? n: n - BGZF_MAX_BLOCK_SIZE - BGZF_HEADER_SIZE;
+        for (i = 0; i < limit && i + BGZF_HEADER_SIZE <= n; ++i){
+            if (!bgzf_is_header(buf + i)) continue;
+            block_size = le_to_u16(buf + i + 16) + 1;
+            if (offset + i + block_size > file_size) continue;
+            if (offset + i + block_size < file_size && (i + block_size + BGZF_HEADER_SIZE > n || !bgzf_is_header(buf + i + block_size))) continue;
+            *coffset = offset + i;
+            *isize = le_to_u32(buf + i + block_size - 4);
+            return 0;
+        }
+        if (offset + n >= file_size) break;
+        offset += limit;
+    }
+    return 1;
+}
+
+/* sanity check of a bam record starting at s, only len bytes of which are available */
+static int bam_check_record(const uint8_t *s, int64_t len, int32_t n_targets){
+    int32_t block_size, tid, pos, l_seq, mtid, mpos;
+    uint32_t l_qname, n_cigar, i;
+    if (len < BAM_CORE_SIZE) return 0;
+    block_size = le_to_i32(s);
+    tid = le_to_i32(s + 4);
+    pos = le_to_i32(s + 8);
+    l_qname = s[12];
+    n_cigar = le_to_u16(s + 16);
+    l_seq = le_to_i32(s + 20);
+    mtid = le_to_i32(s + 24);
+    mpos = le_to_i32(s + 28);
+    if (block_size < BAM_CORE_SIZE - 4 || block_size > BAM_MAX_RECORD_SIZE) return 0;
+    if (tid < -1 || tid >= n_targets || mtid < -1 || mtid >= n_targets || pos < -1 || mpos < -1) return 0;
+    if (l_qname < 2 || l_seq < 0) return 0;
+    if ((int64_t)BAM_CORE_SIZE - 4 + l_qname + (n_cigar << 2u) + ((l_seq + 1) >> 1) + l_seq > block_size) return 0;
+    if (len < BAM_CORE_SIZE + l_qname) return 1;
+    for (i = 0; i < l_qname - 1; ++i)
+        if (s[BAM_CORE_SIZE + i] < '!' || s[BAM_CORE_SIZE + i] > '~') return 0;
+    return s[BAM_CORE_SIZE + l_qname - 1] == '\0';
+}
+
+/* confirm a candidate record boundary by decoding the following records from the stream */
+static int bam_confirm_record(BGZF *fp, bam1_t *b, int64_t voffset, int32_t n_targets){
+    uint8_t core[BAM_CORE_SIZE];
+    int64_t t;
+    ssize_t n;
+    int i;
+    if (bgzf_seek(fp, voffset, SEEK_SET) < 0) return 0;
+    for (i = 0; i < BAM_GUESS_RECORDS; ++i){
+        t = bgzf_tell(fp);
+        if ((n = bgzf_read(fp, core, BAM_CORE_SIZE)) == 0) return i > 0;
+        if (n != BAM_CORE_SIZE || !bam_check_record(core, BAM_CORE_SIZE, n_targets)) return 0;
+        if (bgzf_seek(fp, t, SEEK_SET) < 0 || bam_read1(fp, b) < 0) return 0;
+    }
+    return 1;
+}
+
+/* move from a record boundary to the first record of the next query-name group */
+static int bam_next_group(BGZF *fp, bam1_t *b, int64_t voffset, int64_t *split){
+    char *qname;
+    int64_t t;
+    int ret;
+    if (bgzf_seek(fp, voffset, SEEK_SET) < 0 || bam_read1(fp, b) < 0) return -1;
+    if (!(qname = strdup(bam_get_qname(b)))) return -1;
+    while (1){
+        t = bgzf_tell(fp);
+        if ((ret = bam_read1(fp, b)) < 0) break;
+        if (strcmp(qname, bam_get_qname(b)) != 0) break;
+    }
+    free(qname);
+    if (ret < -1) return -1;
+    if (ret == -1) return 1;
+    *split = t;
+    return 0;
+}
+
+static int bam_split_find(BGZF *fp, hFILE *hf, bam1_t *b, uint8_t *buf, int32_t n_targets, int64_t offset, int64_t first, int64_t file_size, int64_t *split){
+    int64_t coffset, u;
+    int isize, ret;
+    while ((ret = bgzf_find_block(hf, buf, offset, file_size, &coffset, &isize)) == 0){
+        offset = coffset + 1;
+        if (isize <= 0 || bgzf_seek(fp, coffset << 16u, SEEK_SET) < 0) continue;
+        if (bgzf_read(fp, buf, isize) != isize) return -1;
+        u = (coffset == first >> 16u)? first & 0xffff: 0;
+        for (; u < isize; ++u){
+            if (!bam_check_record(buf + u, isize - u, n_targets)) continue;
+            if (bam_confirm_record(fp, b, coffset << 16u | u, n_targets)) return bam_next_group(fp, b, coffset << 16u | u, split);
+        }
+    }
+    return ret;
+}
+
+int bam_split_plan(const char *fn, int n_split, int64_t *offsets){
+    BGZF *fp = NULL;
+    hFILE *hf = NULL;
+    bam_hdr_t *hdr = NULL;
+    bam1_t *b = NULL;
+    uint8_t *buf = NULL;
+    int64_t file_size, offset, split;
+    int k, n_range = -1, ret;
+    if (!(fp = bgzf_open(fn, "r"))) goto clean_up;
+    if (!(hf = hopen(fn, "r"))) goto clean_up;
+    if (!(hdr = bam_hdr_read(fp))) goto clean_up;
+    if (!(b = bam_init1())) goto clean_up;
+    if (!(buf = malloc(BGZF_SCAN_SIZE))) goto clean_up;
+    if ((file_size = hseek(hf, 0, SEEK_END)) < 0) goto clean_up;
+    offsets[0] = bgzf_tell(fp);
+    n_range = 1;
+    for (k = 1; k < n_split; ++k){
+        offset = file_size / n_split * k;
+        if (offset <= offsets[n_range - 1] >> 16u) offset = (offsets[n_range - 1] >> 16u) + 1;
+        if ((ret = bam_split_find(fp, hf, b, buf, hdr->n_targets, offset, offsets[0], file_size, &split)) < 0) {n_range = -1; goto clean_up;}
+        if (ret > 0) break;
+        if (split > offsets[n_range - 1]) offsets[n_range++] = split;
+    }
+    offsets[n_range] = -1;
+
+    clean_up:
+    if (buf) free(buf);
+    if (b) bam_destroy1(b);
+    if (hdr) bam_hdr_destroy(hdr);
+    if (hf) hclose(hf);
+    if (fp) bgzf_close(fp);
+    return n_range;
+}
+
+int bam_concat(BGZF *out, const char *fn, int has_header){
+    BGZF *in = NULL;
+    hFILE *hf = NULL;
+    bam_hdr_t *hdr = NULL;
+    bam1_t *b = NULL;
+    uint8_t *buf = NULL;
+    int64_t start = 0, end;
+    ssize_t n;
+    int ret = -1;
+    if (has_header){
+        if (!(in = bgzf_open(fn, "r"))) goto clean_up;
+        if (!(hdr = bam_hdr_read(in))) goto clean_up;
+        if (!(b = bam_init1())) goto clean_up;
+        /* records sharing the last block of the header are re-encoded, the following blocks are copied as they are */
+        while (bgzf_tell(in) & 0xffff){
+            if ((n = bam_read1(in, b)) < -1) goto clean_up;
+            if (n == -1) break;
+            if (bam_write1(out, b) < 0) goto clean_up;
+        }
+        start = bgzf_tell(in) >> 16u;
+    }
+    if (bgzf_flush(out) < 0) goto clean_up;
+    if (!(buf = malloc(BAM_CONCAT_BUFFER_SIZE))) goto clean_up;
+    if (!(hf = hopen(fn, "r"))) goto clean_up;
+    if ((end = hseek(hf, 0, SEEK_END)) < 0) goto clean_up;
+    if (end - start >= BGZF_EOF_SIZE){
+        if (hseek(hf, end - BGZF_EOF_SIZE, SEEK_SET) < 0 || hread(hf, buf, BGZF_EOF_SIZE) != BGZF_EOF_SIZE) goto clean_up;
+        if (memcmp(buf, bgzf_eof, BGZF_EOF_SIZE) == 0) end -= BGZF_EOF_SIZE;
+    }
+    if (hseek(hf, start, SEEK_SET) < 0) goto clean_up;
+    while (start < end){
+        n = end - start < BAM_CONCAT_BUFFER_SIZE? end - start: BAM_CONCAT_BUFFER_SIZE;
+        if (hread(hf, buf, n) != n || bgzf_raw_write(out, buf, n) != n) goto clean_up;
+        start += n;
+    }
+    ret = 0;
+
+    clean_up:
+    if (buf) free(buf);
+    if (hf) hclose(hf);
+    if (b) bam_destroy1(b);
+    if (hdr) bam_hdr_destroy(hdr);
+    if (in) bgzf_close(in);
+    return ret;
+}
+
+typedef struct split_task_t{
+    const char *in_file;
+    char *seg_file;
+    int64_t start;
+    int64_t end;
+    sam_hdr_t *hdr;
+    void *dict;
+    htsThreadPool *tpool;
+    struct transmap_option *options;
+    struct transmap_statistic statistics;
+    cov_t *cov;
+    int ret;
+} split_task_t;
+
+static void *split_worker(void *arg){
+    split_task_t *task = arg;
+    sam_parser_t *sam = NULL;
+    samFile *seg = NULL;
+    transmap_out_t seg_out = {0};
+    transmap_batch_t *batch = NULL;
+    transmap_worker_t worker;
+    int ret;
+    memset(&worker, 0, sizeof(worker));
+    task->ret = -1;
+    if (!(sam = sam_parser_open(task->in_file, task->tpool, task->options->io_backend))) goto clean_up;
+    if (sam_parser_range(sam, task->start, task->end) != 0) goto clean_up;
+    /* the segments carry no header, they are joined behind the header of the final output */
+    if (!(seg = sam_open(task->seg_file, "wb"))) goto clean_up;
+    if (task->tpool->pool && hts_set_opt(seg, HTS_OPT_THREAD_POOL, task->tpool) != 0) goto clean_up;
+    seg_out.fp = seg;
+    seg_out.hdr = task->hdr;
+    seg_out.keep_tags = task->options->keep_tags;
+    seg_out.cov = task->cov;
+    if (transmap_worker_init(&worker, task->dict, task->options) != 0) goto clean_up;
+    if (!(batch = transmap_batch_init())) goto clean_up;
+    while ((ret = transmap_batch_read(sam, batch, TRANSMAP_BATCH_SIZE)) > 0){
+        if (transmap_batch_map(batch, &worker, task->options) != 0) goto clean_up;
+        if (transmap_batch_write(batch, &seg_out) != 0) goto clean_up;
+        transmap_batch_clear(batch);
+    }
+    if (ret < 0) goto clean_up;
+    task->statistics = worker.statistics;
+    task->ret = 0;
+
+    clean_up:
+    transmap_worker_destroy(&worker);
+    if (batch) transmap_batch_destroy(batch);
+    if (seg && sam_close(seg) != 0) task->ret = -1;
+    if (sam) sam_parser_close(sam);
+    return NULL;
+}
+
+int transmap_split_run(const char *in_file, const char *out_file, sam_hdr_t *hdr, void *dict, htsThreadPool *tpool, cov_t *cov, struct transmap_statistic *statistics, struct transmap_option *options){
+    int64_t *offsets = NULL;
+    split_task_t *tasks = NULL;
+    pthread_t *threads = NULL;
+    BGZF *out = NULL;
+    int i, n_range, n_started = 0, ret = -1;
+    if (!(offsets = malloc((options->n_split + 1) * sizeof(*offsets)))) goto clean_up;
+    if ((n_range = bam_split_plan(in_file, options->n_split, offsets)) < 0){
+        fprintf(stderr, "[transmap] Error: can not split the input bam file.\n");
+        n_range = 0;
+        goto clean_up;
+    }
+    if (!(tasks = calloc(n_range, sizeof(*tasks)))) goto clean_up;
+    if (!(threads = calloc(n_range, sizeof(*threads)))) goto clean_up;
+    for (i = 0; i < n_range; ++i){
+        tasks[i].in_file = in_file;
+        tasks[i].start = offsets[i];
+        tasks[i].end = offsets[i + 1];
+        tasks[i].hdr = hdr;
+        tasks[i].dict = dict;
+        tasks[i].tpool = tpool;
+        tasks[i].options = options;
+        if (cov && !(tasks[i].cov = cov_init(hdr))) goto clean_up;
+        if (!(tasks[i].seg_file = malloc(strlen(out_file) + 32))) goto clean_up;
+        sprintf(tasks[i].seg_file, "%s.split%d.tmp", out_file, i);
+    }
+    for (n_started = 0; n_started < n_range; ++n_started)
+        if (pthread_create(threads + n_started, NULL, split_worker, tasks + n_started) != 0) break;
+    for (i = 0; i < n_started; ++i) pthread_join(threads[i], NULL);
+    if (n_started != n_range) goto clean_up;
+    for (i = 0; i < n_range; ++i){
+        if (tasks[i].ret != 0){
+            fprintf(stderr, "[transmap] Error: can not process the range %d of the input bam file.\n", i);
+            goto clean_up;
+        }
+    }
+
+    if (!(out = bgzf_open(out_file, "w"))) goto clean_up;
+    if (bam_hdr_write(out, hdr) != 0) goto clean_up;
+    for (i = 0; i < n_range; ++i)
+        if (bam_concat(out, tasks[i].seg_file, 0) != 0) goto clean_up;
+    for (i = 0; i < n_range; ++i) transmap_statistic_merge(statistics, &tasks[i].statistics);
+    if (cov) for (i = 0; i < n_range; ++i) if (cov_merge(cov, tasks[i].cov) != 0) goto clean_up;
+    ret = 0;
+
+    clean_up:
+    if (out && bgzf_close(out) != 0) ret = -1;
+    if (ret != 0) fprintf(stderr, "[transmap] Error: can not join the splits into the output bam file.\n");
+    if (tasks){
+        for (i = 0; i < n_range; ++i){
+            if (tasks[i].cov) cov_destroy(tasks[i].cov);
+            if (!tasks[i].seg_file) continue;
+            remove(tasks[i].seg_file);
+            free(tasks[i].seg_file);
+        }
+        free(tasks);
+    }
+    if (threads) free(threads);
+    if (offsets) free(offsets);
+    return ret;
+}
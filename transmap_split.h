@@ -0,0 +1,51 @@
+/* The MIT License (MIT)
+
+   Copyright (c) 2023 Anrui Liu <liuar6@gmail.com>
+
+   Permission is hereby granted, free of charge, to any person obtaining
+   a copy of this software and associated documentation files (the
+   “Software”), to deal in the Software without restriction, including
+   without limitation the rights to use, copy, modify, merge, publish,
+   distribute, sublicense, and/or sell copies of the Software, and to
+   permit persons to whom the Software is furnished to do so, subject to
+   the following conditions:
+
+   The above copyright notice and this permission notice shall be
+   included in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+   EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+   MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+   NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+   BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+   ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+   CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+ */
+
+#ifndef __TRANSMAP_SPLIT_H
+#define __TRANSMAP_SPLIT_H
+
+#include "htslib/sam.h"
+#include "htslib/bgzf.h"
+#include "htslib/thread_pool.h"
+
+struct transmap_option;
+struct transmap_statistic;
+struct cov_s;
+
+/* cut a bam file sorted (or grouped) by query name into at most n_split ranges of similar compressed size. On return,
+ * range i spans the virtual offsets [offsets[i], offsets[i + 1]) and the last offset is -1 (end of file), so offsets
+ * should have room for n_split + 1 values. Every range starts at the first record of a query-name group. Returns the
+ * number of ranges, which is smaller than n_split when the file is too small, or -1 on error. */
+int bam_split_plan(const char *fn, int n_split, int64_t *offsets);
+
+/* append the records of the bam file fn to out without recompressing them. The header of fn is skipped when
+ * has_header is set; the EOF marker of fn is always dropped. */
+int bam_concat(BGZF *out, const char *fn, int has_header);
+
+/* map each range of the input on its own thread and join the results into out_file. The coverage of each range is
+ * added to cov when it is not NULL. */
+int transmap_split_run(const char *in_file, const char *out_file, sam_hdr_t *hdr, void *dict, htsThreadPool *tpool, struct cov_s *cov, struct transmap_statistic *statistics, struct transmap_option *options);
+
+#endif /* __TRANSMAP_SPLIT_H */
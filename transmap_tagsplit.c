@@ -0,0 +1,222 @@
+/* The MIT License (MIT)
+
+   Copyright (c) 2023 Anrui Liu <liuar6@gmail.com>
+
+   Permission is hereby granted, free of charge, to any person obtaining
+   a copy of this software and associated documentation files (the
+   “Software”), to deal in the Software without restriction, including
+   without limitation the rights to use, copy, modify, merge, publish,
+   distribute, sublicense, and/or sell copies of the Software, and to
+   permit persons to whom the Software is furnished to do so, subject to
+   the following conditions:
+
+   The above copyright notice and this permission notice shall be
+   included in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+   EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+   MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+   NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+   BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+   ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+   CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "htslib/sam.h"
+#include "htslib/bgzf.h"
+#include "htslib/hfile.h"
+#include "htslib/khash.h"
+#include "transmap_bam.h"
+#include "transmap_tagsplit.h"
+
+typedef struct {
+    char *fn;
+    BGZF *fp;        /* NULL when closed */
+    int64_t used;    /* tick of the last write, for the LRU */
+    int started;     /* the file was created and holds the header */
+    bam_vector_t *buf;
+} tag_out_t;
+
+KHASH_MAP_INIT_STR(tag_out, int32_t)
+
+struct tag_split_s{
+    char *prefix;
+    char tag[2];
+    sam_hdr_t *hdr;
+    htsThreadPool *tpool;
+    int max_open;
+    int n_open;
+    int64_t tick;
+    khash_t(tag_out) *index;
+    tag_out_t *out;
+    int32_t n_out;
+    int32_t m_out;
+    int32_t untagged; /* index of the output of the untagged records, -1 until needed */
+};
+
+static int tag_out_close(tag_split_t *ts, tag_out_t *o){
+    int ret = bgzf_close(o->fp);
+    o->fp = NULL;
+    ts->n_open--;
+    return ret;
+}
+
+/* open the file of o, creating it with the header on first use and appending to it afterwards */
+static int tag_out_open(tag_split_t *ts, tag_out_t *o){
+    hFILE *hf;
+    int i, lru = -1;
+    if (ts->n_open >= ts->max_open){
+        for (i = 0; i < ts->n_out; ++i)
+            if (ts->out[i].fp && (lru < 0 || ts->out[i].used < ts->out[lru].used)) lru = i;
+        if (lru >= 0 && tag_out_close(ts, ts->out + lru) != 0) return -1;
+    }
+    if (!(hf = hopen(o->fn, o->started? "a": "w"))) return -1;
+    if (!(o->fp = bgzf_hopen(hf, "w"))) {
+        hclose_abruptly(hf);
+        return -1;
+    }
+    ts->n_open++;
+    if (ts->tpool && ts->tpool->pool && bgzf_thread_pool(o->fp, ts->tpool->pool, ts->tpool->qsize) != 0) return -1;
+    if (!o->started){
+        if (bam_hdr_write(o->fp, ts->hdr) != 0) return -1;
+        o->started = 1;
+    }
+    return 0;
+}
+
+static int tag_out_flush(tag_split_t *ts, tag_out_t *o){
+    size_t i;
+    if (o->buf->size == 0) return 0;
+    if (!o->fp && tag_out_open(ts, o) != 0) return -1;
+    for (i = 0; i < o->buf->size; ++i)
+        if (bam_write1(o->fp, o->buf->data[i]) < 0) return -1;
+    o->buf->size = 0;
+    return 0;
+}
+
+/* <prefix>.<value>.bam, or <prefix>.bam without a value. The value is kept apart from the directories. */
+static char *tag_out_name(const char *prefix, const char *value){
+    char *fn, *p;
+    if (!(fn = malloc(strlen(prefix) + (value? strlen(value) + 1: 0) + 5))) return NULL;
+    if (!value) {
+        sprintf(fn, "%s.bam", prefix);
+        return fn;
+    }
+    sprintf(fn, "%s.%s.bam", prefix, value);
+    for (p = fn + strlen(prefix) + 1; *p; ++p) if (*p == '/') *p = '_';
+    return fn;
+}
+
+static int32_t tag_out_add(tag_split_t *ts, const char *value){
+    tag_out_t *o;
+    if (ts->n_out == ts->m_out){
+        int32_t m = ts->m_out? ts->m_out << 1: 16;
+        tag_out_t *new_out = realloc(ts->out, m * sizeof(*new_out));
+        if (!new_out) return -1;
+        ts->out = new_out;
+        ts->m_out = m;
+    }
+    o = ts->out + ts->n_out;
+    memset(o, 0, sizeof(*o));
+    if (!(o->fn = tag_out_name(ts->prefix, value))) return -1;
+    if (!(o->buf = bam_vector_init())) {
+        free(o->fn);
+        return -1;
+    }
+    return ts->n_out++;
+}
+
+static int32_t tag_out_get(tag_split_t *ts, const bam1_t *b){
+    const uint8_t *s = bam_aux_get(b, ts->tag);
+    char a[2] = {0, 0};
+    const char *value;
+    khiter_t k;
+    char *key;
+    int32_t i;
+    int absent;
+    if (s && *s == 'Z') value = bam_aux2Z(s);
+    else if (s && *s == 'A') {
+        a[0] = bam_aux2A(s);
+        value = a;
+    } else {
+        if (ts->untagged < 0) ts->untagged = tag_out_add(ts, NULL);
+        return ts->untagged;
+    }
+    k = kh_get(tag_out, ts->index, value);
+    if (k != kh_end(ts->index)) return kh_val(ts->index, k);
+    if (!(key = strdup(value))) return -1;
+    k = kh_put(tag_out, ts->index, key, &absent);
+    if (absent < 0 || (i = tag_out_add(ts, value)) < 0) {
+        if (absent >= 0) kh_del(tag_out, ts->index, k);
+        free(key);
+        return -1;
+    }
+    kh_val(ts->index, k) = i;
+    return i;
+}
+
+int tag_split_write(tag_split_t *ts, bam1_t *b, const uint8_t *keep_tags){
+    tag_out_t *o;
+    bam1_t *b1;
+    int32_t i;
+    if ((i = tag_out_get(ts, b)) < 0) return -1;
+    o = ts->out + i;
+    o->used = ++ts->tick;
+    if (keep_tags && bam_aux_keep(b, keep_tags) != 0) return -1;
+    if (o->fp) return bam_write1(o->fp, b) < 0? -1: 0;
+    if (!(b1 = bam_vector_next(o->buf)) || !bam_copy1(b1, b)) return -1;
+    o->buf->size++;
+    if (o->buf->size >= TRANSMAP_TAG_SPLIT_BUFFER) return tag_out_flush(ts, o);
+    return 0;
+}
+
+tag_split_t *tag_split_init(const char *prefix, const char *tag, sam_hdr_t *hdr, int max_open, htsThreadPool *tpool){
+    tag_split_t *ts;
+    if (!(ts = calloc(1, sizeof(*ts)))) return NULL;
+    ts->tag[0] = tag[0];
+    ts->tag[1] = tag[1];
+    ts->hdr = hdr;
+    ts->tpool = tpool;
+    ts->max_open = max_open > 0? max_open: 1;
+    ts->untagged = -1;
+    if (!(ts->prefix = strdup(prefix))) goto clean_up;
+    if (!(ts->index = kh_init(tag_out))) goto clean_up;
+    return ts;
+
+    clean_up:
+    tag_split_destroy(ts);
+    return NULL;
+}
+
+int tag_split_finish(tag_split_t *ts){
+    int32_t i;
+    int ret = 0;
+    for (i = 0; i < ts->n_out; ++i){
+        if (tag_out_flush(ts, ts->out + i) != 0) ret = -1;
+        if (ts->out[i].fp && tag_out_close(ts, ts->out + i) != 0) ret = -1;
+    }
+    return ret;
+}
+
+void tag_split_destroy(tag_split_t *ts){
+    int32_t i;
+    khiter_t k;
+    if (!ts) return;
+    for (i = 0; i < ts->n_out; ++i){
+        if (ts->out[i].fp) bgzf_close(ts->out[i].fp);
+        bam_vector_destroy(ts->out[i].buf);
+        free(ts->out[i].fn);
+    }
+    free(ts->out);
+    if (ts->index){
+        for (k = 0; k < kh_end(ts->index); ++k)
+            if (kh_exist(ts->index, k)) free((char *)kh_key(ts->index, k));
+        kh_destroy(tag_out, ts->index);
+    }
+    free(ts->prefix);
+    free(ts);
+}
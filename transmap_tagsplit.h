@@ -0,0 +1,49 @@
+/* The MIT License (MIT)
+
+   Copyright (c) 2023 Anrui Liu <liuar6@gmail.com>
+
+   Permission is hereby granted, free of charge, to any person obtaining
+   a copy of this software and associated documentation files (the
+   “Software”), to deal in the Software without restriction, including
+   without limitation the rights to use, copy, modify, merge, publish,
+   distribute, sublicense, and/or sell copies of the Software, and to
+   permit persons to whom the Software is furnished to do so, subject to
+   the following conditions:
+
+   The above copyright notice and this permission notice shall be
+   included in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+   EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+   MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+   NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+   BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+   ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+   CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+ */
+
+#ifndef __TRANSMAP_TAGSPLIT_H
+#define __TRANSMAP_TAGSPLIT_H
+
+#include "htslib/sam.h"
+#include "htslib/thread_pool.h"
+
+/* files kept open at once by default */
+#define TRANSMAP_TAG_SPLIT_OPEN 64
+/* records held for a value whose file is closed */
+#define TRANSMAP_TAG_SPLIT_BUFFER 64
+
+typedef struct tag_split_s tag_split_t;
+
+/* write the records with each value of tag to <prefix>.<value>.bam, the records without the tag (or with a tag of
+ * another type than Z or A) to <prefix>.bam. At most max_open files are kept open; the others are reopened
+ * for appending when their buffer is full, closing the least recently used one. */
+tag_split_t *tag_split_init(const char *prefix, const char *tag, sam_hdr_t *hdr, int max_open, htsThreadPool *tpool);
+/* route b by its tag value, then apply keep_tags to it when not NULL */
+int tag_split_write(tag_split_t *ts, bam1_t *b, const uint8_t *keep_tags);
+/* flush the buffers and close the files */
+int tag_split_finish(tag_split_t *ts);
+void tag_split_destroy(tag_split_t *ts);
+
+#endif /* __TRANSMAP_TAGSPLIT_H */
@@ -0,0 +1,142 @@
+/* The MIT License (MIT)
+
+   Copyright (c) 2023 Anrui Liu <liuar6@gmail.com>
+
+   Permission is hereby granted, free of charge, to any person obtaining
+   a copy of this software and associated documentation files (the
+   “Software”), to deal in the Software without restriction, including
+   without limitation the rights to use, copy, modify, merge, publish,
+   distribute, sublicense, and/or sell copies of the Software, and to
+   permit persons to whom the Software is furnished to do so, subject to
+   the following conditions:
+
+   The above copyright notice and this permission notice shall be
+   included in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+   EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+   MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+   NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+   BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+   ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+   CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include "htslib/sam.h"
+#include "htslib/khash.h"
+#include "transmap_tcc.h"
+
+/* a class is stored as its size followed by its sorted target ids */
+static inline khint_t tcc_hash(const int32_t *ec){
+    khint_t h = 2166136261u;
+    for (int32_t i = 0; i <= ec[0]; ++i) h = (h ^ (khint_t)ec[i]) * 16777619u;
+    return h;
+}
+
+#define tcc_equal(a, b) ((a)[0] == (b)[0] && memcmp((a) + 1, (b) + 1, (a)[0] * sizeof(int32_t)) == 0)
+
+KHASH_INIT(tcc, const int32_t *, size_t, 1, tcc_hash, tcc_equal)
+
+struct tcc_s{
+    khash_t(tcc) *index;
+    int32_t **ec;
+    int64_t *count;
+    size_t n_ec;
+    size_t m_ec;
+    int32_t *key; /* class of the current read */
+    size_t m_key;
+};
+
+tcc_t *tcc_init(){
+    tcc_t *t;
+    if (!(t = calloc(1, sizeof(*t)))) return NULL;
+    if (!(t->index = kh_init(tcc))) {
+        free(t);
+        return NULL;
+    }
+    return t;
+}
+
+static int tcc_comp(const void *a, const void *b){
+    int32_t x = *(const int32_t *)a, y = *(const int32_t *)b;
+    return (x > y) - (x < y);
+}
+
+int tcc_add(tcc_t *t, bam1_t **r1, bam1_t **r2, int n){
+    int32_t *key, tid;
+    int i, k = 0, absent;
+    khint_t itr;
+    if (n == 0) return 0;
+    if ((size_t)n + 1 > t->m_key){
+        if (!(key = realloc(t->key, (n + 1) * sizeof(*key)))) return -1;
+        t->key = key;
+        t->m_key = n + 1;
+    }
+    key = t->key;
+    for (i = 0; i < n; ++i){
+        tid = r1[i]->core.tid >= 0? r1[i]->core.tid: r2[i]->core.tid;
+        if (tid >= 0) key[++k] = tid;
+    }
+    if (k == 0) return 0;
+    qsort(key + 1, k, sizeof(*key), tcc_comp);
+    for (i = 2, n = 1; i <= k; ++i) if (key[i] != key[n]) key[++n] = key[i];
+    key[0] = n;
+
+    if ((itr = kh_get(tcc, t->index, key)) != kh_end(t->index)) {
+        t->count[kh_val(t->index, itr)]++;
+        return 0;
+    }
+    if (t->n_ec == t->m_ec){
+        size_t m = t->m_ec? t->m_ec << 1u: 1024;
+        int32_t **ec = realloc(t->ec, m * sizeof(*ec));
+        if (!ec) return -1;
+        t->ec = ec;
+        int64_t *count = realloc(t->count, m * sizeof(*count));
+        if (!count) return -1;
+        t->count = count;
+        t->m_ec = m;
+    }
+    if (!(t->ec[t->n_ec] = malloc((n + 1) * sizeof(*key)))) return -1;
+    memcpy(t->ec[t->n_ec], key, (n + 1) * sizeof(*key));
+    itr = kh_put(tcc, t->index, t->ec[t->n_ec], &absent);
+    if (absent < 0) {
+        free(t->ec[t->n_ec]);
+        return -1;
+    }
+    kh_val(t->index, itr) = t->n_ec;
+    t->count[t->n_ec++] = 1;
+    return 0;
+}
+
+int tcc_write(tcc_t *t, const char *fn, sam_hdr_t *hdr){
+    FILE *f;
+    size_t i;
+    int32_t j;
+    int ret = 0;
+    if (!(f = strcmp(fn, "-") == 0? stdout: fopen(fn, "w"))) return -1;
+    for (j = 0; j < sam_hdr_nref(hdr); ++j) fprintf(f, "#target\t%d\t%s\n", j, sam_hdr_tid2name(hdr, j));
+    for (i = 0; i < t->n_ec; ++i){
+        fprintf(f, "%zu\t%" PRId64 "\t", i, t->count[i]);
+        for (j = 1; j <= t->ec[i][0]; ++j) fprintf(f, j > 1? ",%d": "%d", t->ec[i][j]);
+        fputc('\n', f);
+    }
+    if (ferror(f)) ret = -1;
+    if (f != stdout && fclose(f) != 0) ret = -1;
+    else if (f == stdout && fflush(f) != 0) ret = -1;
+    return ret;
+}
+
+void tcc_destroy(tcc_t *t){
+    if (!t) return;
+    for (size_t i = 0; i < t->n_ec; ++i) free(t->ec[i]);
+    free(t->ec);
+    free(t->count);
+    free(t->key);
+    kh_destroy(tcc, t->index);
+    free(t);
+}
@@ -0,0 +1,41 @@
+/* The MIT License (MIT)
+
+   Copyright (c) 2023 Anrui Liu <liuar6@gmail.com>
+
+   Permission is hereby granted, free of charge, to any person obtaining
+   a copy of this software and associated documentation files (the
+   “Software”), to deal in the Software without restriction, including
+   without limitation the rights to use, copy, modify, merge, publish,
+   distribute, sublicense, and/or sell copies of the Software, and to
+   permit persons to whom the Software is furnished to do so, subject to
+   the following conditions:
+
+   The above copyright notice and this permission notice shall be
+   included in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+   EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+   MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+   NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+   BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+   ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+   CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+ */
+
+#ifndef __TRANSMAP_TCC_H
+#define __TRANSMAP_TCC_H
+
+#include "htslib/sam.h"
+
+typedef struct tcc_s tcc_t;
+
+/* count the reads of each equivalence class, the set of targets a read is compatible with */
+tcc_t *tcc_init();
+/* add a read from its n mapped hits, r1 and r2 as in the r1v and r2v of a batch */
+int tcc_add(tcc_t *t, bam1_t **r1, bam1_t **r2, int n);
+/* write the targets of hdr followed by the classes in the order they were first seen */
+int tcc_write(tcc_t *t, const char *fn, sam_hdr_t *hdr);
+void tcc_destroy(tcc_t *t);
+
+#endif /* __TRANSMAP_TCC_H */
@@ -0,0 +1,336 @@
+/* The MIT License (MIT)
+
+   Copyright (c) 2023 Anrui Liu <liuar6@gmail.com>
+
+   Permission is hereby granted, free of charge, to any person obtaining
+   a copy of this software and associated documentation files (the
+   “Software”), to deal in the Software without restriction, including
+   without limitation the rights to use, copy, modify, merge, publish,
+   distribute, sublicense, and/or sell copies of the Software, and to
+   permit persons to whom the Software is furnished to do so, subject to
+   the following conditions:
+
+   The above copyright notice and this permission notice shall be
+   included in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+   EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+   MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+   NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+   BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+   ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+   CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include "htslib/sam.h"
+#include "htslib/hfile.h"
+#include "htslib/kstring.h"
+#include "htslib/hts_endian.h"
+#include "transmap_bam.h"
+#include "transmap_text.h"
+
+struct sam_text_s{
+    samFile *fp;
+    sam_hdr_t *hdr;
+    const char **name;
+    size_t *name_len;
+    int n_ref;
+    char *buf;
+    size_t l;
+    size_t m;
+    kstring_t ks; /* records with float or array tags are formatted by sam_format1() */
+    /* formatting thread */
+    int use_thread;
+    int started;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t has_chunk;
+    pthread_cond_t has_free;
+    bam_vector_t *vec[2];
+    int cur;              /* vector being filled by the caller */
+    bam_vector_t *chunk;  /* vector being formatted by the thread, NULL when the thread is idle */
+    int done;
+    int error;
+};
+
+static char text_seq2[256][2];
+static pthread_once_t text_seq2_once = PTHREAD_ONCE_INIT;
+
+static void text_seq2_init(void){
+    for (int i = 0; i < 256; ++i){
+        text_seq2[i][0] = seq_nt16_str[i >> 4];
+        text_seq2[i][1] = seq_nt16_str[i & 15];
+    }
+}
+
+static int text_flush(sam_text_t *t){
+    if (t->l == 0) return 0;
+    if (hwrite(t->fp->fp.hfile, t->buf, t->l) != (ssize_t)t->l) return -1;
+    t->l = 0;
+    return 0;
+}
+
+/* make room for needed more bytes in the buffer */
+static int text_reserve(sam_text_t *t, size_t needed){
+    if (t->l + needed <= t->m) return 0;
+    if (text_flush(t) != 0) return -1;
+    if (needed > t->m){
+        char *new_buf = realloc(t->buf, needed);
+        if (!new_buf) return -1;
+        t->buf = new_buf;
+        t->m = needed;
+    }
+    return 0;
+}
+
+static int text_fallback(sam_text_t *t, const bam1_t *b){
+    t->ks.l = 0;
+    if (sam_format1(t->hdr, b, &t->ks) < 0) return -1;
+    if (text_reserve(t, t->ks.l + 1) != 0) return -1;
+    memcpy(t->buf + t->l, t->ks.s, t->ks.l);
+    t->l += t->ks.l;
+    t->buf[t->l++] = '\n';
+    return 0;
+}
+
+/* the output matches sam_format1(); records with tags of the types f, d and B fall back to it */
+static int text_format1(sam_text_t *t, const bam1_t *b){
+    const bam1_core_t *c = &b->core;
+    const uint32_t *cigar = bam_get_cigar(b);
+    const uint8_t *s, *end;
+    size_t needed;
+    char *p;
+    uint32_t i;
+
+    if (c->tid >= t->n_ref || c->mtid >= t->n_ref) return text_fallback(t, b);
+    needed = c->l_qname + 16 * 21 + 11 * (size_t)c->n_cigar + 2 * (size_t)c->l_qseq + 4 * (size_t)bam_get_l_aux(b);
+    if (c->tid >= 0) needed += t->name_len[c->tid];
+    if (c->mtid >= 0) needed += t->name_len[c->mtid];
+    if (text_reserve(t, needed) != 0) return -1;
+    p = t->buf + t->l;
+
+    memcpy(p, bam_get_qname(b), c->l_qname - c->l_extranul - 1);
+    p += c->l_qname - c->l_extranul - 1;
+    *p++ = '\t';
+    p = text_putu(p, c->flag);
+    *p++ = '\t';
+    if (c->tid >= 0) {
+        memcpy(p, t->name[c->tid], t->name_len[c->tid]);
+        p += t->name_len[c->tid];
+    } else *p++ = '*';
+    *p++ = '\t';
+    p = text_puti(p, c->pos + 1);
+    *p++ = '\t';
+    p = text_putu(p, c->qual);
+    *p++ = '\t';
+    if (c->n_cigar) {
+        for (i = 0; i < c->n_cigar; ++i){
+            p = text_putu(p, bam_cigar_oplen(cigar[i]));
+            *p++ = bam_cigar_opchr(cigar[i]);
+        }
+    } else *p++ = '*';
+    *p++ = '\t';
+    if (c->mtid < 0) *p++ = '*';
+    else if (c->mtid == c->tid) *p++ = '=';
+    else {
+        memcpy(p, t->name[c->mtid], t->name_len[c->mtid]);
+        p += t->name_len[c->mtid];
+    }
+    *p++ = '\t';
+    p = text_puti(p, c->mpos + 1);
+    *p++ = '\t';
+    p = text_puti(p, c->isize);
+    *p++ = '\t';
+    if (c->l_qseq) {
+        s = bam_get_seq(b);
+        for (i = 0; i + 1 < (uint32_t)c->l_qseq; i += 2, p += 2) memcpy(p, text_seq2[s[i >> 1]], 2);
+        if (i < (uint32_t)c->l_qseq) *p++ = text_seq2[s[i >> 1]][0];
+        *p++ = '\t';
+        s = bam_get_qual(b);
+        if (s[0] == 0xff) *p++ = '*';
+        else for (i = 0; i < (uint32_t)c->l_qseq; ++i) *p++ = (char)(s[i] + 33);
+    } else {
+        memcpy(p, "*\t*", 3);
+        p += 3;
+    }
+
+    s = bam_get_aux(b);
+    end = b->data + b->l_data;
+    while (end - s >= 4){
+        *p++ = '\t';
+        *p++ = (char)s[0];
+        *p++ = (char)s[1];
+        *p++ = ':';
+        switch (s[2]){
+            case 'A':
+                *p++ = 'A'; *p++ = ':'; *p++ = (char)s[3];
+                s += 4;
+                break;
+            case 'c':
+                *p++ = 'i'; *p++ = ':'; p = text_puti(p, (int8_t)s[3]);
+                s += 4;
+                break;
+            case 'C':
+                *p++ = 'i'; *p++ = ':'; p = text_putu(p, s[3]);
+                s += 4;
+                break;
+            case 's':
+                if (end - s < 5) return text_fallback(t, b);
+                *p++ = 'i'; *p++ = ':'; p = text_puti(p, le_to_i16(s + 3));
+                s += 5;
+                break;
+            case 'S':
+                if (end - s < 5) return text_fallback(t, b);
+                *p++ = 'i'; *p++ = ':'; p = text_putu(p, le_to_u16(s + 3));
+                s += 5;
+                break;
+            case 'i':
+                if (end - s < 7) return text_fallback(t, b);
+                *p++ = 'i'; *p++ = ':'; p = text_puti(p, le_to_i32(s + 3));
+                s += 7;
+                break;
+            case 'I':
+                if (end - s < 7) return text_fallback(t, b);
+                *p++ = 'i'; *p++ = ':'; p = text_putu(p, le_to_u32(s + 3));
+                s += 7;
+                break;
+            case 'Z':
+            case 'H': {
+                const uint8_t *z = memchr(s + 3, '\0', end - s - 3);
+                if (!z) return text_fallback(t, b);
+                *p++ = (char)s[2]; *p++ = ':';
+                memcpy(p, s + 3, z - s - 3);
+                p += z - s - 3;
+                s = z + 1;
+                break;
+            }
+            default:
+                /* nothing was committed to the buffer yet, t->l still points at the start of the record */
+                return text_fallback(t, b);
+        }
+    }
+    *p++ = '\n';
+    t->l = p - t->buf;
+    return 0;
+}
+
+static void *text_worker(void *arg){
+    sam_text_t *t = arg;
+    bam_vector_t *chunk;
+    int error;
+    while (1){
+        pthread_mutex_lock(&t->lock);
+        while (!t->chunk && !t->done) pthread_cond_wait(&t->has_chunk, &t->lock);
+        if (!t->chunk) {pthread_mutex_unlock(&t->lock); break;}
+        chunk = t->chunk;
+        pthread_mutex_unlock(&t->lock);
+
+        error = 0;
+        for (size_t i = 0; i < chunk->size && !error; ++i) if (text_format1(t, chunk->data[i]) != 0) error = 1;
+
+        pthread_mutex_lock(&t->lock);
+        t->chunk = NULL;
+        if (error) t->error = 1;
+        pthread_cond_signal(&t->has_free);
+        pthread_mutex_unlock(&t->lock);
+        if (error) break;
+    }
+    return NULL;
+}
+
+/* pass the filled vector to the thread once it is done with the previous one */
+static int text_handoff(sam_text_t *t){
+    pthread_mutex_lock(&t->lock);
+    while (t->chunk && !t->error) pthread_cond_wait(&t->has_free, &t->lock);
+    if (t->error) {pthread_mutex_unlock(&t->lock); return -1;}
+    t->chunk = t->vec[t->cur];
+    t->cur ^= 1;
+    t->vec[t->cur]->size = 0;
+    pthread_cond_signal(&t->has_chunk);
+    pthread_mutex_unlock(&t->lock);
+    return 0;
+}
+
+static void text_join(sam_text_t *t){
+    if (!t->started) return;
+    pthread_mutex_lock(&t->lock);
+    t->done = 1;
+    pthread_cond_signal(&t->has_chunk);
+    pthread_mutex_unlock(&t->lock);
+    pthread_join(t->thread, NULL);
+    t->started = 0;
+}
+
+sam_text_t *sam_text_init(samFile *fp, sam_hdr_t *hdr, int use_thread){
+    sam_text_t *t;
+    int i;
+    pthread_once(&text_seq2_once, text_seq2_init);
+    if (!(t = calloc(1, sizeof(*t)))) return NULL;
+    t->fp = fp;
+    t->hdr = hdr;
+    t->n_ref = sam_hdr_nref(hdr);
+    if (t->n_ref > 0 && (!(t->name = malloc(t->n_ref * sizeof(*t->name))) || !(t->name_len = malloc(t->n_ref * sizeof(*t->name_len))))) goto clean_up;
+    for (i = 0; i < t->n_ref; ++i){
+        t->name[i] = sam_hdr_tid2name(hdr, i);
+        t->name_len[i] = strlen(t->name[i]);
+    }
+    t->m = TRANSMAP_TEXT_BUFFER;
+    if (!(t->buf = malloc(t->m))) goto clean_up;
+    if (use_thread){
+        if (!(t->vec[0] = bam_vector_init()) || !(t->vec[1] = bam_vector_init())) goto clean_up;
+        pthread_mutex_init(&t->lock, NULL);
+        pthread_cond_init(&t->has_chunk, NULL);
+        pthread_cond_init(&t->has_free, NULL);
+        t->use_thread = 1;
+        if (pthread_create(&t->thread, NULL, text_worker, t) != 0) goto clean_up;
+        t->started = 1;
+    }
+    return t;
+
+    clean_up:
+    sam_text_destroy(t);
+    return NULL;
+}
+
+int sam_text_write1(sam_text_t *t, const bam1_t *b){
+    bam_vector_t *bv;
+    bam1_t *b1;
+    if (!t->use_thread) return text_format1(t, b);
+    bv = t->vec[t->cur];
+    if (!(b1 = bam_vector_next(bv)) || !bam_copy1(b1, b)) return -1;
+    if (++bv->size >= TRANSMAP_TEXT_CHUNK) return text_handoff(t);
+    return 0;
+}
+
+int sam_text_finish(sam_text_t *t){
+    int ret = 0;
+    if (t->use_thread){
+        if (t->vec[t->cur]->size > 0 && text_handoff(t) != 0) ret = -1;
+        text_join(t);
+        if (t->error) ret = -1;
+    }
+    if (ret == 0 && text_flush(t) != 0) ret = -1;
+    return ret;
+}
+
+void sam_text_destroy(sam_text_t *t){
+    if (!t) return;
+    if (t->use_thread){
+        text_join(t);
+        pthread_cond_destroy(&t->has_free);
+        pthread_cond_destroy(&t->has_chunk);
+        pthread_mutex_destroy(&t->lock);
+    }
+    if (t->vec[0]) bam_vector_destroy(t->vec[0]);
+    if (t->vec[1]) bam_vector_destroy(t->vec[1]);
+    free(t->name);
+    free(t->name_len);
+    free(t->buf);
+    ks_free(&t->ks);
+    free(t);
+}
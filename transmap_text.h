@@ -0,0 +1,79 @@
+/* The MIT License (MIT)
+
+   Copyright (c) 2023 Anrui Liu <liuar6@gmail.com>
+
+   Permission is hereby granted, free of charge, to any person obtaining
+   a copy of this software and associated documentation files (the
+   “Software”), to deal in the Software without restriction, including
+   without limitation the rights to use, copy, modify, merge, publish,
+   distribute, sublicense, and/or sell copies of the Software, and to
+   permit persons to whom the Software is furnished to do so, subject to
+   the following conditions:
+
+   The above copyright notice and this permission notice shall be
+   included in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+   EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+   MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+   NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+   BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+   ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+   CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+ */
+
+#ifndef __TRANSMAP_TEXT_H
+#define __TRANSMAP_TEXT_H
+
+#include <stdint.h>
+#include <string.h>
+#include "htslib/sam.h"
+
+/* records handed to the formatting thread at once */
+#define TRANSMAP_TEXT_CHUNK 4096
+/* size of the text buffer passed to a single hwrite() */
+#define TRANSMAP_TEXT_BUFFER (1u << 20u)
+
+/* integer formatting shared by the text writers, returning the end of the written digits */
+static const char text_digits[201] =
+        "0001020304050607080910111213141516171819202122232425262728293031323334353637383940414243444546474849"
+        "5051525354555657585960616263646566676869707172737475767778798081828384858687888990919293949596979899";
+
+static inline char *text_putu(char *p, uint64_t v){
+    char tmp[20], *q = tmp + 20;
+    unsigned int d;
+    while (v >= 100){
+        d = (unsigned int)(v % 100) << 1u;
+        v /= 100;
+        *--q = text_digits[d + 1];
+        *--q = text_digits[d];
+    }
+    if (v >= 10){
+        d = (unsigned int)v << 1u;
+        *--q = text_digits[d + 1];
+        *--q = text_digits[d];
+    } else *--q = (char)('0' + v);
+    memcpy(p, q, tmp + 20 - q);
+    return p + (tmp + 20 - q);
+}
+
+static inline char *text_puti(char *p, int64_t v){
+    if (v < 0) {
+        *p++ = '-';
+        return text_putu(p, -(uint64_t)v);
+    }
+    return text_putu(p, (uint64_t)v);
+}
+
+typedef struct sam_text_s sam_text_t;
+
+/* SAM text encoder writing to the uncompressed output fp after its header. The reference names are taken once from
+ * hdr, which must outlive the encoder. With use_thread the records are copied and formatted on a separate thread. */
+sam_text_t *sam_text_init(samFile *fp, sam_hdr_t *hdr, int use_thread);
+int sam_text_write1(sam_text_t *t, const bam1_t *b);
+/* format the remaining records and flush them to fp */
+int sam_text_finish(sam_text_t *t);
+void sam_text_destroy(sam_text_t *t);
+
+#endif /* __TRANSMAP_TEXT_H */